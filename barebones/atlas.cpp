@@ -0,0 +1,66 @@
+#include "atlas.hpp"
+#include <algorithm>
+#include <climits>
+
+atlas_t::atlas_t(int w,int h): width(w), height(h), used(0) {
+	const run_t floor = {0,0,w};
+	skyline.push_back(floor);
+}
+
+// whether a rectangle with its left edge at the start of a run fits, and the y it would sit at
+bool atlas_t::fits(size_t run,int w,int h,int& y) const {
+	if(skyline[run].x+w > width)
+		return false;
+	y = 0;
+	for(int left=w; left>0; left-=skyline[run++].width) {
+		y = std::max(y,skyline[run].y);
+		if(y+h > height)
+			return false;
+	}
+	return true;
+}
+
+bool atlas_t::add(int w,int h,int& x,int& y) {
+	if((w <= 0) || (h <= 0))
+		return false;
+	size_t best = skyline.size();
+	int best_top = INT_MAX, best_width = INT_MAX;
+	for(size_t i=0; i<skyline.size(); i++) {
+		int top;
+		if(!fits(i,w,h,top))
+			continue;
+		top += h;
+		if((top < best_top) || ((top == best_top) && (skyline[i].width < best_width))) {
+			best = i;
+			best_top = top;
+			best_width = skyline[i].width;
+		}
+	}
+	if(best == skyline.size())
+		return false;
+	x = skyline[best].x;
+	y = best_top-h;
+	// the new run covers the start of those it sits on
+	const run_t run = {x,best_top,w};
+	skyline.insert(skyline.begin()+best,run);
+	for(size_t i=best+1; i<skyline.size(); ) {
+		const int overlap = skyline[i-1].x+skyline[i-1].width-skyline[i].x;
+		if(overlap <= 0)
+			break;
+		if(overlap < skyline[i].width) {
+			skyline[i].x += overlap;
+			skyline[i].width -= overlap;
+			break;
+		}
+		skyline.erase(skyline.begin()+i);
+	}
+	// and runs of the same height are merged
+	for(size_t i=1; i<skyline.size(); )
+		if(skyline[i-1].y == skyline[i].y) {
+			skyline[i-1].width += skyline[i].width;
+			skyline.erase(skyline.begin()+i);
+		} else
+			i++;
+	used += (long)w*h;
+	return true;
+}
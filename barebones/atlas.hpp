@@ -0,0 +1,27 @@
+#ifndef __ATLAS_HPP__
+#define __ATLAS_HPP__
+
+#include <vector>
+#include <cstddef>
+
+// places rectangles in a page without overlap, by the skyline bottom-left heuristic of
+// Jylanki's "A Thousand Ways to Pack the Bin": the top edge of what has been placed so far is
+// kept as runs of equal height, and each rectangle goes where its top would be lowest, ties
+// going to the narrowest run. Nothing is ever removed. Units are up to the caller; sizes that
+// are all multiples of some alignment get positions that are too.
+class atlas_t {
+public:
+	atlas_t(int width,int height);
+	bool add(int width,int height,int& x,int& y); // false if it doesn't fit
+	float occupancy() const { return (float)used/((float)width*height); }
+private:
+	bool fits(size_t run,int w,int h,int& y) const;
+	struct run_t {
+		int x, y, width;
+	};
+	std::vector<run_t> skyline; // left to right, covering the width
+	int width, height;
+	long used;
+};
+
+#endif//__ATLAS_HPP__
@@ -0,0 +1,75 @@
+#include "frustum.hpp"
+#include <cmath>
+#ifdef __SSE2__
+	#include <emmintrin.h>
+#endif
+
+void frustum_t::set(const glm::mat4& m) {
+	// Gribb & Hartmann: each plane is the last row of the matrix plus or minus another row;
+	// they are not normalized, as only the signs of distances are ever used
+	for(int i=0; i<6; i++) {
+		const int row = i/2;
+		const float sign = (i&1)? -1: 1;
+		x[i] = m[0][3]+sign*m[0][row];
+		y[i] = m[1][3]+sign*m[1][row];
+		z[i] = m[2][3]+sign*m[2][row];
+		w[i] = m[3][3]+sign*m[3][row];
+	}
+	for(int i=6; i<PLANES; i++) {
+		x[i] = y[i] = z[i] = 0;
+		w[i] = 1;
+	}
+	for(int i=0; i<PLANES; i++) {
+		abs_x[i] = fabsf(x[i]);
+		abs_y[i] = fabsf(y[i]);
+		abs_z[i] = fabsf(z[i]);
+	}
+}
+
+frustum_t::cull_t frustum_t::test(const glm::vec3& min,const glm::vec3& max) const {
+	// the box's centre is d from each plane, and its corners reach r either side of that
+#ifdef __SSE2__
+	const __m128 half = _mm_set1_ps(0.5f),
+		min_x = _mm_set1_ps(min.x), min_y = _mm_set1_ps(min.y), min_z = _mm_set1_ps(min.z),
+		max_x = _mm_set1_ps(max.x), max_y = _mm_set1_ps(max.y), max_z = _mm_set1_ps(max.z),
+		c_x = _mm_mul_ps(_mm_add_ps(min_x,max_x),half), e_x = _mm_mul_ps(_mm_sub_ps(max_x,min_x),half),
+		c_y = _mm_mul_ps(_mm_add_ps(min_y,max_y),half), e_y = _mm_mul_ps(_mm_sub_ps(max_y,min_y),half),
+		c_z = _mm_mul_ps(_mm_add_ps(min_z,max_z),half), e_z = _mm_mul_ps(_mm_sub_ps(max_z,min_z),half);
+	int outside = 0, straddles = 0;
+	for(int i=0; i<PLANES; i+=4) {
+		const __m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_loadu_ps(x+i),c_x),_mm_mul_ps(_mm_loadu_ps(y+i),c_y)),
+				_mm_add_ps(_mm_mul_ps(_mm_loadu_ps(z+i),c_z),_mm_loadu_ps(w+i))),
+			r = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_loadu_ps(abs_x+i),e_x),_mm_mul_ps(_mm_loadu_ps(abs_y+i),e_y)),
+				_mm_mul_ps(_mm_loadu_ps(abs_z+i),e_z));
+		outside |= _mm_movemask_ps(_mm_cmplt_ps(_mm_add_ps(d,r),_mm_setzero_ps()));
+		straddles |= _mm_movemask_ps(_mm_cmplt_ps(_mm_sub_ps(d,r),_mm_setzero_ps()));
+	}
+	return outside? OUTSIDE: straddles? INTERSECTS: INSIDE;
+#else
+	const glm::vec3 c((min.x+max.x)/2,(min.y+max.y)/2,(min.z+max.z)/2),
+		e((max.x-min.x)/2,(max.y-min.y)/2,(max.z-min.z)/2);
+	cull_t cull = INSIDE;
+	for(int i=0; i<6; i++) {
+		const float d = x[i]*c.x+y[i]*c.y+z[i]*c.z+w[i],
+			r = abs_x[i]*e.x+abs_y[i]*e.y+abs_z[i]*e.z;
+		if(d+r < 0)
+			return OUTSIDE;
+		if(d-r < 0)
+			cull = INTERSECTS;
+	}
+	return cull;
+#endif
+}
+
+void frustum_t::transform(const glm::mat4& m,glm::vec3& min,glm::vec3& max) {
+	// Arvo: each axis of the new box is the translation plus the least and most each column adds
+	glm::vec3 new_min(m[3][0],m[3][1],m[3][2]), new_max(new_min);
+	for(int col=0; col<3; col++)
+		for(int row=0; row<3; row++) {
+			const float a = m[col][row]*min[col], b = m[col][row]*max[col];
+			new_min[row] += (a < b)? a: b;
+			new_max[row] += (a < b)? b: a;
+		}
+	min = new_min;
+	max = new_max;
+}
@@ -0,0 +1,24 @@
+#ifndef __FRUSTUM_HPP__
+#define __FRUSTUM_HPP__
+
+#include "../external/ogl-math/glm/glm.hpp"
+
+// the six clip planes of a projection; made from projection*modelview they are in the
+// model's own space, so its bounding boxes can be tested as they are
+class frustum_t {
+public:
+	frustum_t() {}
+	explicit frustum_t(const glm::mat4& matrix) { set(matrix); }
+	void set(const glm::mat4& matrix);
+	enum cull_t { OUTSIDE, INTERSECTS, INSIDE };
+	cull_t test(const glm::vec3& min,const glm::vec3& max) const;
+	static void transform(const glm::mat4& matrix,glm::vec3& min,glm::vec3& max); // the box around a transformed box
+private:
+	// planes side by side, four at a time for SSE, padded with planes everything is inside of;
+	// the absolute normals go with the box's half-size to get its reach along each normal
+	enum { PLANES = 8 };
+	float x[PLANES], y[PLANES], z[PLANES], w[PLANES],
+		abs_x[PLANES], abs_y[PLANES], abs_z[PLANES];
+};
+
+#endif//__FRUSTUM_HPP__
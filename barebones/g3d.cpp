@@ -1,141 +1,298 @@
 #include "g3d.hpp"
+#include "profile.hpp"
+#include "gl_state.hpp"
 #include <iostream>
 #include <limits>
 
-struct g3d_t::mesh_t: private main_t::texture_load_t {
+struct g3d_t::mesh_t: public g3d_data_t::mesh_t, private main_t::texture_load_t {
 public:
-	mesh_t(g3d_t& g3d,binary_reader_t& in,char ver);
+	// how the arrays are stored in g3d's vbo and ibo; the frames follow each other, then the tex_frames
+	struct layout_t {
+		layout_t(const g3d_data_t::mesh_t& mesh,bool quantize,bool with_lods);
+		GLenum normal_type, tex_type; // GL_FLOAT unless quantized
+		GLsizei vn_stride, tex_stride;
+		size_t vn_ofs, t_ofs, i_ofs, vn_bytes, t_bytes, i_bytes;
+		size_t lods; // the full triangles then the simpler versions, one after another from i_ofs
+		size_t lod_ofs[g3d_data_t::MAX_LODS];
+		GLsizei lod_index_count[g3d_data_t::MAX_LODS];
+	};
+	mesh_t(g3d_t& g3d,const g3d_data_t::mesh_t& data,const layout_t& layout);
 	virtual ~mesh_t();
-	void draw(float time,const glm::mat4& projection,const glm::mat4& modelview,const glm::vec3& light_0,bool cycles,const glm::vec4& colour);
-	bool is_ready() const { return i_vbo && (!(textures&1) || texture); }
+	void draw(float time,const glm::mat4& projection,const glm::mat4& modelview,const glm::vec3& light_0,bool cycles,const glm::vec4& colour,size_t lod);
+	void draw(const instance_t* instances,const glm::mat4& projection,const glm::vec3& light_0,bool cycles); // g3d.instance_visible
+	void pick_frame(float time,bool cycles,size_t& frame_0,size_t& frame_1,float& lerp,size_t& tex_frame) const;
+	bool is_ready() const { return g3d.ibo && (!(textures&1) || texture); }
 	g3d_t& g3d;
-	std::string name;
-	uint32_t frame_count, vertex_count, index_count, textures, tex_frame_count;
-	GLfloat* vn_data;
-	GLfloat* t_data;
-	GLushort* i_data;
-	GLuint* vn_vbo; // per frame
-	GLuint* t_vbo; // per tex_frame
-	GLuint i_vbo;
+	const layout_t layout;
+	size_t tex_frames() const { return (textures&1)? tex_frame_count: 1; }
+	GLuint* vao; // per frame and tex_frame; NULL without vertex array objects
+	uint32_t bind_arrays(GLuint vertex_0,GLuint normal_0,GLuint vertex_1,GLuint normal_1,GLuint tex,size_t frame_0,size_t tex_frame);
+	bool packable; // its texture may be put in an atlas page
+	std::vector<GLfloat> packed_t_data; // t_data moved into the texture's rect of its page
+	void upload_t(); // t_data
+	void drop_cpu_data();
 	GLuint texture, program,
 		uniform_mvp_matrix, uniform_normal_matrix, uniform_light_0, uniform_colour,
 		attrib_vertex_0, attrib_normal_0,
 		attrib_vertex_1, attrib_normal_1, uniform_lerp,
 		attrib_tex;
-	glm::vec3 min, max;
+	struct instanced_t { // the instanced variant of program, if there is one
+		GLuint program,
+			uniform_light_0,
+			attrib_mvp_matrix, attrib_normal_matrix, attrib_colour, attrib_lerp,
+			attrib_vertex_0, attrib_normal_0,
+			attrib_vertex_1, attrib_normal_1,
+			attrib_tex;
+		GLuint* vao;
+		uint32_t bind_arrays(mesh_t& mesh,size_t frame_0,size_t tex_frame);
+	} instanced;
 private:
-	void on_texture_loaded(const std::string& name,GLuint handle,intptr_t data);
+	void on_texture_loaded(const std::string& name,GLuint handle,const main_t::texture_rect_t& rect,intptr_t data);
 	enum { LOAD_TEXTURE };
 };
 
-g3d_t::g3d_t(main_t& m,const std::string& fn,loaded_t* o,intptr_t od): main(m), filename(fn),
-	observer(o), observer_data(od) {
-	main.read_file(filename,this,LOAD_G3D);
+namespace {
+	// instance records, as uploaded: MVP_MATRIX, NORMAL_MATRIX, COLOUR then LERP
+	enum {
+		INSTANCE_MVP_MATRIX = 0,
+		INSTANCE_NORMAL_MATRIX = 16,
+		INSTANCE_COLOUR = 16+9,
+		INSTANCE_LERP = 16+9+4,
+		INSTANCE_FLOATS
+	};
+
+	void draw_elements_instanced(GLsizei count,GLsizei instances,size_t offset) {
+	#ifndef __native_client__
+		if(GLEW_VERSION_3_3)
+			glDrawElementsInstanced(GL_TRIANGLES,count,GL_UNSIGNED_SHORT,(void*)offset,instances);
+		else
+			glDrawElementsInstancedARB(GL_TRIANGLES,count,GL_UNSIGNED_SHORT,(void*)offset,instances);
+	#endif
+	}
+
+	int snorm(float v,int max) {
+		return (int)floorf(std::min(std::max(v,-1.0f),1.0f)*max+0.5f);
+	}
+
+	// positions as normalized shorts within the model's bounds, padded to four, then the normal
+	// as normalized bytes or packed into 2_10_10_10
+	void quantize_vn(const GLfloat* src,size_t count,const glm::vec3& centre,const glm::vec3& extent,GLenum normal_type,uint8_t* dest) {
+		for(size_t v=0; v<count; v++, src+=6, dest+=4*sizeof(GLshort)+4) {
+			GLshort pos[4] = {0,0,0,0};
+			for(int i=0; i<3; i++)
+				pos[i] = snorm((src[i]-centre[i])/extent[i],32767);
+			memcpy(dest,pos,sizeof(pos));
+			if(GL_BYTE == normal_type) {
+				const GLbyte normal[4] = {(GLbyte)snorm(src[3],127),(GLbyte)snorm(src[4],127),(GLbyte)snorm(src[5],127),0};
+				memcpy(dest+sizeof(pos),normal,sizeof(normal));
+			} else {
+				uint32_t normal = 0;
+				for(int i=0; i<3; i++)
+					normal |= (snorm(src[3+i],511)&0x3ff) << (i*10);
+				memcpy(dest+sizeof(pos),&normal,sizeof(normal));
+			}
+		}
+	}
+
+	GLushort half_float(float v) {
+		uint32_t f;
+		memcpy(&f,&v,sizeof(f));
+		const uint32_t sign = (f>>16)&0x8000, mantissa = f&0x7fffff;
+		const int exponent = (int)((f>>23)&0xff)-127+15;
+		if(exponent <= 0)
+			return sign; // too small; flush to zero
+		if(exponent >= 31)
+			return sign|0x7c00; // too big; infinity
+		return (sign|(exponent<<10)|(mantissa>>13))+((mantissa>>12)&1); // rounded; a carry into the exponent is still right
+	}
+
+	void quantize_t(const GLfloat* src,size_t count,GLenum type,GLushort* dest) {
+		for(size_t i=0; i<count; i++)
+			dest[i] = (GL_UNSIGNED_SHORT == type)? (GLushort)floorf(src[i]*65535+0.5f): half_float(src[i]);
+	}
+
+	// a per-instance attribute of columns*rows floats at offset in the instance records
+	uint32_t instance_attrib(GLuint buffer,GLuint loc,int columns,int rows,size_t first,size_t offset) {
+		const GLsizei stride = INSTANCE_FLOATS*sizeof(GLfloat);
+		uint32_t attribs = 0;
+		for(int c=0; c<columns; c++) {
+			gl_state_t::vertex_attrib(loc+c,buffer,rows,GL_FLOAT,GL_FALSE,stride,(first*INSTANCE_FLOATS+offset+c*rows)*sizeof(GLfloat),1);
+			attribs |= 1<<(loc+c);
+		}
+		return attribs;
+	}
+} // anon namespace
+
+g3d_t::g3d_t(main_t& m,const std::string& fn,loaded_t* o,intptr_t od,unsigned f): main(m), filename(fn), flags(f),
+	lod_threshold(0.25f), vbo(0), ibo(0), quantized(false),
+	model_min(FLT_MAX,FLT_MAX,FLT_MAX), model_max(-FLT_MAX,-FLT_MAX,-FLT_MAX), radius(0), instance_vbo(0), instance_vbo_is_base(false), observer(o), observer_data(od) {
+	// use the cache if it is at least as new as the model
+	const int64_t cache_mtime = main_t::file_mtime(g3d_data_t::cache_path(filename));
+	if((cache_mtime >= 0) && (cache_mtime >= main_t::file_mtime(filename)))
+		main.read_file(g3d_data_t::cache_path(filename),this,LOAD_CACHE);
+	else
+		main.read_file(filename,this,LOAD_G3D);
 }
 
-void g3d_t::on_io(const std::string& name,bool ok,const std::string& bytes,intptr_t data) {
+void g3d_t::on_io(const std::string& name,bool ok,const bytes_t& bytes,intptr_t data) {
 	try {
-		if(!ok || !bytes.size())
-			data_error("could not load");
-		if(LOAD_G3D == data) {
-			binary_reader_t in(bytes);
-			const uint32_t ver = in.uint32();
-			// note the endian here is little endian
-			if(((ver&0xff)!='G')||(((ver>>8)&0xff)!='3')||(((ver>>16)&0xff)!='D'))
-				data_error("(" << std::hex << ver << ") is not a G3D model");
-			switch(ver>>24) {
-			//case 3: {
-			//} break;
-			case 4: {
-				const uint16_t mesh_count = in.uint16();
-				if(!mesh_count) data_error("has no meshes");
-				if(in.byte()) data_error("not a G3D mtMorphMesh");
-				for(int16_t i=0; i<mesh_count; i++)
-					meshes.push_back(new mesh_t(*this,in,ver>>24));
-			} break;
-			default: data_error("not a supported G3D model version (" << (ver&0xff) << ")");
+		g3d_data_t g3d_data;
+		bool save = false;
+		if(LOAD_CACHE == data) {
+			if(!ok || !g3d_data.load_cache(bytes)) {
+				main.read_file(filename,this,LOAD_G3D);
+				return;
 			}
+		} else if(LOAD_G3D == data) {
+			if(!ok || !bytes.size())
+				data_error("could not load");
+			g3d_data.load_g3d(filename,bytes);
+			save = true;
 		} else
 			data_error("stray io " << name << ',' << data);
+		if((flags & LODS) && !g3d_data.lods_made) {
+			size_t before = 0, after = 0;
+			g3d_data.make_lods();
+			for(g3d_data_t::meshes_t::const_iterator m=g3d_data.meshes.begin(); m!=g3d_data.meshes.end(); m++) {
+				before += m->index_count/3;
+				after += m->lods.size()? m->lods.back().index_count/3: m->index_count/3;
+			}
+			std::cout << "made LODs of " << filename << ": " << before << " -> " << after << " triangles" << std::endl;
+			save = true;
+		}
+		if((flags & OPTIMISE) && !g3d_data.optimised) {
+			const g3d_data_t::vertex_cache_stats_t before = g3d_data.vertex_cache_stats();
+			g3d_data.optimise();
+			const g3d_data_t::vertex_cache_stats_t after = g3d_data.vertex_cache_stats();
+			std::cout << "optimised " << filename << ": " << before.vertices << " -> " << after.vertices << " vertices, ACMR " <<
+				before.acmr() << " -> " << after.acmr() << ", ATVR " << before.atvr() << " -> " << after.atvr() << std::endl;
+			save = true;
+		}
+		if(save)
+			main.write_file(g3d_data_t::cache_path(filename),g3d_data.save_cache());
+		create_meshes(g3d_data);
 	} catch(std::exception& e) {
 		std::cerr << "ERROR loading G3D " << filename << ": " << e.what() << std::endl;
-		meshes.clear();
-		ok = false;
+		clear();
 	}
 }
 
-g3d_t::mesh_t::mesh_t(g3d_t& g,binary_reader_t& in,char ver):
-	g3d(g),
-	vn_data(NULL), t_data(NULL), i_data(NULL), vn_vbo(NULL), t_vbo(NULL), i_vbo(0),
-	texture(0), program(0),
-	min(FLT_MAX/2,FLT_MAX/2,FLT_MAX/2), max(-FLT_MAX/2,-FLT_MAX/2,-FLT_MAX/2) {
-	if(ver==4) {
-		name = std::string(in.fixed_str<64>().c_str());
-		frame_count = in.uint32(); if(!frame_count) data_error(name << " has no frames");
-		vertex_count = in.uint32(); if(!vertex_count) data_error(name << " has no vertices");
-		index_count = in.uint32(); if(!index_count) data_error(name << " has no indices");
-		if(index_count%3) data_error(name << " bad number of indices: " << index_count);
-		in.skip(9*4);
-		textures = in.uint32();
-		for(int t=0; t<5; t++)
-			if((1<<t)&textures) {
-				const std::string path = std::string(in.fixed_str<64>().c_str());
-				if(t==0) // diffuse?
-					g3d.main.load_texture(g3d.main.relpath(g3d.filename,path),this,LOAD_TEXTURE);
-			}
-		tex_frame_count = textures?1:0;
-	}
-	const size_t vn_size = vertex_count*frame_count*6;
-	vn_data = new GLfloat[vn_size];
-	for(int pass=0; pass<2; pass++) //0==vertices,1==normals
-		for(uint32_t f=0; f<frame_count; f++)
-			for(uint32_t v=0; v<vertex_count; v++)
-				for(int j=0; j<3; j++) {
-					const size_t slot = f*vertex_count*6 + v*6 + pass*3 + j;
-					assert(slot < vn_size);
-					vn_data[slot] = in.float32();
-					min[j] = std::min(vn_data[slot],min[j]);
-					max[j] = std::max(vn_data[slot],max[j]);
-				}
-	vn_vbo = new GLuint[frame_count];
-	glGenBuffers(frame_count,vn_vbo);
-	glCheck();
-	for(uint32_t f=0; f<frame_count; f++) {
-		glBindBuffer(GL_ARRAY_BUFFER,vn_vbo[f]);
-		glBufferData(GL_ARRAY_BUFFER,vertex_count*6*sizeof(GLfloat),vn_data+f*vertex_count*6,GL_STATIC_DRAW);
-		glBindBuffer(GL_ARRAY_BUFFER,0);
-		glCheck();
+void g3d_t::create_meshes(const g3d_data_t& data) {
+	quantized = flags & QUANTIZE;
+	std::vector<mesh_t::layout_t> layouts;
+	size_t vn_size = 0, i_size = 0;
+	glm::vec3 min(FLT_MAX,FLT_MAX,FLT_MAX), max(-FLT_MAX,-FLT_MAX,-FLT_MAX);
+	for(g3d_data_t::meshes_t::const_iterator m=data.meshes.begin(); m!=data.meshes.end(); m++) {
+		for(int i=0; i<3; i++) {
+			min[i] = std::min(min[i],m->min[i]);
+			max[i] = std::max(max[i],m->max[i]);
+		}
+		mesh_t::layout_t layout(*m,quantized,flags & LODS);
+		layout.vn_ofs = vn_size;
+		layout.t_ofs = vn_size+layout.vn_bytes;
+		layout.i_ofs = i_size;
+		for(size_t l=0; l<layout.lods; l++)
+			layout.lod_ofs[l] += i_size;
+		vn_size += layout.vn_bytes+layout.t_bytes;
+		i_size += layout.i_bytes;
+		layouts.push_back(layout);
 	}
-	const size_t texture_size = textures?tex_frame_count*vertex_count*2:0;
-	t_data = new GLfloat[texture_size];
-	for(uint32_t f=0; f<tex_frame_count; f++)
-		for(uint32_t v=0; v<vertex_count; v++) {
-			size_t slot = f*vertex_count*2+v*2;
-			assert(slot < texture_size-1);
-			t_data[slot] = in.float32();
-			t_data[slot+1] = 1.-in.float32(); // invert Y
+	model_min = min;
+	model_max = max;
+	centre = glm::vec3((min.x+max.x)/2,(min.y+max.y)/2,(min.z+max.z)/2);
+	radius = sqrtf((max.x-min.x)*(max.x-min.x)+(max.y-min.y)*(max.y-min.y)+(max.z-min.z)*(max.z-min.z))/2;
+	if(quantized) {
+		// positions are stored relative to the bounds of the whole model, so every mesh
+		// and instance shares the one matrix that puts them back
+		dequantize = glm::mat4(1);
+		for(int i=0; i<3; i++) {
+			dequantize[i][i] = std::max((max[i]-min[i])/2,FLT_MIN);
+			dequantize[3][i] = (min[i]+max[i])/2;
 		}
-	t_vbo = new GLuint[tex_frame_count];
-	glGenBuffers(tex_frame_count,t_vbo);
+	}
+	if(gl_state_t::vertex_arrays())
+		gl_state_t::bind_vertex_array(0); // so as not to change the element buffer of another
+	glGenBuffers(1,&vbo);
+	glGenBuffers(1,&ibo);
 	glCheck();
-	for(uint32_t f=0; f<tex_frame_count; f++) {
-		glBindBuffer(GL_ARRAY_BUFFER,t_vbo[f]);
-		glBufferData(GL_ARRAY_BUFFER,vertex_count*2*sizeof(GLfloat),t_data+f*vertex_count*2,GL_STATIC_DRAW);
-		glBindBuffer(GL_ARRAY_BUFFER,0);
-		glCheck();
+	gl_state_t::bind_buffer(GL_ARRAY_BUFFER,vbo);
+	glBufferData(GL_ARRAY_BUFFER,vn_size,NULL,GL_STATIC_DRAW);
+	gl_state_t::bind_buffer(GL_ELEMENT_ARRAY_BUFFER,ibo);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER,i_size,NULL,GL_STATIC_DRAW);
+	glCheck();
+	for(size_t m=0; m<data.meshes.size(); m++)
+		meshes.push_back(new mesh_t(*this,data.meshes[m],layouts[m]));
+}
+
+void g3d_t::clear() {
+	for(meshes_t::iterator m=meshes.begin(); m!=meshes.end(); m++)
+		delete *m;
+	meshes.clear();
+	const GLuint buffers[] = {vbo,ibo};
+	if(vbo)
+		gl_state_t::delete_buffers(2,buffers);
+	vbo = ibo = 0;
+}
+
+g3d_t::mesh_t::layout_t::layout_t(const g3d_data_t::mesh_t& mesh,bool quantize,bool with_lods):
+	normal_type(GL_FLOAT), tex_type(GL_FLOAT),
+	vn_stride(6*sizeof(GLfloat)), tex_stride(2*sizeof(GLfloat)),
+	vn_ofs(0), t_ofs(0), i_ofs(0) {
+	if(quantize) {
+		normal_type = gl_state_t::int_2_10_10_10_attribs()? GL_INT_2_10_10_10_REV: GL_BYTE;
+		vn_stride = 4*sizeof(GLshort)+4;
+		// texture coordinates are normalized if they are all 0..1, else half floats if we can
+		bool unit = true;
+		for(size_t i=0; unit && (i<mesh.tex_frame_count*mesh.vertex_count*2); i++)
+			unit = (mesh.t_data[i] >= 0) && (mesh.t_data[i] <= 1);
+		if(unit)
+			tex_type = GL_UNSIGNED_SHORT;
+		else if(gl_state_t::half_float_attribs())
+			tex_type = GL_HALF_FLOAT;
+		if(GL_FLOAT != tex_type)
+			tex_stride = 2*sizeof(GLushort);
 	}
-	i_data = new GLushort[index_count];
-	for(uint32_t i=0; i<index_count; i++) {
-		i_data[i] = in.uint32();
-		if(i_data[i] >= vertex_count)
-			data_error("index[" << i << "]=" << i_data[i] << " out of bounds (" << vertex_count << ')');
+	vn_bytes = mesh.frame_count*mesh.vertex_count*vn_stride;
+	t_bytes = mesh.tex_frame_count*mesh.vertex_count*tex_stride;
+	lods = 1+(with_lods? mesh.lods.size(): 0); // a cache made with LODS has them either way
+	lod_ofs[0] = 0;
+	lod_index_count[0] = mesh.index_count;
+	for(size_t l=1; l<lods; l++) {
+		lod_ofs[l] = lod_ofs[l-1]+lod_index_count[l-1]*sizeof(GLushort);
+		lod_index_count[l] = mesh.lods[l-1].index_count;
 	}
-	glGenBuffers(1,&i_vbo);
-	glCheck();
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER,i_vbo);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER,index_count*sizeof(GLushort),i_data,GL_STATIC_DRAW);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER,0);
+	i_bytes = lod_ofs[lods-1]+lod_index_count[lods-1]*sizeof(GLushort);
+}
+
+g3d_t::mesh_t::mesh_t(g3d_t& g,const g3d_data_t::mesh_t& data,const layout_t& l):
+	g3d_data_t::mesh_t(data),
+	g3d(g), layout(l),
+	vao(NULL), packable(false), texture(0), program(0) {
+	PROFILE_GPU_ZONE("g3d mesh create");
+	instanced.vao = NULL;
+	if(textures&1) {
+		packable = (g3d.flags & PACK_TEXTURES) && t_data;
+		for(size_t i=0; packable && (i<tex_frame_count*vertex_count*2); i++)
+			packable = (t_data[i] >= 0) && (t_data[i] <= 1);
+		g3d.main.load_texture(texture_path,this,LOAD_TEXTURE,packable);
+	}
+	gl_state_t::bind_buffer(GL_ARRAY_BUFFER,g3d.vbo);
+	if(GL_FLOAT == layout.normal_type)
+		glBufferSubData(GL_ARRAY_BUFFER,layout.vn_ofs,layout.vn_bytes,vn_data);
+	else {
+		std::vector<uint8_t> buf(layout.vn_bytes);
+		const glm::mat4& d = g3d.dequantize;
+		quantize_vn(vn_data,frame_count*vertex_count,glm::vec3(d[3][0],d[3][1],d[3][2]),
+			glm::vec3(d[0][0],d[1][1],d[2][2]),layout.normal_type,&buf[0]);
+		glBufferSubData(GL_ARRAY_BUFFER,layout.vn_ofs,layout.vn_bytes,&buf[0]);
+	}
+	upload_t();
+	gl_state_t::bind_buffer(GL_ELEMENT_ARRAY_BUFFER,g3d.ibo);
+	for(size_t l=0; l<layout.lods; l++)
+		glBufferSubData(GL_ELEMENT_ARRAY_BUFFER,layout.lod_ofs[l],layout.lod_index_count[l]*sizeof(GLushort),l? lods[l-1].i_data: i_data);
 	glCheck();
+	if((g3d.flags & DROP_CPU_DATA) && !packable) // else once the texture is in, as it may move t_data
+		drop_cpu_data();
 	if(1 == frame_count) {
 		program = g3d.main.get_shared_program("g3d_single_frame");
 		graphics_assert(program && "g3d_single_frame"); // provided by game adaptation
@@ -153,107 +310,364 @@ g3d_t::mesh_t::mesh_t(g3d_t& g,binary_reader_t& in,char ver):
 	attrib_vertex_0 = g3d.main.get_attribute_loc(program,"VERTEX_0",GL_FLOAT_VEC3);
 	attrib_normal_0 = g3d.main.get_attribute_loc(program,"NORMAL_0",GL_FLOAT_VEC3);
 	attrib_tex = g3d.main.get_attribute_loc(program,"TEX_COORD_0",GL_FLOAT_VEC2);
-	glUseProgram(program);
+	gl_state_t::use_program(program);
 	glCheck();
 	glUniform1i(g3d.main.get_uniform_loc(program,"TEX_UNIT_0"),0);
+	instanced.program = 0;
+	if(gl_state_t::instancing())
+		instanced.program = g3d.main.get_shared_program((1 == frame_count)? "g3d_single_frame_instanced": "g3d_multi_frame_instanced");
+	if(instanced.program) {
+		const GLuint p = instanced.program;
+		if(1 != frame_count) {
+			instanced.attrib_lerp = g3d.main.get_attribute_loc(p,"LERP",GL_FLOAT);
+			instanced.attrib_vertex_1 = g3d.main.get_attribute_loc(p,"VERTEX_1",GL_FLOAT_VEC3);
+			instanced.attrib_normal_1 = g3d.main.get_attribute_loc(p,"NORMAL_1",GL_FLOAT_VEC3);
+		}
+		instanced.uniform_light_0 = g3d.main.get_uniform_loc(p,"LIGHT_0",GL_FLOAT_VEC3);
+		instanced.attrib_mvp_matrix = g3d.main.get_attribute_loc(p,"MVP_MATRIX",GL_FLOAT_MAT4);
+		instanced.attrib_normal_matrix = g3d.main.get_attribute_loc(p,"NORMAL_MATRIX",GL_FLOAT_MAT3);
+		instanced.attrib_colour = g3d.main.get_attribute_loc(p,"COLOUR",GL_FLOAT_VEC4);
+		instanced.attrib_vertex_0 = g3d.main.get_attribute_loc(p,"VERTEX_0",GL_FLOAT_VEC3);
+		instanced.attrib_normal_0 = g3d.main.get_attribute_loc(p,"NORMAL_0",GL_FLOAT_VEC3);
+		instanced.attrib_tex = g3d.main.get_attribute_loc(p,"TEX_COORD_0",GL_FLOAT_VEC2);
+		gl_state_t::use_program(p);
+		glCheck();
+		glUniform1i(g3d.main.get_uniform_loc(p,"TEX_UNIT_0"),0);
+		if(!g3d.instance_vbo) {
+			glGenBuffers(1,&g3d.instance_vbo);
+			glCheck();
+		}
+	}
+	// a vertex array object for each pairing of frames, and texture frame, that draw can use
+	if(gl_state_t::vertex_arrays()) {
+		const size_t count = frame_count*tex_frames();
+		vao = new GLuint[count];
+		glGenVertexArrays(count,vao);
+		if(instanced.program) {
+			instanced.vao = new GLuint[count];
+			glGenVertexArrays(count,instanced.vao);
+		}
+		glCheck();
+		for(size_t f=0; f<count; f++) {
+			gl_state_t::bind_vertex_array(vao[f]);
+			gl_state_t::use_attribs(bind_arrays(attrib_vertex_0,attrib_normal_0,attrib_vertex_1,attrib_normal_1,attrib_tex,f/tex_frames(),f%tex_frames()));
+			gl_state_t::bind_buffer(GL_ELEMENT_ARRAY_BUFFER,g3d.ibo);
+			if(instanced.program) {
+				gl_state_t::bind_vertex_array(instanced.vao[f]);
+				gl_state_t::use_attribs(instanced.bind_arrays(*this,f/tex_frames(),f%tex_frames()));
+				gl_state_t::bind_buffer(GL_ELEMENT_ARRAY_BUFFER,g3d.ibo);
+			}
+			glCheck();
+		}
+		gl_state_t::bind_vertex_array(0);
+	}
 	if(!(textures&1))
 		g3d.on_ready(this);
-	glUseProgram(0);
+}
+
+void g3d_t::mesh_t::upload_t() { // into the vbo, which is bound
+	if(GL_FLOAT == layout.tex_type)
+		glBufferSubData(GL_ARRAY_BUFFER,layout.t_ofs,layout.t_bytes,t_data);
+	else if(layout.t_bytes) {
+		std::vector<GLushort> buf(layout.t_bytes/sizeof(GLushort));
+		quantize_t(t_data,buf.size(),layout.tex_type,&buf[0]);
+		glBufferSubData(GL_ARRAY_BUFFER,layout.t_ofs,layout.t_bytes,&buf[0]);
+	}
+}
+
+void g3d_t::mesh_t::drop_cpu_data() {
+	vn_data = t_data = NULL;
+	i_data = NULL;
+	lods.clear();
+	std::vector<GLfloat>().swap(packed_t_data);
+	storage = bytes_t();
 }
 
 g3d_t::mesh_t::~mesh_t() {
-	delete[] vn_data;
-	delete[] t_data;
-	if(vn_vbo) glDeleteBuffers(frame_count,vn_vbo);
-	delete[] vn_vbo;
-	if(t_vbo) glDeleteBuffers(tex_frame_count,t_vbo);
-	delete[] t_vbo;
-	delete[] i_data;
-	if(i_vbo) glDeleteBuffers(1,&i_vbo);
+	if((textures&1) && !texture) // still waiting, e.g. when a failed load clears its meshes
+		g3d.main.cancel_load_texture(this,LOAD_TEXTURE);
+	if(vao) gl_state_t::delete_vertex_arrays(frame_count*tex_frames(),vao);
+	delete[] vao;
+	if(instanced.vao) gl_state_t::delete_vertex_arrays(frame_count*tex_frames(),instanced.vao);
+	delete[] instanced.vao;
 }
 
-void g3d_t::mesh_t::draw(float time,const glm::mat4& projection,const glm::mat4& modelview,const glm::vec3& light_0,bool cycles,const glm::vec4& colour) {
-	if(!i_vbo || ((textures&1) && !texture)) {
-		std::cerr << "cannot draw " << g3d.filename << ':' << name << " because it is not initialized (" << i_vbo << ',' << textures << ',' << texture << ')' << std::endl;
+void g3d_t::mesh_t::draw(float time,const glm::mat4& projection,const glm::mat4& modelview,const glm::vec3& light_0,bool cycles,const glm::vec4& colour,size_t lod) {
+	PROFILE_GPU_ZONE("g3d mesh draw");
+	if(!is_ready()) {
+		std::cerr << "cannot draw " << g3d.filename << ':' << name << " because it is not initialized (" << g3d.ibo << ',' << textures << ',' << texture << ')' << std::endl;
 		return;
 	} else if(!frame_count) {
 		std::cerr << "cannot draw " << g3d.filename << ':' << name << " because it has no frames!" << std::endl;
 		return;
 	}
-	const uint32_t frame_count = ((this->frame_count > 1) && !cycles)? this->frame_count-1: this->frame_count; 
-	time = std::min(std::max(time,0.0f),1.0f) * (float)frame_count;
-	const size_t frame_0 = (size_t)time % frame_count;
-	glUseProgram(program);
-	glCheck();
+	size_t frame_0, frame_1, tex_frame;
+	float lerp;
+	pick_frame(time,cycles,frame_0,frame_1,lerp,tex_frame);
+	gl_state_t::use_program(program);
 	glUniform4fv(uniform_colour,1,glm::value_ptr(const_cast<glm::vec4&>(colour)));
 	glUniform3fv(uniform_light_0,1,glm::value_ptr(const_cast<glm::vec3&>(light_0)));
-	glUniformMatrix4fv(uniform_mvp_matrix,1,false,glm::value_ptr(projection*modelview));
+	glUniformMatrix4fv(uniform_mvp_matrix,1,false,glm::value_ptr(g3d.quantized? projection*modelview*g3d.dequantize: projection*modelview));
 	glUniformMatrix3fv(uniform_normal_matrix,1,false,glm::value_ptr(glm::inverse(glm::mat3(modelview))));
+	if(frame_count > 1)
+		glUniform1f(uniform_lerp,lerp);
 	glCheck();
-	const GLsizei stride = 6*sizeof(GLfloat);
-	glBindBuffer(GL_ARRAY_BUFFER,vn_vbo[frame_0]);	
-	glVertexAttribPointer(attrib_vertex_0,3,GL_FLOAT,GL_FALSE,stride,(void*)(0));
-	glEnableVertexAttribArray(attrib_vertex_0);
-	glVertexAttribPointer(attrib_normal_0,3,GL_FLOAT,GL_FALSE,stride,(void*)(3*sizeof(GLfloat)));
-	glEnableVertexAttribArray(attrib_normal_0);
+	gl_state_t::bind_texture(texture);
+	if(vao)
+		gl_state_t::bind_vertex_array(vao[frame_0*tex_frames()+tex_frame]);
+	else {
+		gl_state_t::use_attribs(bind_arrays(attrib_vertex_0,attrib_normal_0,attrib_vertex_1,attrib_normal_1,attrib_tex,frame_0,tex_frame));
+		gl_state_t::bind_buffer(GL_ELEMENT_ARRAY_BUFFER,g3d.ibo);
+	}
+	lod = std::min(lod,layout.lods-1);
+	glDrawElements(GL_TRIANGLES,layout.lod_index_count[lod],GL_UNSIGNED_SHORT,(void*)layout.lod_ofs[lod]);
 	glCheck();
+}
+
+// points a program's attributes at the arrays for frame_0 (and the frame after it, if
+// animated) and tex_frame; returns the attribute arrays to enable
+uint32_t g3d_t::mesh_t::bind_arrays(GLuint vertex_0,GLuint normal_0,GLuint vertex_1,GLuint normal_1,GLuint tex,size_t frame_0,size_t tex_frame) {
+	const bool quantized = (GL_FLOAT != layout.normal_type);
+	const GLenum vertex_type = quantized? GL_SHORT: GL_FLOAT;
+	const GLint normal_size = (GL_INT_2_10_10_10_REV == layout.normal_type)? 4: 3;
+	const size_t normal_ofs = quantized? 4*sizeof(GLshort): 3*sizeof(GLfloat),
+		frame_bytes = vertex_count*layout.vn_stride;
+	const size_t vn_0 = layout.vn_ofs+frame_0*frame_bytes;
+	uint32_t attribs = (1<<vertex_0)|(1<<normal_0);
+	gl_state_t::vertex_attrib(vertex_0,g3d.vbo,3,vertex_type,quantized,layout.vn_stride,vn_0);
+	gl_state_t::vertex_attrib(normal_0,g3d.vbo,normal_size,layout.normal_type,quantized,layout.vn_stride,vn_0+normal_ofs);
 	if(frame_count > 1) {
-		const size_t frame_1 = (frame_0+1) % this->frame_count;
-		const float lerp = fmod(time,1);
-		glUniform1f(uniform_lerp,lerp);
-		glBindBuffer(GL_ARRAY_BUFFER,vn_vbo[frame_1]);	
-		glVertexAttribPointer(attrib_vertex_1,3,GL_FLOAT,GL_FALSE,stride,(void*)(0));
-		glEnableVertexAttribArray(attrib_vertex_1);
-		glVertexAttribPointer(attrib_normal_1,3,GL_FLOAT,GL_FALSE,stride,(void*)(3*sizeof(GLfloat)));
-		glEnableVertexAttribArray(attrib_normal_1);
-		glBindBuffer(GL_ARRAY_BUFFER,0);
-		glCheck();
+		const size_t vn_1 = layout.vn_ofs+((frame_0+1) % frame_count)*frame_bytes;
+		gl_state_t::vertex_attrib(vertex_1,g3d.vbo,3,vertex_type,quantized,layout.vn_stride,vn_1);
+		gl_state_t::vertex_attrib(normal_1,g3d.vbo,normal_size,layout.normal_type,quantized,layout.vn_stride,vn_1+normal_ofs);
+		attribs |= (1<<vertex_1)|(1<<normal_1);
 	}
-	glBindTexture(GL_TEXTURE_2D,texture);
-	if((textures&1) && texture) {
-		const size_t tex_frame = (size_t)(std::min(std::max(time,0.0f),1.0f) * (float)tex_frame_count) % tex_frame_count;
-		glBindBuffer(GL_ARRAY_BUFFER,t_vbo[tex_frame]);
-		glVertexAttribPointer(attrib_tex,2,GL_FLOAT,GL_FALSE,2*sizeof(GLfloat),(void*)(0));
-		glEnableVertexAttribArray(attrib_tex);
-		glBindBuffer(GL_ARRAY_BUFFER,0);
-		glCheck();
+	if(textures&1) {
+		gl_state_t::vertex_attrib(tex,g3d.vbo,2,layout.tex_type,GL_UNSIGNED_SHORT == layout.tex_type,
+			layout.tex_stride,layout.t_ofs+tex_frame*vertex_count*layout.tex_stride);
+		attribs |= 1<<tex;
 	}
-	graphics_assert(i_vbo);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER,i_vbo);
-	glDrawElements(GL_TRIANGLES,index_count,GL_UNSIGNED_SHORT,(void*)(0));
-	glCheck();
-	glDisableVertexAttribArray(attrib_vertex_0);
-	glDisableVertexAttribArray(attrib_normal_0);
-	if(frame_count > 1) {
-		glDisableVertexAttribArray(attrib_vertex_1);
-		glDisableVertexAttribArray(attrib_normal_1);
+	return attribs;
+}
+
+// the same for the instanced program, with its per-instance attributes pointing at the first instance
+uint32_t g3d_t::mesh_t::instanced_t::bind_arrays(mesh_t& mesh,size_t frame_0,size_t tex_frame) {
+	uint32_t attribs = mesh.bind_arrays(attrib_vertex_0,attrib_normal_0,attrib_vertex_1,attrib_normal_1,attrib_tex,frame_0,tex_frame);
+	const GLuint buffer = mesh.g3d.instance_vbo;
+	attribs |= instance_attrib(buffer,attrib_mvp_matrix,4,4,0,INSTANCE_MVP_MATRIX);
+	attribs |= instance_attrib(buffer,attrib_normal_matrix,3,3,0,INSTANCE_NORMAL_MATRIX);
+	attribs |= instance_attrib(buffer,attrib_colour,1,4,0,INSTANCE_COLOUR);
+	if(mesh.frame_count > 1)
+		attribs |= instance_attrib(buffer,attrib_lerp,1,1,0,INSTANCE_LERP);
+	return attribs;
+}
+
+void g3d_t::mesh_t::draw(const instance_t* instances,const glm::mat4& projection,const glm::vec3& light_0,bool cycles) {
+	if(!is_ready()) {
+		std::cerr << "cannot draw " << g3d.filename << ':' << name << " because it is not initialized (" << g3d.ibo << ',' << textures << ',' << texture << ')' << std::endl;
+		return;
+	} else if(!frame_count) {
+		std::cerr << "cannot draw " << g3d.filename << ':' << name << " because it has no frames!" << std::endl;
+		return;
 	}
-	if((textures&1) & texture) {
-		glDisableVertexAttribArray(attrib_tex);
-		glBindTexture(GL_TEXTURE_2D,0);
+	// cull this mesh from the instances that only partly overlap the view, and key the rest
+	// by key frames and LOD, as instances that share those are drawn together
+	const std::vector<uint32_t>& visible = g3d.instance_visible;
+	const size_t tex_frames = (textures&1)? tex_frame_count: 1, frames = frame_count*tex_frames;
+	const bool animated = (frame_count > 1) || (tex_frames > 1), sorted = animated || (layout.lods > 1);
+	std::vector<uint64_t>& order = g3d.instance_order;
+	order.clear();
+	for(size_t v=0; v<visible.size(); v++) {
+		if(g3d.instance_partial.size() && g3d.instance_partial[v] && (frustum_t::OUTSIDE == g3d.instance_frustum[v].test(min,max)))
+			continue;
+		size_t frame_0 = 0, frame_1, tex_frame = 0;
+		float lerp;
+		if(animated)
+			pick_frame(instances[visible[v]].time,cycles,frame_0,frame_1,lerp,tex_frame);
+		const size_t lod = std::min<size_t>(g3d.instance_lod[v],layout.lods-1);
+		order.push_back(((uint64_t)(lod*frames+frame_0*tex_frames+tex_frame) << 32) | v);
+	}
+	const size_t count = order.size();
+	const bool culled = (count < visible.size());
+	g3d.cull_stats.meshes_drawn += count;
+	g3d.cull_stats.meshes_culled += visible.size()-count;
+	if(!instanced.program) {
+		for(size_t i=0; i<count; i++) {
+			const size_t v = order[i] & 0xffffffff;
+			const instance_t& instance = instances[visible[v]];
+			draw(instance.time,projection,instance.modelview,light_0,cycles,instance.colour,g3d.instance_lod[v]);
+		}
+		return;
+	}
+	if(!count)
+		return;
+	PROFILE_GPU_ZONE("g3d mesh draw instanced");
+	gl_state_t::bind_buffer(GL_ARRAY_BUFFER,g3d.instance_vbo);
+	if(sorted || culled) {
+		if(sorted)
+			std::sort(order.begin(),order.end());
+		std::vector<GLfloat>& data = g3d.instance_data;
+		data.resize(count*INSTANCE_FLOATS);
+		for(size_t i=0; i<count; i++) {
+			const size_t v = order[i] & 0xffffffff;
+			GLfloat* record = &data[i*INSTANCE_FLOATS];
+			std::copy(&g3d.instance_base[v*INSTANCE_FLOATS],&g3d.instance_base[(v+1)*INSTANCE_FLOATS],record);
+			size_t frame_0, frame_1, tex_frame;
+			pick_frame(instances[visible[v]].time,cycles,frame_0,frame_1,record[INSTANCE_LERP],tex_frame);
+		}
+		glBufferData(GL_ARRAY_BUFFER,data.size()*sizeof(GLfloat),&data[0],GL_STREAM_DRAW);
+		g3d.instance_vbo_is_base = false;
+	} else if(!g3d.instance_vbo_is_base) {
+		glBufferData(GL_ARRAY_BUFFER,g3d.instance_base.size()*sizeof(GLfloat),&g3d.instance_base[0],GL_STREAM_DRAW);
+		g3d.instance_vbo_is_base = true;
 	}
 	glCheck();
+	gl_state_t::use_program(instanced.program);
+	glUniform3fv(instanced.uniform_light_0,1,glm::value_ptr(const_cast<glm::vec3&>(light_0)));
+	gl_state_t::bind_texture(texture);
+	glCheck();
+	for(size_t first=0, last; first<count; first=last) {
+		const uint64_t key = order[first] >> 32;
+		for(last=first+1; (last<count) && ((order[last] >> 32) == key); last++);
+		const size_t lod = key / frames, frame_0 = (key % frames) / tex_frames, tex_frame = key % tex_frames;
+		if(instanced.vao)
+			gl_state_t::bind_vertex_array(instanced.vao[key % frames]);
+		else {
+			gl_state_t::use_attribs(instanced.bind_arrays(*this,frame_0,tex_frame));
+			gl_state_t::bind_buffer(GL_ELEMENT_ARRAY_BUFFER,g3d.ibo);
+		}
+		// move the per-instance attributes along to this run's first instance; a vertex
+		// array object keeps wherever the last draw through it left them
+		if(first || instanced.vao) {
+			instance_attrib(g3d.instance_vbo,instanced.attrib_mvp_matrix,4,4,first,INSTANCE_MVP_MATRIX);
+			instance_attrib(g3d.instance_vbo,instanced.attrib_normal_matrix,3,3,first,INSTANCE_NORMAL_MATRIX);
+			instance_attrib(g3d.instance_vbo,instanced.attrib_colour,1,4,first,INSTANCE_COLOUR);
+			if(frame_count > 1)
+				instance_attrib(g3d.instance_vbo,instanced.attrib_lerp,1,1,first,INSTANCE_LERP);
+		}
+		glCheck();
+		draw_elements_instanced(layout.lod_index_count[lod],last-first,layout.lod_ofs[lod]);
+		glCheck();
+	}
 }
 
-void g3d_t::mesh_t::on_texture_loaded(const std::string& name,GLuint handle,intptr_t data) {
+// which key frames to draw, and how far between them, at time 0..1
+void g3d_t::mesh_t::pick_frame(float time,bool cycles,size_t& frame_0,size_t& frame_1,float& lerp,size_t& tex_frame) const {
+	const uint32_t frames = ((frame_count > 1) && !cycles)? frame_count-1: frame_count;
+	time = std::min(std::max(time,0.0f),1.0f) * (float)frames;
+	frame_0 = (size_t)time % frames;
+	frame_1 = (frame_0+1) % frame_count;
+	lerp = fmod(time,1);
+	tex_frame = tex_frame_count? (size_t)(std::min(std::max(time,0.0f),1.0f) * (float)tex_frame_count) % tex_frame_count: 0;
+}
+
+void g3d_t::mesh_t::on_texture_loaded(const std::string& name,GLuint handle,const main_t::texture_rect_t& rect,intptr_t data) {
 	if(!handle || (data != LOAD_TEXTURE))
 		data_error(g3d.filename << ':' << this->name << " could not load " << name << ',' << data);
 	texture = handle;
+	if(packable && ((rect.u0 != 0) || (rect.v0 != 0) || (rect.u1 != 1) || (rect.v1 != 1))) { // it's in an atlas page
+		packed_t_data.resize(tex_frame_count*vertex_count*2);
+		for(size_t i=0; i<packed_t_data.size(); i+=2) {
+			packed_t_data[i] = rect.u0+t_data[i]*(rect.u1-rect.u0);
+			packed_t_data[i+1] = rect.v0+t_data[i+1]*(rect.v1-rect.v0);
+		}
+		t_data = &packed_t_data[0];
+		gl_state_t::bind_buffer(GL_ARRAY_BUFFER,g3d.vbo);
+		upload_t();
+		glCheck();
+	}
+	if(packable && (g3d.flags & DROP_CPU_DATA))
+		drop_cpu_data();
 	g3d.on_ready(this);
 }
 
 void g3d_t::draw(float time,const glm::mat4& projection,const glm::mat4& modelview,const glm::vec3& light_0,bool cycles,const glm::vec4& colour) {
+	const frustum_t frustum(projection*modelview);
+	const frustum_t::cull_t cull = frustum.test(model_min,model_max);
+	if(frustum_t::OUTSIDE == cull) {
+		cull_stats.instances_culled++;
+		cull_stats.meshes_culled += meshes.size();
+		return;
+	}
+	cull_stats.instances_drawn++;
+	const size_t lod = pick_lod(projection,modelview);
 	for(meshes_t::iterator m=meshes.begin(); m!=meshes.end(); m++)
-		(*m)->draw(time,projection,modelview,light_0,cycles,colour);
+		if((frustum_t::INSIDE == cull) || (meshes.size() == 1) || (frustum_t::OUTSIDE != frustum.test((*m)->min,(*m)->max))) {
+			cull_stats.meshes_drawn++;
+			(*m)->draw(time,projection,modelview,light_0,cycles,colour,lod);
+		} else
+			cull_stats.meshes_culled++;
 }
 
-void g3d_t::bounds(glm::vec3& min,glm::vec3& max) {
-	min = glm::vec3(FLT_MAX,FLT_MAX,FLT_MAX);
-	max = glm::vec3(-FLT_MAX,-FLT_MAX,-FLT_MAX);
-	for(meshes_t::const_iterator m=meshes.begin(); m!=meshes.end(); m++) {
-		min = glm::vec3(std::min(min.x,(*m)->min.x),std::min(min.y,(*m)->min.y),std::min(min.z,(*m)->min.z));
-		max = glm::vec3(std::max(max.x,(*m)->max.x),std::max(max.y,(*m)->max.y),std::max(max.z,(*m)->max.z));
+void g3d_t::draw(const instance_t* instances,size_t count,const glm::mat4& projection,const glm::vec3& light_0,bool cycles) {
+	if(!count)
+		return;
+	// the per-instance matrices are the same for every mesh, so work them out once for
+	// the instances that are not culled
+	const bool multiple = meshes.size() > 1;
+	instance_visible.clear();
+	instance_base.resize(count*INSTANCE_FLOATS);
+	instance_lod.resize(count);
+	instance_partial.resize(multiple? count: 0);
+	instance_frustum.resize(multiple? count: 0);
+	for(size_t i=0; i<count; i++) {
+		const glm::mat4 pmv = projection*instances[i].modelview;
+		const frustum_t frustum(pmv);
+		const frustum_t::cull_t cull = frustum.test(model_min,model_max);
+		if(frustum_t::OUTSIDE == cull)
+			continue;
+		const size_t v = instance_visible.size();
+		instance_visible.push_back(i);
+		instance_lod[v] = pick_lod(projection,instances[i].modelview);
+		if(multiple) {
+			instance_partial[v] = (frustum_t::INTERSECTS == cull);
+			if(instance_partial[v])
+				instance_frustum[v] = frustum;
+		}
+		GLfloat* record = &instance_base[v*INSTANCE_FLOATS];
+		const glm::mat4 mvp = quantized? pmv*dequantize: pmv;
+		const glm::mat3 normal = glm::inverse(glm::mat3(instances[i].modelview));
+		std::copy(glm::value_ptr(mvp),glm::value_ptr(mvp)+16,record+INSTANCE_MVP_MATRIX);
+		std::copy(glm::value_ptr(normal),glm::value_ptr(normal)+9,record+INSTANCE_NORMAL_MATRIX);
+		std::copy(glm::value_ptr(instances[i].colour),glm::value_ptr(instances[i].colour)+4,record+INSTANCE_COLOUR);
+		record[INSTANCE_LERP] = 0;
 	}
+	cull_stats.instances_drawn += instance_visible.size();
+	cull_stats.instances_culled += count-instance_visible.size();
+	cull_stats.meshes_culled += (count-instance_visible.size())*meshes.size();
+	if(instance_visible.empty())
+		return;
+	instance_base.resize(instance_visible.size()*INSTANCE_FLOATS);
+	instance_vbo_is_base = false;
+	for(meshes_t::iterator m=meshes.begin(); m!=meshes.end(); m++)
+		(*m)->draw(instances,projection,light_0,cycles);
+}
+
+size_t g3d_t::pick_lod(const glm::mat4& projection,const glm::mat4& modelview) const {
+	// the radius of the bounding sphere on screen, as it would be face on at its centre's depth
+	const glm::vec4 eye = modelview*glm::vec4(centre,1), clip = projection*eye;
+	if(!(flags & LODS) || (clip.w <= 0))
+		return 0;
+	float scale = 0; // the model's largest scaling
+	for(int i=0; i<3; i++)
+		scale = std::max(scale,modelview[i][0]*modelview[i][0]+modelview[i][1]*modelview[i][1]+modelview[i][2]*modelview[i][2]);
+	const float size = radius*sqrtf(scale)*fabsf(projection[1][1])/clip.w;
+	size_t lod = 0;
+	for(float threshold=lod_threshold; (size < threshold) && (lod+1 < g3d_data_t::MAX_LODS); threshold /= 2)
+		lod++;
+	return lod;
+}
+
+void g3d_t::bounds(glm::vec3& min,glm::vec3& max) const {
+	min = model_min;
+	max = model_max;
+}
+
+g3d_t::cull_stats_t g3d_t::cull_stats = {0,0,0,0};
+
+void g3d_t::reset_cull_stats() {
+	const cull_stats_t zero = {0,0,0,0};
+	cull_stats = zero;
 }
 
 bool g3d_t::is_ready() const {
@@ -2,48 +2,92 @@
 #define __G3D_HPP__
 
 #include "main.hpp"
+#include "g3d_data.hpp"
+#include "frustum.hpp"
 #include "../external/ogl-math/glm/glm.hpp"
 #include "../external/ogl-math/glm/gtc/type_ptr.hpp"
 
-class binary_reader_t;
-
 class g3d_t: private main_t::file_io_t {
 public:
 	struct loaded_t {
 		virtual void on_g3d_loaded(g3d_t& g3d,bool ok,intptr_t data) = 0; // throw error if upset
 	};
-	g3d_t(main_t& main,const std::string& filename,loaded_t* observer=NULL,intptr_t data=0);
+	enum { // flags
+		// free the vertex and index arrays once they are uploaded; only the bounds are kept
+		DROP_CPU_DATA = 1,
+		// store vertices compactly in GL: positions as normalized shorts within the model's
+		// bounds, normals as 2_10_10_10 (or bytes) and texture coordinates as normalized shorts
+		// (or half floats if they tile). Vertex fetch and the MVP_MATRIX undo it all, so the
+		// shared programs need not change; only expect normals to be a little off unit length.
+		QUANTIZE = 2,
+		// merge duplicate vertices and reorder the triangles and vertices for the GPU's vertex
+		// cache when loading (see g3d_data_t::optimise); the result is kept in the cache file
+		OPTIMISE = 4,
+		// simplify the meshes into levels of detail when loading (see g3d_data_t::make_lods),
+		// also kept in the cache file; draw picks one by how big the model is on screen
+		LODS = 8,
+		// let the textures of meshes whose texture coordinates don't tile be packed into atlas
+		// pages (see main_t::set_texture_atlas), with the coordinates moved to match, so that
+		// meshes of different textures can share a bind; DROP_CPU_DATA waits until they are in
+		PACK_TEXTURES = 16
+	};
+	g3d_t(main_t& main,const std::string& filename,loaded_t* observer=NULL,intptr_t data=0,unsigned flags=0);
 	main_t& main;
 	const std::string filename;
+	const unsigned flags;
+	// the radius of the bounding sphere on screen, in half viewport heights, below which the
+	// first simpler level of detail is drawn; each level after that at half the size again
+	float lod_threshold;
+	size_t pick_lod(const glm::mat4& projection,const glm::mat4& modelview) const;
+	// draws skip the models, and then the meshes, that are wholly outside the view frustum
 	void draw(float time,const glm::mat4& projection,const glm::mat4& modelview,const glm::vec3& light_0,bool cycles,const glm::vec4& colour = glm::vec4(1,1,1,1));
-	void bounds(glm::vec3& min,glm::vec3& max);
+	// many copies of the model at once; each mesh is drawn with a single instanced draw call
+	// (one per key frame in use, if animated) using the "g3d_single_frame_instanced" and
+	// "g3d_multi_frame_instanced" shared programs. These are the plain programs with the
+	// MVP_MATRIX, NORMAL_MATRIX, COLOUR and LERP uniforms turned into attributes of the same
+	// names and types. Without them, or without instancing in the driver, the instances are
+	// drawn one by one. Instances and meshes outside the view frustum are skipped.
+	struct instance_t {
+		glm::mat4 modelview;
+		glm::vec4 colour;
+		float time;
+	};
+	void draw(const instance_t* instances,size_t count,const glm::mat4& projection,const glm::vec3& light_0,bool cycles);
+	void bounds(glm::vec3& min,glm::vec3& max) const;
 	bool is_ready() const;
+	// what the draws have culled, summed over all models until reset; a mesh drawn or
+	// culled counts once per instance
+	struct cull_stats_t {
+		size_t instances_drawn, instances_culled, meshes_drawn, meshes_culled;
+	};
+	static cull_stats_t cull_stats;
+	static void reset_cull_stats();
 private:
 	struct mesh_t;
 	friend struct mesh_t;
-	enum { LOAD_G3D };
-	void on_io(const std::string& name,bool ok,const std::string& bytes,intptr_t data);
+	enum { LOAD_G3D, LOAD_CACHE };
+	void on_io(const std::string& name,bool ok,const bytes_t& bytes,intptr_t data);
 	void on_ready(mesh_t* mesh);
+	void create_meshes(const g3d_data_t& data);
+	void clear();
 	typedef std::vector<mesh_t*> meshes_t;
 	meshes_t meshes;
+	GLuint vbo, ibo; // every mesh's arrays, packed one after another
+	bool quantized;
+	glm::mat4 dequantize; // from quantized positions to model space
+	glm::vec3 model_min, model_max;
+	glm::vec3 centre; // the bounding sphere, for picking LODs
+	float radius;
+	// scratch for instanced draws
+	std::vector<GLfloat> instance_base, instance_data;
+	std::vector<uint64_t> instance_order;
+	std::vector<uint32_t> instance_visible; // the instances not culled; the rest are by this index
+	std::vector<uint8_t> instance_lod, instance_partial; // partial if only some meshes may be visible
+	std::vector<frustum_t> instance_frustum; // in model space, for culling the meshes of partial instances
+	GLuint instance_vbo;
+	bool instance_vbo_is_base;
 	loaded_t* observer;
 	intptr_t observer_data;
 };
 
-class binary_reader_t {
-public:
-	binary_reader_t(const std::string& d): data(d), ofs(0) {}
-	inline uint8_t byte() { return _r<uint8_t>(); }
-	inline uint16_t uint16() { return _r<uint16_t>(); };
-	inline uint32_t uint32() { return _r<uint32_t>(); };
-	inline float float32() { return _r<float>(); }
-	inline void skip(size_t bytes) { ofs += bytes; }
-	inline void read(void* dest,size_t bytes) { for(char* d = reinterpret_cast<char*>(dest); bytes--; d++) *d = data.at(ofs++); }
-	template<int N> std::string fixed_str() { ofs += N; return data.substr(ofs-N,N); }
-private:
-	template<typename T> T _r() { T v; read(&v,sizeof(T)); return v; }
-	const std::string& data;
-	size_t ofs;
-};
-
 #endif//__G3D_HPP__
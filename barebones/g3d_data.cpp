@@ -0,0 +1,696 @@
+#include "g3d_data.hpp"
+#include <iostream>
+#include <cfloat>
+#include <cmath>
+#include <algorithm>
+#ifdef __SSE2__
+	#include <emmintrin.h>
+#endif
+
+g3d_data_t::mesh_t::mesh_t():
+	frame_count(0), vertex_count(0), index_count(0), textures(0), tex_frame_count(0),
+	vn_data(NULL), t_data(NULL), i_data(NULL),
+	min(FLT_MAX/2,FLT_MAX/2,FLT_MAX/2), max(-FLT_MAX/2,-FLT_MAX/2,-FLT_MAX/2) {}
+
+static void load_g3d_v4_mesh(const std::string& filename,binary_reader_t& in,g3d_data_t::mesh_t& mesh) {
+	mesh.name = std::string(in.fixed_str<64>().c_str());
+	mesh.frame_count = in.uint32(); if(!mesh.frame_count) data_error(mesh.name << " has no frames");
+	mesh.vertex_count = in.uint32(); if(!mesh.vertex_count) data_error(mesh.name << " has no vertices");
+	mesh.index_count = in.uint32(); if(!mesh.index_count) data_error(mesh.name << " has no indices");
+	if(mesh.index_count%3) data_error(mesh.name << " bad number of indices: " << mesh.index_count);
+	in.skip(9*4);
+	mesh.textures = in.uint32();
+	for(int t=0; t<5; t++)
+		if((1<<t)&mesh.textures) {
+			const std::string path = std::string(in.fixed_str<64>().c_str());
+			if(t==0) // diffuse?
+				mesh.texture_path = main_t::relpath(filename,path);
+		}
+	mesh.tex_frame_count = mesh.textures?1:0;
+	const uint64_t vn_size = (uint64_t)mesh.vertex_count*mesh.frame_count*6,
+		t_size = (uint64_t)mesh.tex_frame_count*mesh.vertex_count*2;
+	if((vn_size+t_size+mesh.index_count)*4 > in.remaining())
+		data_error(mesh.name << " is truncated");
+	// all the arrays share one buffer
+	std::string buf((vn_size+t_size)*sizeof(GLfloat)+mesh.index_count*sizeof(GLushort),'\0');
+	GLfloat* vn_data = reinterpret_cast<GLfloat*>(&buf[0]);
+	GLfloat* t_data = vn_data+vn_size;
+	GLushort* i_data = reinterpret_cast<GLushort*>(t_data+t_size);
+	// the file has all the frames of vertices, then all the frames of normals; we interleave them
+	std::vector<GLfloat> frame(mesh.vertex_count*3);
+	for(int pass=0; pass<2; pass++) //0==vertices,1==normals
+		for(uint32_t f=0; f<mesh.frame_count; f++) {
+			in.float32s(&frame[0],frame.size());
+			GLfloat* dest = vn_data + f*mesh.vertex_count*6 + pass*3;
+			for(uint32_t v=0; v<mesh.vertex_count; v++, dest+=6) {
+				const GLfloat* src = &frame[v*3];
+				dest[0] = src[0]; dest[1] = src[1]; dest[2] = src[2];
+				if(!pass)
+					for(int j=0; j<3; j++) {
+						mesh.min[j] = std::min(src[j],mesh.min[j]);
+						mesh.max[j] = std::max(src[j],mesh.max[j]);
+					}
+			}
+		}
+	if(t_size) {
+		in.float32s(t_data,t_size);
+		for(size_t slot=1; slot<t_size; slot+=2)
+			t_data[slot] = 1.-t_data[slot]; // invert Y
+	}
+	const size_t bad = in.narrow_uint32s(i_data,mesh.index_count,mesh.vertex_count);
+	if(bad < mesh.index_count)
+		data_error("index[" << bad << "] out of bounds (" << mesh.vertex_count << ')');
+	mesh.storage = bytes_t::take(buf);
+	mesh.vn_data = reinterpret_cast<const GLfloat*>(mesh.storage.data());
+	mesh.t_data = mesh.vn_data+vn_size;
+	mesh.i_data = reinterpret_cast<const GLushort*>(mesh.t_data+t_size);
+}
+
+void binary_reader_t::float32s(float* dest,size_t count) {
+	uint32s(reinterpret_cast<uint32_t*>(dest),count);
+}
+
+void binary_reader_t::uint32s(uint32_t* dest,size_t count) {
+	memcpy(dest,view(count*4),count*4);
+#ifdef BINARY_READER_SWAP
+	for(size_t i=0; i<count; i++)
+		dest[i] = __builtin_bswap32(dest[i]);
+#endif
+}
+
+size_t binary_reader_t::narrow_uint32s(uint16_t* dest,size_t count,uint32_t limit) {
+	const uint8_t* src = view(count*4);
+	limit = std::min<uint32_t>(limit,0x10000);
+	size_t i = 0;
+#if defined(__SSE2__) && !defined(BINARY_READER_SWAP)
+	if(limit) {
+		// SSE2 has no unsigned compares nor unsigned 32->16 pack, so bias into the signed range
+		const __m128i bias32 = _mm_set1_epi32((int)0x80000000), max = _mm_set1_epi32((int)((limit-1)^0x80000000)),
+			bias16 = _mm_set1_epi32(0x8000), unbias16 = _mm_set1_epi16(-0x8000);
+		__m128i over = _mm_setzero_si128();
+		for(; i+8<=count; i+=8) {
+			const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src+i*4)),
+				b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src+i*4+16));
+			over = _mm_or_si128(over,_mm_cmpgt_epi32(_mm_xor_si128(a,bias32),max));
+			over = _mm_or_si128(over,_mm_cmpgt_epi32(_mm_xor_si128(b,bias32),max));
+			const __m128i packed = _mm_packs_epi32(_mm_sub_epi32(a,bias16),_mm_sub_epi32(b,bias16));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(dest+i),_mm_xor_si128(packed,unbias16));
+		}
+		if(_mm_movemask_epi8(over))
+			i = 0; // rescan to find which
+	}
+#endif
+	for(; i<count; i++) {
+		uint32_t v;
+		memcpy(&v,src+i*4,4);
+	#ifdef BINARY_READER_SWAP
+		v = __builtin_bswap32(v);
+	#endif
+		if(v >= limit)
+			return i;
+		dest[i] = v;
+	}
+	return count;
+}
+
+void g3d_data_t::load_g3d(const std::string& filename,const bytes_t& bytes) {
+	meshes.clear();
+	optimised = lods_made = false;
+	if(bytes.empty())
+		data_error("empty file");
+	binary_reader_t in(bytes);
+	const uint32_t ver = in.uint32();
+	// note the endian here is little endian
+	if(((ver&0xff)!='G')||(((ver>>8)&0xff)!='3')||(((ver>>16)&0xff)!='D'))
+		data_error("(" << std::hex << ver << ") is not a G3D model");
+	switch(ver>>24) {
+	//case 3: {
+	//} break;
+	case 4: {
+		const uint16_t mesh_count = in.uint16();
+		if(!mesh_count) data_error("has no meshes");
+		if(in.byte()) data_error("not a G3D mtMorphMesh");
+		meshes.resize(mesh_count);
+		for(uint16_t i=0; i<mesh_count; i++)
+			load_g3d_v4_mesh(filename,in,meshes[i]);
+	} break;
+	default: data_error("not a supported G3D model version (" << (ver>>24) << ")");
+	}
+}
+
+/* The cache is a straight dump of the parsed meshes in host byte order, with every
+   field and array 4-byte aligned so the vertex and index arrays can be handed to
+   glBufferData directly from the mapped file:
+	"G3DC", version, byte order mark, optimised, lods made, mesh count, then per mesh:
+	name, texture path, frame/vertex/index/textures/tex_frame counts, min, max,
+	vn_data, t_data, i_data, LOD count, then per LOD: index count, i_data
+   Strings are a length followed by the characters. */
+
+namespace {
+	const char cache_magic[4] = {'G','3','D','C'};
+	const uint32_t cache_byte_order = 0x01020304;
+
+	struct _cache_writer_t {
+		std::string buf;
+		void raw(const void* data,size_t len) {
+			buf.append(static_cast<const char*>(data),len);
+			buf.append((4-(len&3))&3,'\0');
+		}
+		void uint32(uint32_t v) { raw(&v,sizeof(v)); }
+		void str(const std::string& s) { uint32(s.size()); raw(s.data(),s.size()); }
+		void vec3(const glm::vec3& v) { for(int i=0; i<3; i++) raw(&v[i],sizeof(float)); }
+	};
+
+	struct _cache_reader_t {
+		_cache_reader_t(const bytes_t& b): bytes(b), ofs(0) {}
+		const bytes_t& bytes;
+		size_t ofs;
+		const uint8_t* raw(uint64_t len) {
+			if(len > bytes.size()-ofs) data_error("truncated cache");
+			const uint8_t* data = bytes.data()+ofs;
+			ofs = std::min(bytes.size(),ofs+((len+3)&~3));
+			return data;
+		}
+		uint32_t uint32() { uint32_t v; memcpy(&v,raw(sizeof(v)),sizeof(v)); return v; }
+		std::string str() { const uint32_t len = uint32(); return std::string(reinterpret_cast<const char*>(raw(len)),len); }
+		glm::vec3 vec3() { glm::vec3 v; memcpy(&v[0],raw(3*sizeof(float)),3*sizeof(float)); return v; }
+		// checked as load_g3d checks them, as they go to the GL as they are
+		const GLushort* indices(uint32_t count,uint32_t vertex_count) {
+			const GLushort* i_data = reinterpret_cast<const GLushort*>(raw((uint64_t)count*sizeof(GLushort)));
+			for(uint32_t i=0; i<count; i++)
+				if(i_data[i] >= vertex_count)
+					data_error("index[" << i << "] out of bounds (" << vertex_count << ')');
+			return i_data;
+		}
+	};
+} // anon namespace
+
+bytes_t g3d_data_t::save_cache() const {
+	_cache_writer_t out;
+	out.raw(cache_magic,sizeof(cache_magic));
+	out.uint32(CACHE_VERSION);
+	out.uint32(cache_byte_order);
+	out.uint32(optimised);
+	out.uint32(lods_made);
+	out.uint32(meshes.size());
+	for(meshes_t::const_iterator m=meshes.begin(); m!=meshes.end(); m++) {
+		out.str(m->name);
+		out.str(m->texture_path);
+		out.uint32(m->frame_count);
+		out.uint32(m->vertex_count);
+		out.uint32(m->index_count);
+		out.uint32(m->textures);
+		out.uint32(m->tex_frame_count);
+		out.vec3(m->min);
+		out.vec3(m->max);
+		out.raw(m->vn_data,m->frame_count*m->vertex_count*6*sizeof(GLfloat));
+		out.raw(m->t_data,m->tex_frame_count*m->vertex_count*2*sizeof(GLfloat));
+		out.raw(m->i_data,m->index_count*sizeof(GLushort));
+		out.uint32(m->lods.size());
+		for(std::vector<mesh_t::lod_t>::const_iterator l=m->lods.begin(); l!=m->lods.end(); l++) {
+			out.uint32(l->index_count);
+			out.raw(l->i_data,l->index_count*sizeof(GLushort));
+		}
+	}
+	return bytes_t::take(out.buf);
+}
+
+bool g3d_data_t::load_cache(const bytes_t& bytes) {
+	meshes.clear();
+	try {
+		_cache_reader_t in(bytes);
+		if(memcmp(in.raw(sizeof(cache_magic)),cache_magic,sizeof(cache_magic))
+			|| (in.uint32() != CACHE_VERSION)
+			|| (in.uint32() != cache_byte_order))
+			return false;
+		optimised = in.uint32();
+		lods_made = in.uint32();
+		const uint32_t mesh_count = in.uint32();
+		if(mesh_count > bytes.size())
+			data_error("bad mesh count " << mesh_count);
+		meshes.resize(mesh_count);
+		for(meshes_t::iterator m=meshes.begin(); m!=meshes.end(); m++) {
+			m->name = in.str();
+			m->texture_path = in.str();
+			m->frame_count = in.uint32();
+			m->vertex_count = in.uint32();
+			m->index_count = in.uint32();
+			m->textures = in.uint32();
+			m->tex_frame_count = in.uint32();
+			m->min = in.vec3();
+			m->max = in.vec3();
+			const size_t start = in.ofs;
+			m->vn_data = reinterpret_cast<const GLfloat*>(in.raw((uint64_t)m->frame_count*m->vertex_count*6*sizeof(GLfloat)));
+			m->t_data = reinterpret_cast<const GLfloat*>(in.raw((uint64_t)m->tex_frame_count*m->vertex_count*2*sizeof(GLfloat)));
+			m->i_data = in.indices(m->index_count,m->vertex_count);
+			const uint32_t lod_count = in.uint32();
+			if(lod_count >= MAX_LODS)
+				data_error("bad LOD count " << lod_count);
+			m->lods.resize(lod_count);
+			for(std::vector<mesh_t::lod_t>::iterator l=m->lods.begin(); l!=m->lods.end(); l++) {
+				l->index_count = in.uint32();
+				l->i_data = in.indices(l->index_count,m->vertex_count);
+			}
+			m->storage = bytes.sub(start,in.ofs-start);
+		}
+		if(in.ofs != bytes.size())
+			data_error("trailing bytes in cache");
+	} catch(data_error_t& de) {
+		std::cerr << "ignoring G3D cache: " << de.what() << std::endl;
+		meshes.clear();
+		return false;
+	}
+	return true;
+}
+
+std::string g3d_data_t::cache_path(const std::string& filename) {
+	return filename + ".g3dc";
+}
+
+namespace {
+	const uint32_t NONE = ~0u;
+
+	size_t vertex_cache_misses(const GLushort* indices,size_t count) {
+		GLushort cache[g3d_data_t::VERTEX_CACHE_SIZE];
+		size_t used = 0, head = 0, misses = 0;
+		for(size_t i=0; i<count; i++) {
+			if(std::find(cache,cache+used,indices[i]) != cache+used)
+				continue;
+			misses++;
+			cache[head] = indices[i];
+			head = (head+1) % g3d_data_t::VERTEX_CACHE_SIZE;
+			used = std::min<size_t>(used+1,g3d_data_t::VERTEX_CACHE_SIZE);
+		}
+		return misses;
+	}
+
+	// Tom Forsyth's "Linear-Speed Vertex Cache Optimisation": greedily emit the triangle whose
+	// vertices score best for being recently used in a simulated LRU cache, with a bonus for
+	// vertices with few triangles left so that no stragglers are left behind
+	enum { FORSYTH_CACHE_SIZE = 32 };
+
+	float forsyth_score(int cache_pos,uint32_t remaining) {
+		if(!remaining)
+			return -1;
+		float score = 0;
+		if(cache_pos >= 3)
+			score = powf(1.0f-(float)(cache_pos-3)/(FORSYTH_CACHE_SIZE-3),1.5f);
+		else if(cache_pos >= 0)
+			score = 0.75f; // the last triangle's; don't favour one of these over another
+		return score+2.0f/sqrtf((float)remaining);
+	}
+
+	void forsyth(const GLushort* in,size_t index_count,size_t vertex_count,GLushort* out) {
+		const size_t tri_count = index_count/3;
+		// the triangles still to emit that use each vertex
+		std::vector<uint32_t> remaining(vertex_count,0), first(vertex_count+1,0), adjacent(index_count);
+		for(size_t i=0; i<index_count; i++)
+			remaining[in[i]]++;
+		for(size_t v=0; v<vertex_count; v++)
+			first[v+1] = first[v]+remaining[v];
+		std::vector<uint32_t> fill(first.begin(),first.end()-1);
+		for(size_t i=0; i<index_count; i++)
+			adjacent[fill[in[i]]++] = i/3;
+		std::vector<int> cache_pos(vertex_count,-1);
+		std::vector<float> vertex_score(vertex_count), tri_score(tri_count);
+		for(size_t v=0; v<vertex_count; v++)
+			vertex_score[v] = forsyth_score(-1,remaining[v]);
+		for(size_t t=0; t<tri_count; t++)
+			tri_score[t] = vertex_score[in[t*3]]+vertex_score[in[t*3+1]]+vertex_score[in[t*3+2]];
+		std::vector<bool> emitted(tri_count,false);
+		std::vector<uint32_t> cache, next; // most recently used first
+		uint32_t best = NONE, restart = 0;
+		for(size_t n=0; n<tri_count; n++) {
+			if(NONE == best) { // nothing in the cache has triangles left, so take the next not yet emitted
+				while(emitted[restart])
+					restart++;
+				best = restart;
+			}
+			emitted[best] = true;
+			const GLushort* tri = in+best*3;
+			std::copy(tri,tri+3,out+n*3);
+			for(int c=0; c<3; c++) {
+				uint32_t* adj = &adjacent[first[tri[c]]];
+				uint32_t& count = remaining[tri[c]];
+				*std::find(adj,adj+count,best) = adj[count-1];
+				count--;
+			}
+			// the triangle's vertices go to the front of the cache
+			next.clear();
+			for(int c=0; c<3; c++)
+				if(std::find(next.begin(),next.end(),tri[c]) == next.end())
+					next.push_back(tri[c]);
+			for(std::vector<uint32_t>::const_iterator v=cache.begin(); v!=cache.end(); v++)
+				if((*v != tri[0]) && (*v != tri[1]) && (*v != tri[2]))
+					next.push_back(*v);
+			for(size_t i=0; i<next.size(); i++) {
+				const uint32_t v = next[i];
+				cache_pos[v] = (i < FORSYTH_CACHE_SIZE)? (int)i: -1;
+				vertex_score[v] = forsyth_score(cache_pos[v],remaining[v]);
+			}
+			// and the triangles they are in are rescored, including those of vertices that fell out
+			best = NONE;
+			for(size_t i=0; i<next.size(); i++) {
+				const uint32_t v = next[i];
+				for(uint32_t a=first[v]; a<first[v]+remaining[v]; a++) {
+					const uint32_t t = adjacent[a];
+					tri_score[t] = vertex_score[in[t*3]]+vertex_score[in[t*3+1]]+vertex_score[in[t*3+2]];
+					if((NONE == best) || (tri_score[t] > tri_score[best]))
+						best = t;
+				}
+			}
+			if(next.size() > FORSYTH_CACHE_SIZE)
+				next.resize(FORSYTH_CACHE_SIZE);
+			cache.swap(next);
+		}
+	}
+
+	struct _row_less_t {
+		_row_less_t(const GLfloat* r,size_t l): rows(r), len(l) {}
+		bool operator()(uint32_t a,uint32_t b) const { return memcmp(rows+a*len,rows+b*len,len*sizeof(GLfloat)) < 0; }
+		const GLfloat* rows;
+		size_t len;
+	};
+
+	// for each vertex, the first that is the same in every frame; in its normal and texture
+	// coordinates too, unless positions_only
+	void same_vertices(const g3d_data_t::mesh_t& mesh,bool positions_only,std::vector<uint32_t>& same) {
+		const size_t vertex_count = mesh.vertex_count, vn_len = positions_only? 3: 6,
+			row_len = mesh.frame_count*vn_len+(positions_only? 0: mesh.tex_frame_count*2);
+		std::vector<GLfloat> rows(vertex_count*row_len);
+		for(size_t v=0; v<vertex_count; v++) {
+			GLfloat* row = &rows[v*row_len];
+			for(size_t f=0; f<mesh.frame_count; f++, row+=vn_len)
+				std::copy(mesh.vn_data+(f*vertex_count+v)*6,mesh.vn_data+(f*vertex_count+v)*6+vn_len,row);
+			for(size_t f=0; !positions_only && (f<mesh.tex_frame_count); f++, row+=2)
+				std::copy(mesh.t_data+(f*vertex_count+v)*2,mesh.t_data+(f*vertex_count+v+1)*2,row);
+		}
+		std::vector<uint32_t> sorted(vertex_count);
+		for(size_t v=0; v<vertex_count; v++)
+			sorted[v] = v;
+		const _row_less_t less(&rows[0],row_len);
+		std::sort(sorted.begin(),sorted.end(),less);
+		same.resize(vertex_count);
+		for(size_t i=0; i<vertex_count; i++)
+			same[sorted[i]] = (i && !less(sorted[i-1],sorted[i]))? same[sorted[i-1]]: sorted[i];
+	}
+
+	// replaces the mesh's arrays: order lists the vertices to keep in their new order, and
+	// indices the triangles, already renumbered, then those of each LOD
+	void rebuild_mesh(g3d_data_t::mesh_t& mesh,const std::vector<uint32_t>& order,const std::vector<std::vector<GLushort> >& indices) {
+		const size_t vertex_count = mesh.vertex_count, new_count = order.size(),
+			vn_len = mesh.frame_count*6, t_len = mesh.tex_frame_count*2;
+		size_t index_count = 0;
+		for(size_t l=0; l<indices.size(); l++)
+			index_count += indices[l].size();
+		std::string buf((vn_len+t_len)*new_count*sizeof(GLfloat)+index_count*sizeof(GLushort),'\0');
+		GLfloat* vn_data = reinterpret_cast<GLfloat*>(&buf[0]);
+		GLfloat* t_data = vn_data+vn_len*new_count;
+		GLushort* i_data = reinterpret_cast<GLushort*>(t_data+t_len*new_count);
+		mesh.min = glm::vec3(FLT_MAX/2,FLT_MAX/2,FLT_MAX/2);
+		mesh.max = glm::vec3(-FLT_MAX/2,-FLT_MAX/2,-FLT_MAX/2);
+		for(size_t f=0; f<mesh.frame_count; f++)
+			for(size_t v=0; v<new_count; v++) {
+				const GLfloat* src = mesh.vn_data+(f*vertex_count+order[v])*6;
+				std::copy(src,src+6,vn_data+(f*new_count+v)*6);
+				for(int j=0; j<3; j++) {
+					mesh.min[j] = std::min(src[j],mesh.min[j]);
+					mesh.max[j] = std::max(src[j],mesh.max[j]);
+				}
+			}
+		for(size_t f=0; f<mesh.tex_frame_count; f++)
+			for(size_t v=0; v<new_count; v++) {
+				const GLfloat* src = mesh.t_data+(f*vertex_count+order[v])*2;
+				std::copy(src,src+2,t_data+(f*new_count+v)*2);
+			}
+		GLushort* dest = i_data;
+		for(size_t l=0; l<indices.size(); l++)
+			dest = std::copy(indices[l].begin(),indices[l].end(),dest);
+		mesh.vertex_count = new_count;
+		mesh.index_count = indices[0].size();
+		mesh.storage = bytes_t::take(buf);
+		mesh.vn_data = reinterpret_cast<const GLfloat*>(mesh.storage.data());
+		mesh.t_data = mesh.vn_data+vn_len*new_count;
+		mesh.i_data = reinterpret_cast<const GLushort*>(mesh.t_data+t_len*new_count);
+		mesh.lods.resize(indices.size()-1);
+		const GLushort* src = mesh.i_data+mesh.index_count;
+		for(size_t l=0; l<mesh.lods.size(); src+=mesh.lods[l].index_count, l++) {
+			mesh.lods[l].index_count = indices[l+1].size();
+			mesh.lods[l].i_data = src;
+		}
+	}
+
+	void optimise_mesh(g3d_data_t::mesh_t& mesh) {
+		std::vector<uint32_t> same;
+		same_vertices(mesh,false,same);
+		// every level of detail uses the same vertices, so they all get the same treatment
+		std::vector<std::vector<GLushort> > indices(1+mesh.lods.size());
+		for(size_t l=0; l<indices.size(); l++) {
+			const GLushort* src = l? mesh.lods[l-1].i_data: mesh.i_data;
+			std::vector<GLushort> merged(l? mesh.lods[l-1].index_count: mesh.index_count);
+			for(size_t i=0; i<merged.size(); i++)
+				merged[i] = same[src[i]];
+			indices[l].resize(merged.size());
+			forsyth(&merged[0],merged.size(),mesh.vertex_count,&indices[l][0]);
+		}
+		// renumber the vertices in the order they are first used; unused ones drop out
+		std::vector<uint32_t> renumber(mesh.vertex_count,NONE), order;
+		for(size_t i=0; i<indices[0].size(); i++)
+			if(NONE == renumber[indices[0][i]]) {
+				renumber[indices[0][i]] = order.size();
+				order.push_back(indices[0][i]);
+			}
+		for(size_t l=0; l<indices.size(); l++)
+			for(size_t i=0; i<indices[l].size(); i++)
+				indices[l][i] = renumber[indices[l][i]];
+		rebuild_mesh(mesh,order,indices);
+	}
+
+	// Garland and Heckbert's quadric error: the sum of squared distances to the planes of
+	// the triangles around a vertex, as a symmetric 4x4 matrix
+	struct _quadric_t {
+		double a2, ab, ac, ad, b2, bc, bd, c2, cd, d2;
+		void add_plane(const glm::vec3& p0,const glm::vec3& p1,const glm::vec3& p2) {
+			const glm::vec3 e1(p1.x-p0.x,p1.y-p0.y,p1.z-p0.z), e2(p2.x-p0.x,p2.y-p0.y,p2.z-p0.z);
+			double a = e1.y*e2.z-e1.z*e2.y, b = e1.z*e2.x-e1.x*e2.z, c = e1.x*e2.y-e1.y*e2.x;
+			const double len = sqrt(a*a+b*b+c*c);
+			if(!(len > 0))
+				return;
+			a /= len; b /= len; c /= len;
+			const double d = -(a*p0.x+b*p0.y+c*p0.z), w = len/2; // weighted by area
+			a2 += w*a*a; ab += w*a*b; ac += w*a*c; ad += w*a*d;
+			b2 += w*b*b; bc += w*b*c; bd += w*b*d;
+			c2 += w*c*c; cd += w*c*d;
+			d2 += w*d*d;
+		}
+		void add(const _quadric_t& q) {
+			a2 += q.a2; ab += q.ab; ac += q.ac; ad += q.ad; b2 += q.b2;
+			bc += q.bc; bd += q.bd; c2 += q.c2; cd += q.cd; d2 += q.d2;
+		}
+		double error(const GLfloat* p) const {
+			const double x = p[0], y = p[1], z = p[2];
+			return a2*x*x+2*ab*x*y+2*ac*x*z+2*ad*x+b2*y*y+2*bc*y*z+2*bd*y+c2*z*z+2*cd*z+d2;
+		}
+	};
+
+	struct _collapse_t {
+		double cost;
+		uint32_t from, to;
+		bool operator<(const _collapse_t& other) const { return cost < other.cost; }
+	};
+
+	enum { LOD_FRAMES = 8 }; // the most key frames sampled for errors and flipped triangles
+
+	struct _simplifier_t {
+		_simplifier_t(const g3d_data_t::mesh_t& mesh);
+		void simplify(std::vector<GLushort>& indices,size_t target);
+		bool flips(const std::vector<GLushort>& indices,uint32_t from,uint32_t to) const;
+		const GLfloat* position(uint32_t vertex,size_t frame) const { return mesh.vn_data+(frames[frame]*mesh.vertex_count+vertex)*6; }
+		const g3d_data_t::mesh_t& mesh;
+		std::vector<size_t> frames;
+		std::vector<uint32_t> same;
+		std::vector<bool> locked;
+		std::vector<_quadric_t> quadrics; // per vertex, per sampled frame
+		std::vector<uint32_t> first, adjacent; // the triangles around each vertex
+	};
+
+	_simplifier_t::_simplifier_t(const g3d_data_t::mesh_t& m): mesh(m), locked(m.vertex_count,false) {
+		const size_t vertex_count = mesh.vertex_count;
+		for(size_t f=0; f<std::min<size_t>(LOD_FRAMES,mesh.frame_count); f++)
+			frames.push_back(f*mesh.frame_count/std::min<size_t>(LOD_FRAMES,mesh.frame_count));
+		// vertices that share a position but differ in their other attributes are a seam
+		std::vector<uint32_t> placed, first_same(vertex_count,NONE);
+		same_vertices(mesh,false,same);
+		same_vertices(mesh,true,placed);
+		std::vector<bool> seam(vertex_count,false);
+		for(size_t v=0; v<vertex_count; v++) {
+			uint32_t& other = first_same[placed[v]];
+			if(NONE == other)
+				other = same[v];
+			else if(other != same[v])
+				seam[placed[v]] = true;
+		}
+		for(size_t v=0; v<vertex_count; v++)
+			locked[v] = seam[placed[v]];
+		// edges that don't have exactly two triangles are on the edge of the mesh
+		std::vector<uint64_t> edges;
+		for(size_t i=0; i<mesh.index_count; i++) {
+			const uint64_t a = same[mesh.i_data[i]], b = same[mesh.i_data[i-i%3+(i+1)%3]];
+			edges.push_back((std::min(a,b) << 32) | std::max(a,b));
+		}
+		std::sort(edges.begin(),edges.end());
+		for(size_t i=0, j; i<edges.size(); i=j) {
+			for(j=i+1; (j<edges.size()) && (edges[j] == edges[i]); j++);
+			if(j-i != 2)
+				locked[edges[i] >> 32] = locked[edges[i] & 0xffffffff] = true;
+		}
+		const _quadric_t zero = {0,0,0,0,0,0,0,0,0,0};
+		quadrics.resize(vertex_count*frames.size(),zero);
+		for(size_t i=0; i<mesh.index_count; i+=3)
+			for(size_t f=0; f<frames.size(); f++) {
+				const GLfloat* p[3];
+				for(int c=0; c<3; c++)
+					p[c] = position(mesh.i_data[i+c],f);
+				const glm::vec3 p0(p[0][0],p[0][1],p[0][2]), p1(p[1][0],p[1][1],p[1][2]), p2(p[2][0],p[2][1],p[2][2]);
+				for(int c=0; c<3; c++)
+					quadrics[same[mesh.i_data[i+c]]*frames.size()+f].add_plane(p0,p1,p2);
+			}
+	}
+
+	// would moving from to to turn any of from's other triangles over, in any sampled frame?
+	bool _simplifier_t::flips(const std::vector<GLushort>& indices,uint32_t from,uint32_t to) const {
+		for(uint32_t a=first[from]; a<first[from+1]; a++) {
+			const GLushort* tri = &indices[adjacent[a]*3];
+			if((tri[0] == to) || (tri[1] == to) || (tri[2] == to))
+				continue; // goes away
+			for(size_t f=0; f<frames.size(); f++) {
+				const GLfloat* p[3];
+				for(int c=0; c<3; c++)
+					p[c] = position(tri[c],f);
+				float before[3], after[3];
+				for(int pass=0; pass<2; pass++) {
+					const GLfloat* q[3];
+					for(int c=0; c<3; c++)
+						q[c] = (pass && (tri[c] == from))? position(to,f): p[c];
+					const float e1[3] = {q[1][0]-q[0][0],q[1][1]-q[0][1],q[1][2]-q[0][2]},
+						e2[3] = {q[2][0]-q[0][0],q[2][1]-q[0][1],q[2][2]-q[0][2]};
+					float* n = pass? after: before;
+					n[0] = e1[1]*e2[2]-e1[2]*e2[1];
+					n[1] = e1[2]*e2[0]-e1[0]*e2[2];
+					n[2] = e1[0]*e2[1]-e1[1]*e2[0];
+				}
+				if(before[0]*after[0]+before[1]*after[1]+before[2]*after[2] <= 0)
+					return true;
+			}
+		}
+		return false;
+	}
+
+	// collapses edges in passes, cheapest first and none next to another in the same pass,
+	// until there are no more than target triangles or no more edges can go
+	void _simplifier_t::simplify(std::vector<GLushort>& indices,size_t target) {
+		const size_t vertex_count = mesh.vertex_count, sampled = frames.size();
+		std::vector<_collapse_t> collapses;
+		std::vector<uint32_t> remap(vertex_count);
+		std::vector<bool> touched(vertex_count);
+		while(indices.size()/3 > target) {
+			first.assign(vertex_count+1,0);
+			adjacent.resize(indices.size());
+			for(size_t i=0; i<indices.size(); i++)
+				first[indices[i]+1]++;
+			for(size_t v=0; v<vertex_count; v++)
+				first[v+1] += first[v];
+			std::vector<uint32_t> fill(first.begin(),first.end()-1);
+			for(size_t i=0; i<indices.size(); i++)
+				adjacent[fill[indices[i]]++] = i/3;
+			collapses.clear();
+			for(size_t i=0; i<indices.size(); i++) {
+				const uint32_t a = indices[i], b = indices[i-i%3+(i+1)%3];
+				for(int dir=0; dir<2; dir++) {
+					const _collapse_t collapse = {0,dir? b: a,dir? a: b};
+					if(locked[collapse.from])
+						continue;
+					collapses.push_back(collapse);
+					_collapse_t& c = collapses.back();
+					for(size_t f=0; f<sampled; f++)
+						c.cost += quadrics[c.from*sampled+f].error(position(c.to,f));
+				}
+			}
+			std::sort(collapses.begin(),collapses.end());
+			for(size_t v=0; v<vertex_count; v++)
+				remap[v] = v;
+			touched.assign(vertex_count,false);
+			size_t removed = 0, collapsed = 0;
+			const size_t excess = indices.size()/3-target;
+			for(std::vector<_collapse_t>::const_iterator c=collapses.begin(); (c!=collapses.end()) && (removed<excess); c++) {
+				if(touched[c->from] || touched[c->to] || flips(indices,c->from,c->to))
+					continue;
+				remap[c->from] = c->to;
+				for(uint32_t a=first[c->from]; a<first[c->from+1]; a++) {
+					const GLushort* tri = &indices[adjacent[a]*3];
+					for(int i=0; i<3; i++)
+						touched[tri[i]] = true;
+					if((tri[0] == c->to) || (tri[1] == c->to) || (tri[2] == c->to))
+						removed++;
+				}
+				for(size_t f=0; f<sampled; f++)
+					quadrics[c->to*sampled+f].add(quadrics[c->from*sampled+f]);
+				collapsed++;
+			}
+			if(!collapsed)
+				break;
+			size_t out = 0;
+			for(size_t i=0; i<indices.size(); i+=3) {
+				const GLushort a = remap[indices[i]], b = remap[indices[i+1]], c = remap[indices[i+2]];
+				if((a != b) && (b != c) && (c != a)) {
+					indices[out++] = a;
+					indices[out++] = b;
+					indices[out++] = c;
+				}
+			}
+			indices.resize(out);
+		}
+	}
+
+	void make_mesh_lods(g3d_data_t::mesh_t& mesh) {
+		_simplifier_t simplifier(mesh);
+		std::vector<std::vector<GLushort> > indices(1,std::vector<GLushort>(mesh.i_data,mesh.i_data+mesh.index_count));
+		std::vector<GLushort> lod(mesh.index_count);
+		for(size_t i=0; i<mesh.index_count; i++)
+			lod[i] = simplifier.same[mesh.i_data[i]];
+		while(indices.size() < g3d_data_t::MAX_LODS) {
+			const size_t before = lod.size();
+			simplifier.simplify(lod,before/3/2);
+			if(lod.empty() || (lod.size() > before*3/4))
+				break; // not worth another level
+			indices.push_back(std::vector<GLushort>(lod.size()));
+			forsyth(&lod[0],lod.size(),mesh.vertex_count,&indices.back()[0]);
+		}
+		std::vector<uint32_t> order(mesh.vertex_count);
+		for(size_t v=0; v<order.size(); v++)
+			order[v] = v;
+		rebuild_mesh(mesh,order,indices);
+	}
+} // anon namespace
+
+void g3d_data_t::optimise() {
+	for(meshes_t::iterator m=meshes.begin(); m!=meshes.end(); m++)
+		optimise_mesh(*m);
+	optimised = true;
+}
+
+void g3d_data_t::make_lods() {
+	for(meshes_t::iterator m=meshes.begin(); m!=meshes.end(); m++)
+		make_mesh_lods(*m);
+	lods_made = true;
+}
+
+g3d_data_t::vertex_cache_stats_t g3d_data_t::vertex_cache_stats() const {
+	vertex_cache_stats_t stats = {0,0,0};
+	for(meshes_t::const_iterator m=meshes.begin(); m!=meshes.end(); m++) {
+		stats.triangles += m->index_count/3;
+		stats.vertices += m->vertex_count;
+		stats.misses += vertex_cache_misses(m->i_data,m->index_count);
+	}
+	return stats;
+}
@@ -0,0 +1,99 @@
+#ifndef __G3D_DATA_HPP__
+#define __G3D_DATA_HPP__
+
+#include "main.hpp"
+#include "../external/ogl-math/glm/glm.hpp"
+
+// the CPU side of a g3d_t model; everything that can be worked out without a GL context.
+// It can be parsed from a G3D file or mapped straight out of a previously saved cache.
+class g3d_data_t {
+public:
+	struct mesh_t {
+		mesh_t();
+		std::string name;
+		uint32_t frame_count, vertex_count, index_count, textures, tex_frame_count;
+		std::string texture_path; // diffuse, already made relative to the model file
+		const GLfloat* vn_data; // per frame, per vertex: x,y,z,nx,ny,nz
+		const GLfloat* t_data; // per tex_frame, per vertex: u,v with v already flipped
+		const GLushort* i_data;
+		glm::vec3 min, max;
+		// simpler versions of the triangles, over the same vertices so that every frame still
+		// works; each has about half the triangles of the one before
+		struct lod_t {
+			uint32_t index_count;
+			const GLushort* i_data;
+		};
+		std::vector<lod_t> lods;
+		bytes_t storage; // keeps the arrays above alive
+	};
+	typedef std::vector<mesh_t> meshes_t;
+	meshes_t meshes;
+	g3d_data_t(): optimised(false), lods_made(false) {}
+	void load_g3d(const std::string& filename,const bytes_t& bytes); // throws data_error_t
+	bool load_cache(const bytes_t& bytes); // false if not a cache of the current version
+	bytes_t save_cache() const;
+	static std::string cache_path(const std::string& filename);
+	enum { CACHE_VERSION = 3 };
+	// merges vertices that are the same in every frame, drops unused ones, reorders the
+	// triangles for the post-transform vertex cache (Forsyth's algorithm) and then the
+	// vertices into the order they are fetched in
+	void optimise();
+	// simplifies each mesh into up to MAX_LODS-1 levels of detail by collapsing the edges
+	// that least change the shape, by the quadric error summed over the key frames. Vertices
+	// on the edges of the mesh and at seams (where vertices share a position but not their
+	// normals or texture coordinates) are not moved.
+	void make_lods();
+	enum { MAX_LODS = 4 }; // including the full mesh
+	bool optimised, lods_made; // saved in the cache
+	// how the triangles would fare in a FIFO cache of VERTEX_CACHE_SIZE transformed vertices:
+	// ACMR is the misses per triangle (0.5 is ideal, 3 is none), ATVR per vertex (1 is ideal)
+	struct vertex_cache_stats_t {
+		uint64_t triangles, vertices, misses;
+		double acmr() const { return triangles? (double)misses/triangles: 0; }
+		double atvr() const { return vertices? (double)misses/vertices: 0; }
+	};
+	vertex_cache_stats_t vertex_cache_stats() const;
+	enum { VERTEX_CACHE_SIZE = 16 };
+};
+
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+	#define BINARY_READER_SWAP // files are little-endian
+#endif
+
+class binary_reader_t {
+public:
+	binary_reader_t(const bytes_t& d): data(d), ofs(0) {}
+	inline uint8_t byte() { return _r<uint8_t>(); }
+	inline uint16_t uint16() { return _r<uint16_t>(); };
+	inline uint32_t uint32() { return _r<uint32_t>(); };
+	inline float float32() { return _r<float>(); }
+	inline void skip(size_t bytes) { ofs += bytes; }
+	inline size_t remaining() const { return (ofs < data.size())? data.size()-ofs: 0; }
+	inline void read(void* dest,size_t bytes) { memcpy(dest,view(bytes),bytes); }
+	// the next bytes, in place; valid for as long as the underlying bytes_t
+	inline const uint8_t* view(size_t bytes) {
+		if(bytes > remaining()) data_error("wanted " << bytes << " bytes @" << ofs << " but only " << remaining() << " left");
+		ofs += bytes;
+		return data.data()+ofs-bytes;
+	}
+	template<int N> std::string fixed_str() { return std::string(reinterpret_cast<const char*>(view(N)),N); }
+	// bulk reads; one bounds check for the lot
+	void float32s(float* dest,size_t count);
+	void uint32s(uint32_t* dest,size_t count);
+	// reads uint32s and narrows them; returns the position of the first one >= limit or that
+	// doesn't fit in 16 bits (or count if all are fine)
+	size_t narrow_uint32s(uint16_t* dest,size_t count,uint32_t limit);
+private:
+	template<typename T> T _r() {
+		T v;
+		read(&v,sizeof(T));
+	#ifdef BINARY_READER_SWAP
+		std::reverse(reinterpret_cast<uint8_t*>(&v),reinterpret_cast<uint8_t*>(&v)+sizeof(T));
+	#endif
+		return v;
+	}
+	const bytes_t& data;
+	size_t ofs;
+};
+
+#endif//__G3D_DATA_HPP__
@@ -0,0 +1,194 @@
+#include "gl_state.hpp"
+
+namespace {
+	struct _attrib_t {
+		bool known;
+		GLuint buffer;
+		GLint size;
+		GLenum type;
+		GLboolean normalized;
+		GLsizei stride;
+		size_t offset;
+		GLuint divisor;
+	};
+
+	enum { UNKNOWN = ~0u }; // not a handle that GL gives out
+
+	GLuint program = UNKNOWN, vertex_array = 0, array_buffer = UNKNOWN, element_buffer = UNKNOWN, texture = UNKNOWN;
+	_attrib_t attribs[gl_state_t::MAX_ATTRIBS]; // of vertex array 0, as is the element buffer
+	uint32_t enabled = 0;
+	bool enabled_known = false;
+	GLuint max_attribs = 0;
+
+	void vertex_attrib_divisor(GLuint loc,GLuint divisor) {
+	#ifndef __native_client__
+		if(GLEW_VERSION_3_3)
+			glVertexAttribDivisor(loc,divisor);
+		else if(GLEW_ARB_instanced_arrays)
+			glVertexAttribDivisorARB(loc,divisor);
+	#endif
+	}
+} // anon namespace
+
+void gl_state_t::use_program(GLuint p) {
+	if(p != program) {
+		glUseProgram(p);
+		program = p;
+	}
+}
+
+void gl_state_t::bind_vertex_array(GLuint vao) {
+#ifndef __native_client__
+	if(vao != vertex_array) {
+		glBindVertexArray(vao);
+		vertex_array = vao;
+	}
+#endif
+}
+
+void gl_state_t::bind_buffer(GLenum target,GLuint buffer) {
+	if((GL_ELEMENT_ARRAY_BUFFER == target) && vertex_array) {
+		glBindBuffer(target,buffer);
+		return;
+	}
+	GLuint& bound = (GL_ELEMENT_ARRAY_BUFFER == target)? element_buffer: array_buffer;
+	if(buffer != bound) {
+		glBindBuffer(target,buffer);
+		bound = buffer;
+	}
+}
+
+void gl_state_t::bind_texture(GLuint t) {
+	if(t != texture) {
+		glBindTexture(GL_TEXTURE_2D,t);
+		texture = t;
+	}
+}
+
+void gl_state_t::vertex_attrib(GLuint loc,GLuint buffer,GLint size,GLenum type,GLboolean normalized,GLsizei stride,size_t offset,GLuint divisor) {
+	graphics_assert(loc < MAX_ATTRIBS);
+	_attrib_t scratch = {false};
+	_attrib_t& attrib = vertex_array? scratch: attribs[loc];
+	if(!attrib.known || (attrib.buffer != buffer) || (attrib.size != size) || (attrib.type != type) ||
+		(attrib.normalized != normalized) || (attrib.stride != stride) || (attrib.offset != offset)) {
+		bind_buffer(GL_ARRAY_BUFFER,buffer);
+		glVertexAttribPointer(loc,size,type,normalized,stride,(void*)offset);
+		if(!attrib.known)
+			attrib.divisor = UNKNOWN;
+		attrib.known = true;
+		attrib.buffer = buffer;
+		attrib.size = size;
+		attrib.type = type;
+		attrib.normalized = normalized;
+		attrib.stride = stride;
+		attrib.offset = offset;
+	}
+	if(attrib.divisor != divisor) {
+		if(divisor || instancing())
+			vertex_attrib_divisor(loc,divisor);
+		attrib.divisor = divisor;
+	}
+}
+
+void gl_state_t::use_attribs(uint32_t mask) {
+	if(!max_attribs) {
+		GLint max = 0;
+		glGetIntegerv(GL_MAX_VERTEX_ATTRIBS,&max);
+		max_attribs = std::min<GLuint>(std::max(max,1),MAX_ATTRIBS);
+	}
+	const uint32_t changed = (enabled_known && !vertex_array)? (mask ^ enabled): ~0u;
+	for(GLuint loc=0; loc<max_attribs; loc++)
+		if(changed & (1u << loc)) {
+			if(mask & (1u << loc))
+				glEnableVertexAttribArray(loc);
+			else
+				glDisableVertexAttribArray(loc);
+		}
+	if(!vertex_array) {
+		enabled = mask;
+		enabled_known = true;
+	}
+}
+
+void gl_state_t::delete_buffers(GLsizei n,const GLuint* buffers) {
+	glDeleteBuffers(n,buffers);
+	// GL unbinds deleted buffers, and the handles will be given out again
+	for(GLsizei i=0; i<n; i++) {
+		if(buffers[i] == array_buffer) array_buffer = 0;
+		if(buffers[i] == element_buffer) element_buffer = 0;
+		for(GLuint loc=0; loc<MAX_ATTRIBS; loc++)
+			if(attribs[loc].buffer == buffers[i])
+				attribs[loc].known = false;
+	}
+}
+
+void gl_state_t::delete_vertex_arrays(GLsizei n,const GLuint* vaos) {
+#ifndef __native_client__
+	glDeleteVertexArrays(n,vaos);
+	for(GLsizei i=0; i<n; i++)
+		if(vaos[i] == vertex_array)
+			vertex_array = 0;
+#endif
+}
+
+void gl_state_t::reset() {
+	invalidate();
+	if(vertex_arrays())
+		bind_vertex_array(0);
+	use_program(0);
+	bind_buffer(GL_ARRAY_BUFFER,0);
+	bind_buffer(GL_ELEMENT_ARRAY_BUFFER,0);
+	bind_texture(0);
+	use_attribs(0);
+	if(instancing())
+		for(GLuint loc=0; loc<max_attribs; loc++)
+			vertex_attrib_divisor(loc,0);
+}
+
+void gl_state_t::invalidate() {
+	program = array_buffer = element_buffer = texture = UNKNOWN;
+	vertex_array = vertex_arrays()? UNKNOWN: 0;
+	for(GLuint loc=0; loc<MAX_ATTRIBS; loc++)
+		attribs[loc].known = false;
+	enabled_known = false;
+}
+
+bool gl_state_t::instancing() {
+#ifdef __native_client__
+	return false; // GLES2 only has it as an extension that NaCl doesn't expose
+#else
+	return GLEW_VERSION_3_3 || (GLEW_ARB_instanced_arrays && GLEW_ARB_draw_instanced);
+#endif
+}
+
+bool gl_state_t::vertex_arrays() {
+#ifdef __native_client__
+	return false; // no OES_vertex_array_object in this Pepper
+#else
+	return GLEW_VERSION_3_0 || GLEW_ARB_vertex_array_object;
+#endif
+}
+
+bool gl_state_t::half_float_attribs() {
+#ifdef __native_client__
+	return false;
+#else
+	return GLEW_VERSION_3_0 || GLEW_ARB_half_float_vertex;
+#endif
+}
+
+bool gl_state_t::int_2_10_10_10_attribs() {
+#ifdef __native_client__
+	return false;
+#else
+	return GLEW_VERSION_3_3 || GLEW_ARB_vertex_type_2_10_10_10_rev;
+#endif
+}
+
+bool gl_state_t::s3tc_textures() {
+#ifdef __native_client__
+	return false;
+#else
+	return GLEW_EXT_texture_compression_s3tc;
+#endif
+}
@@ -0,0 +1,46 @@
+#ifndef __GL_STATE_HPP__
+#define __GL_STATE_HPP__
+
+#include "main.hpp"
+
+/* A shadow of the GL state that drawing changes most: the program, the vertex array object,
+   the array and element buffers, the 2D texture on unit 0 and the vertex attribute arrays.
+   Setting something to what it already is doesn't go to the driver, so barebones draws don't
+   put things back the way they found them; they leave them bound for the next draw.
+
+   Attribute arrays and the element buffer belong to the bound vertex array object, so they
+   are only shadowed for the default one (0); while another is bound, they go straight to GL.
+
+   Code drawing with raw GL calls should call reset() first, which puts the tracked state
+   back to GL's defaults; raw calls that change tracked state must be followed by reset()
+   or invalidate(). main_t invalidates at the start of every frame. */
+
+#ifdef __native_client__ // not in GLES2, so never used there, but named in code that is
+	#define GL_HALF_FLOAT 0x140B
+	#define GL_INT_2_10_10_10_REV 0x8D9F
+	#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+	#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+
+class gl_state_t {
+public:
+	static void use_program(GLuint program);
+	static void bind_vertex_array(GLuint vao); // only if vertex_arrays()
+	static void bind_buffer(GLenum target,GLuint buffer); // GL_ARRAY_BUFFER or GL_ELEMENT_ARRAY_BUFFER
+	static void bind_texture(GLuint texture); // GL_TEXTURE_2D on unit 0
+	// glVertexAttribPointer, and glVertexAttribDivisor if instanced
+	static void vertex_attrib(GLuint loc,GLuint buffer,GLint size,GLenum type,GLboolean normalized,GLsizei stride,size_t offset,GLuint divisor = 0);
+	static void use_attribs(uint32_t mask); // enables exactly these attribute arrays, by location bit
+	static void delete_buffers(GLsizei n,const GLuint* buffers); // glDeleteBuffers, forgetting them
+	static void delete_vertex_arrays(GLsizei n,const GLuint* vaos);
+	static void reset();
+	static void invalidate(); // forget it all; the next calls will go to the driver
+	static bool instancing(); // glVertexAttribDivisor and glDrawElementsInstanced are available
+	static bool vertex_arrays(); // vertex array objects are available
+	static bool half_float_attribs(); // GL_HALF_FLOAT vertex attributes
+	static bool int_2_10_10_10_attribs(); // GL_INT_2_10_10_10_REV vertex attributes
+	static bool s3tc_textures(); // GL_COMPRESSED_RGB_S3TC_DXT1_EXT and GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+	enum { MAX_ATTRIBS = 32 };
+};
+
+#endif//__GL_STATE_HPP__
@@ -1,11 +1,19 @@
 #include "main.hpp"
 #include "rand.hpp"
 #include "build_info.hpp"
+#include "thread.hpp"
+#include "profile.hpp"
+#include "gl_state.hpp"
+#include "texture_cache.hpp"
+#include "atlas.hpp"
 #include <memory>
 #include <map>
 #include <iostream>
+#include <fstream>
 
 #include "../external/SOIL/SOIL.h"
+#include "../external/SOIL/image_helper.h"
+#include "../external/SOIL/image_DXT.h"
 
 #ifdef __native_client__
 	#include "ppapi/cpp/instance.h"
@@ -22,11 +30,49 @@
 	#include "ppapi/cpp/graphics_3d.h"
 #else
 	#include <SDL.h>
+	#include <sys/stat.h>
+	#ifdef __WIN32
+		#include <windows.h>
+	#else
+		#include <sys/mman.h>
+		#include <fcntl.h>
+		#include <unistd.h>
+	#endif
 #endif
 
 namespace {
 	struct _file_io_impl_t;
 	struct _texture_t;
+
+	// the active uniforms or attributes of a linked program, asked of the driver once
+	class _reflection_t {
+	public:
+		struct var_t {
+			std::string name;
+			GLint loc;
+			GLenum type;
+			GLint size;
+		};
+		void reflect(GLuint program,bool uniforms);
+		const var_t* find(const std::string& name) const;
+	private:
+		void add(const var_t& var);
+		static uint32_t hash(const std::string& name);
+		std::vector<var_t> vars;
+		std::vector<int> slots; // open addressed by hash; -1 is empty
+	};
+
+	struct _program_t {
+		_reflection_t uniforms, attributes;
+	};
+
+	// a texture that small ones are packed into
+	struct _atlas_page_t {
+		_atlas_page_t(int s,int unit): size(s), handle(0), packer(s/unit,s/unit) {}
+		int size;
+		GLuint handle;
+		atlas_t packer; // in units of the border, which keeps every slot aligned for the mip levels
+	};
 } // anon namespace
 
 struct main_t::_pimpl_t {
@@ -35,21 +81,157 @@ struct main_t::_pimpl_t {
 	typedef std::vector<callback_t*> callbacks_t;
 	callbacks_t callbacks;
 	bool tick();
+	void drain_completed();
 	typedef std::vector<_file_io_impl_t*> file_io_impls_t;
 	file_io_impls_t file_io_impls;
-	typedef std::map<std::string,_texture_t*> textures_t;
+	completion_queue_t completed;
+	worker_pool_t io_pool;
+	uint64_t io_budget;
+	worker_pool_t cpu_pool; // decoding and other crunching
+	bool compress_textures, gamma_correct_textures;
+	std::string texture_cache_dir; // empty if off
+	uint64_t texture_cache_max_bytes;
+	uint64_t texture_cache_bytes; // as the last trim left it, plus what has been written since
+	bool texture_cache_trimming;
+	void trim_texture_cache();
+	int atlas_page_size, atlas_max_size; // 0 if off
+	std::vector<_atlas_page_t> atlas_pages;
+	typedef std::map<std::pair<std::string,bool>,_texture_t*> textures_t; // by name and if packable
 	textures_t textures;
 	typedef std::map<std::string,GLuint> shared_programs_t;
 	shared_programs_t shared_programs;
+	typedef std::map<GLuint,_program_t> programs_t;
+	programs_t programs;
+	const _program_t& program(GLuint handle);
 	input_key_map_t key_map;
 	input_mouse_map_t mouse_map;
+	frame_timer_t timings;
+	uint64_t clock_step; // if set, _now advances by this much each tick rather than following real time
+	enum {
+		DEFAULT_IO_THREADS = 2,
+		DEFAULT_IO_BUDGET = 2000000, // 2ms
+		ATLAS_LEVELS = 3, // mip levels after the first that packed textures' borders last to
+		ATLAS_BORDER = 1<<ATLAS_LEVELS
+	};
 #ifdef __native_client__
 	pp::Instance* instance;
 #endif
 };
 
 namespace {
-	struct _file_io_impl_t: public main_t::callback_t {
+#ifndef __native_client__
+#ifdef __WIN32
+	// no mmap; read the whole file into a heap buffer
+	bool read_file_bytes(const std::string& name,bytes_t& bytes) {
+		FILE* file = fopen(name.c_str(),"rb");
+		if(!file) return false;
+		std::string buf;
+		fseek(file,0,SEEK_END);
+		buf.resize(ftell(file));
+		fseek(file,0,SEEK_SET);
+		size_t ofs = 0;
+		while(ofs < buf.size()) {
+			const size_t read = fread(&buf.at(ofs),1,buf.size()-ofs,file);
+			if(read <= 0) break;
+			ofs += read;
+		}
+		fclose(file);
+		if(ofs != buf.size()) return false;
+		bytes = bytes_t::take(buf);
+		return true;
+	}
+#else
+	struct _mmap_buffer_t: public bytes_t::buffer_t {
+		_mmap_buffer_t(void* a,size_t l): addr(a), len(l) {}
+		~_mmap_buffer_t() { munmap(addr,len); }
+		void* const addr;
+		const size_t len;
+	};
+
+	// map the file read-only; the view points straight into the page cache
+	bool read_file_bytes(const std::string& name,bytes_t& bytes) {
+		const int fd = open(name.c_str(),O_RDONLY);
+		if(fd == -1) return false;
+		struct stat st;
+		if(fstat(fd,&st) || !S_ISREG(st.st_mode)) {
+			close(fd);
+			return false;
+		}
+		const size_t len = st.st_size;
+		if(!len) { // can't map an empty file
+			close(fd);
+			bytes = bytes_t();
+			return true;
+		}
+		int flags = MAP_PRIVATE;
+	#ifdef MAP_POPULATE
+		flags |= MAP_POPULATE; // do the actual reading now, on the io thread
+	#endif
+		void* addr = mmap(NULL,len,PROT_READ,flags,fd,0);
+		close(fd); // the mapping keeps its own reference
+		if(addr == MAP_FAILED) return false;
+	#ifndef MAP_POPULATE
+		volatile uint8_t touch = 0;
+		for(size_t i=0; i<len; i+=4096)
+			touch ^= static_cast<const uint8_t*>(addr)[i];
+	#endif
+		bytes = bytes_t(static_cast<const uint8_t*>(addr),len,new _mmap_buffer_t(addr,len));
+		return true;
+	}
+#endif
+
+	// writes to a temporary name and renames it into place, so readers never see a partial file
+	struct _file_write_t: public job_t {
+		_file_write_t(const std::string& n,const bytes_t& b): name(n), bytes(b) {}
+		const std::string name;
+		bytes_t bytes;
+		void run() {
+			const std::string tmp = name + ".tmp";
+			FILE* file = fopen(tmp.c_str(),"wb");
+			bool ok = file && (fwrite(bytes.data(),1,bytes.size(),file) == bytes.size());
+			if(file && fclose(file)) ok = false;
+			if(ok) {
+				remove(name.c_str()); // windows won't rename over an existing file
+				ok = !rename(tmp.c_str(),name.c_str());
+			}
+			if(!ok) {
+				std::cerr << "could not write " << name << std::endl;
+				remove(tmp.c_str());
+			}
+			bytes = bytes_t();
+		}
+		void done() {
+			delete this;
+		}
+	};
+
+	// scans the texture cache, trimming it back to three quarters of its size if it is over, so
+	// that the next is a while coming; what was written meanwhile is still counted when it's done
+	struct _texture_cache_trim_t: public job_t {
+		_texture_cache_trim_t(main_t::_pimpl_t& p): pimpl(p), dir(p.texture_cache_dir), max_bytes(p.texture_cache_max_bytes),
+			written(p.texture_cache_bytes), left(0) {}
+		main_t::_pimpl_t& pimpl;
+		const std::string dir;
+		const uint64_t max_bytes, written;
+		uint64_t left;
+		void run() {
+			PROFILE_ZONE("texture cache trim");
+			left = texture_cache_t::trim(dir,max_bytes,max_bytes-max_bytes/4);
+		}
+		void done() {
+			if((dir == pimpl.texture_cache_dir) && (pimpl.texture_cache_bytes >= written))
+				pimpl.texture_cache_bytes = left+(pimpl.texture_cache_bytes-written);
+			pimpl.texture_cache_trimming = false;
+			delete this;
+		}
+	};
+#endif
+
+	struct _file_io_impl_t: public main_t::callback_t
+#ifndef __native_client__
+		, public job_t
+#endif
+	{
 		_file_io_impl_t(main_t::_pimpl_t& p,const std::string& n,main_t::file_io_t* cb,intptr_t d): 
 			pimpl(p), name(n), callback(cb), data(d), ok(false), cancelled(false)
 	#ifdef __native_client__
@@ -67,20 +249,14 @@ namespace {
 		}
 	#else
 		{
-			if(FILE* file = fopen(name.c_str(),"rb")) {
-				fseek(file,0,SEEK_END);
-				bytes.resize(ftell(file));
-				fseek(file,0,SEEK_SET);
-				size_t ofs = 0;
-				while(ofs < bytes.size()) {
-					const size_t read = fread(&bytes.at(ofs),1,bytes.size()-ofs,file);
-					if(read <= 0) break;
-					ofs += read;
-				}
-				ok = (ofs == bytes.size());
-				fclose(file);
-			}
-			fire();
+			pimpl.io_pool.post(this);
+		}
+		void run() {
+			PROFILE_ZONE_DETAIL("read file",name);
+			ok = read_file_bytes(name,bytes);
+		}
+		void done() {
+			on_fire();
 		}
 	#endif
 		main_t::_pimpl_t& pimpl;
@@ -88,11 +264,14 @@ namespace {
 		main_t::file_io_t* const callback;
 		const intptr_t data;
 		bool ok, cancelled;
-		std::string bytes;
+		bytes_t bytes;
 		void on_fire() {
-			if(!cancelled)
-				callback->on_io(name,ok,bytes,data);
 			remove();
+			if(!cancelled) {
+				PROFILE_ZONE_DETAIL("on_io",name);
+				callback->on_io(name,ok,bytes,data);
+			}
+			delete this;
 		}
 		void cancel() {
 			remove();
@@ -109,6 +288,7 @@ namespace {
 	#ifdef __native_client__
 		pp::URLLoader nc_url_loader;
 		pp::URLRequestInfo nc_url_info;
+		std::string nc_url_buf;
 		size_t nc_url_ofs;
 		static void nc_url_open(void* ptr,int32_t code) {
 			_file_io_impl_t* self = static_cast<_file_io_impl_t*>(ptr);
@@ -126,7 +306,8 @@ namespace {
 				self->nc_url_do_read();
 				return;
 			} else if(code == 0) {
-				self->bytes.resize(self->nc_url_ofs);
+				self->nc_url_buf.resize(self->nc_url_ofs);
+				self->bytes = bytes_t::take(self->nc_url_buf);
 				self->ok = true;
 			}
 			self->fire();
@@ -135,15 +316,16 @@ namespace {
 			enum { bytes_to_read = 1024*4 };
 			int result;
 			for(;;) {
-				bytes.resize(nc_url_ofs+bytes_to_read);
-				result = nc_url_loader.ReadResponseBody(&bytes.at(nc_url_ofs),bytes_to_read,pp::CompletionCallback(nc_url_read,this));
+				nc_url_buf.resize(nc_url_ofs+bytes_to_read);
+				result = nc_url_loader.ReadResponseBody(&nc_url_buf.at(nc_url_ofs),bytes_to_read,pp::CompletionCallback(nc_url_read,this));
 				//std::cout << "nc_url_do_read(" << path << ',' << nc_url_ofs << ")=" << result << std::endl;
 				if(result > 0)
 					nc_url_ofs += result;
 				else if(result == PP_OK_COMPLETIONPENDING)
 					return;
 				else if(result == PP_OK) {
-					bytes.resize(nc_url_ofs);
+					nc_url_buf.resize(nc_url_ofs);
+					bytes = bytes_t::take(nc_url_buf);
 					ok = true;
 					break;
 				} else
@@ -154,27 +336,419 @@ namespace {
 	#endif
 	};
 	
-	struct _texture_t: public main_t::file_io_t, public main_t::callback_t {
-		_texture_t(main_t& m,const std::string& fn): main(m), filename(fn), handle(0), loaded(false) {
-			main.read_file(filename,this,0);
+	struct _texture_t;
+
+	// a band of one of the steps of loading a texture, on a worker
+	struct _texture_band_t: public job_t {
+		_texture_band_t(_texture_t& t,size_t b): texture(t), band(b) {}
+		void run();
+		void done();
+		_texture_t& texture;
+		const size_t band;
+	};
+
+	// textures are decoded, scaled, mipmapped and perhaps compressed on workers, and only uploaded on
+	// the main thread; each step of a big texture is split into bands of rows that the workers share,
+	// and the next step is started when the last band is done(). With a texture cache, the source's
+	// hash is looked up first, and a hit is read and uploaded as it is; a miss is saved once made.
+	// Small packable textures are bordered and copied into an atlas page rather than uploaded alone
+	struct _texture_t: public main_t::file_io_t, public main_t::callback_t, public job_t {
+		_texture_t(main_t::_pimpl_t& p,const std::string& fn,bool pk): pimpl(p), main(p.main), filename(fn), packable(pk),
+			handle(0), loaded(false), max_size(0), channels(0), compress(false), gamma(false), pack_size(0), page_size(0),
+			step(DECODE), width(0), height(0), img(NULL), resampled(NULL), outstanding(1), error(NULL) {
+			const main_t::texture_rect_t all = {0,0,1,1};
+			rect = all;
+			main.read_file(filename,this,LOAD_SOURCE);
 		}
-		void on_io(const std::string& name,bool ok,const std::string& bytes,intptr_t data) {
-			loaded = true;
-			if(ok) {
-				handle = SOIL_load_OGL_texture_from_memory(
-					reinterpret_cast<const unsigned char*>(bytes.c_str()),bytes.size(),
-					SOIL_LOAD_AUTO,
-					SOIL_CREATE_NEW_ID,
-					SOIL_FLAG_POWER_OF_TWO|SOIL_FLAG_MIPMAPS);
+		enum { LOAD_SOURCE, LOAD_CACHE };
+		void on_io(const std::string& name,bool ok,const bytes_t& bytes,intptr_t data) {
+			if(LOAD_CACHE == data) {
+				on_cache_io(ok,bytes);
+				return;
+			}
+			if(!ok) {
+				std::cerr << "could not load texture " << filename << std::endl;
+				step = UPLOAD;
+				done();
+				return;
+			}
+			this->bytes = bytes;
+			glGetIntegerv(GL_MAX_TEXTURE_SIZE,&max_size);
+			compress = pimpl.compress_textures && gl_state_t::s3tc_textures();
+			gamma = pimpl.gamma_correct_textures;
+			if(packable && pimpl.atlas_page_size) {
+				pack_size = pimpl.atlas_max_size;
+				page_size = pimpl.atlas_page_size;
+			}
+			cache_dir = pimpl.texture_cache_dir;
+			if(cache_dir.size())
+				step = LOOKUP;
+			pimpl.cpu_pool.post(this);
+		}
+		void on_cache_io(bool ok,const bytes_t& bytes) {
+			texture_cache_t::format_t format;
+			texture_cache_t::levels_t levels;
+			if(!ok || !texture_cache_t::load(bytes,format,levels)) { // gone, or not one of ours; make it after all
+				step = DECODE;
+				pimpl.cpu_pool.post(this);
+				return;
+			}
+			cached = bytes;
+			this->bytes = bytes_t();
+			compress = (texture_cache_t::DXT1 == format) || (texture_cache_t::DXT5 == format);
+			channels = compress? ((texture_cache_t::DXT5 == format)? 4: 3): format;
+			width = levels[0].width;
+			height = levels[0].height;
+			for(texture_cache_t::levels_t::const_iterator l=levels.begin(); l!=levels.end(); l++) {
+				unsigned char* data = const_cast<unsigned char*>(l->data); // never freed, as cached is
+				const mip_t mip = {l->width,l->height,compress? NULL: data,compress? data: NULL,(int)l->size};
+				mips.push_back(mip);
+			}
+			texture_cache_t::touch(cache_path);
+			cache_path.clear(); // nothing to save
+			step = SAVE; // as if just made, so it's packed if it is to be
+			done();
+		}
+		void run() { // worker thread; what SOIL_FLAG_POWER_OF_TWO|SOIL_FLAG_MIPMAPS does, minus the GL
+			if(LOOKUP == step) {
+				PROFILE_ZONE_DETAIL("texture hash",filename);
+				cache_path = texture_cache_t::path(cache_dir,bytes,max_size,pack_size,compress,gamma);
+				if(main_t::file_mtime(cache_path) >= 0)
+					return; // done() reads it
+				step = DECODE;
+			}
+			PROFILE_ZONE_DETAIL("texture decode",filename);
+			img = SOIL_load_image_from_memory(bytes.data(),bytes.size(),&width,&height,&channels,SOIL_LOAD_AUTO);
+			bytes = bytes_t();
+			if(!img) {
+				error = "decode failed"; // not SOIL_last_result(), which every thread's decodes share
+				step = UPLOAD;
+				return;
 			}
+			next_step(true);
+		}
+		enum step_t { LOOKUP, DECODE, SCALE, SHRINK, MIPMAP, COMPRESS, SAVE, PACK, UPLOAD };
+		enum { BAND_PIXELS = 1<<16 }; // about a job's worth
+		// goes on to the next step that has work to do; on a worker, a step too small to split is
+		// done there and then, else its bands are posted
+		void next_step(bool on_worker) {
+			while(UPLOAD != (step = step_t(step+1))) {
+				const size_t bands = plan_step();
+				if(!bands)
+					continue;
+				if(on_worker && (1 == bands)) {
+					run_band(0);
+					end_step();
+					continue;
+				}
+				// counted before any is posted, as their done() may come before this returns
+				outstanding += bands;
+				for(size_t i=0; i<bands; i++)
+					pimpl.cpu_pool.post(new _texture_band_t(*this,i));
+				return;
+			}
+		}
+		size_t plan_step() { // sets up the step, returning how many bands it has
+			switch(step) {
+			case SCALE: { // up to a power of two
+				resampled_width = resampled_height = 1;
+				while(resampled_width < width) resampled_width *= 2;
+				while(resampled_height < height) resampled_height *= 2;
+				if((resampled_width == width) && (resampled_height == height))
+					return 0;
+				resampled = (unsigned char*)malloc(channels*resampled_width*resampled_height);
+				band_rows = std::max<int>(1,BAND_PIXELS/resampled_width);
+				return (resampled_height+band_rows-1)/band_rows;
+			}
+			case SHRINK: // down to what the GL can take
+				if((width <= max_size) && (height <= max_size))
+					return 0;
+				resampled_width = std::min<int>(width,max_size);
+				resampled_height = std::min<int>(height,max_size);
+				resampled = (unsigned char*)malloc(channels*resampled_width*resampled_height);
+				return 1;
+			case MIPMAP: {
+				const mip_t base = {width,height,img,NULL,0};
+				mips.push_back(base);
+				levels = 0;
+				while(((1<<(levels+1)) <= width) || ((1<<(levels+1)) <= height)) {
+					levels++;
+					const mip_t mip = {std::max(width>>levels,1),std::max(height>>levels,1),NULL,NULL,0};
+					mips.push_back(mip);
+					mips.back().pixels = (unsigned char*)malloc(channels*mip.width*mip.height);
+					mip_pixels.push_back(mips.back().pixels);
+				}
+				if(!levels)
+					return 0;
+				// bands of a power of two rows hold whole blocks of the first few levels; the sums
+				// of the last of those in each band are then gone on from for the rest
+				band_rows = 2;
+				band_levels = 1;
+				while((band_rows < height) && (band_rows*width < BAND_PIXELS)) {
+					band_rows *= 2;
+					band_levels++;
+				}
+				if(band_rows >= height) {
+					band_rows = height;
+					band_levels = levels;
+					return 1;
+				}
+				sums.resize(channels*std::max(width>>band_levels,1)*std::max(height>>band_levels,1));
+				return height/band_rows;
+			}
+			case COMPRESS: {
+				if(packs()) // atlas pages aren't compressed
+					compress = false;
+				if(!compress)
+					return 0;
+				// about the same number of blocks per band; big levels are split, small ones are lumped together
+				enum { BAND_BLOCKS = BAND_PIXELS/16 };
+				splits.assign(1,0);
+				size_t rows = 0, blocks = 0;
+				for(size_t i=0; i<mips.size(); i++) {
+					mip_t& mip = mips[i];
+					mip.compressed_size = DXT_image_size(mip.width,mip.height,dxt5());
+					mip.compressed = (unsigned char*)malloc(mip.compressed_size);
+					const size_t blocks_x = (mip.width+3)/4, blocks_y = (mip.height+3)/4;
+					for(size_t row=0; row<blocks_y; row++) {
+						rows++;
+						blocks += blocks_x;
+						if(blocks >= BAND_BLOCKS) {
+							splits.push_back(rows);
+							blocks = 0;
+						}
+					}
+				}
+				if(splits.back() < rows)
+					splits.push_back(rows);
+				return splits.size()-1;
+			}
+			case SAVE: // to the cache, as it will be uploaded
+				return cache_path.size()? 1: 0;
+			case PACK:
+				if(!packs() || compress)
+					return 0;
+				padded.resize(mips.size());
+				return 1;
+			default:
+				return 0;
+			}
+		}
+		static const char* step_name(step_t step) {
+			static const char* const names[] = {"texture lookup","texture decode","texture scale","texture shrink","texture mipmap",
+				"texture compress","texture save","texture pack"};
+			return names[step];
+		}
+		void run_band(size_t band) { // any thread
+			PROFILE_ZONE_DETAIL(step_name(step),filename);
+			switch(step) {
+			case SCALE: {
+				const int first = band*band_rows;
+				up_scale_image_band(img,width,height,channels,resampled,resampled_width,resampled_height,gamma,
+					first,std::min(band_rows,resampled_height-first));
+			} break;
+			case SHRINK:
+				mipmap_image_gamma(img,width,height,channels,resampled,width/resampled_width,height/resampled_height,gamma);
+				break;
+			case MIPMAP:
+				mipmap_image_band(img,width,height,channels,gamma,band*band_rows,band_rows,band_levels,&mip_pixels[0],
+					sums.size()? &sums[0]: NULL);
+				break;
+			case COMPRESS:
+				compress_rows(splits[band],splits[band+1]);
+				break;
+			case SAVE: {
+				texture_cache_t::levels_t levels;
+				for(size_t i=0; i<mips.size(); i++) {
+					const texture_cache_t::level_t level = {mips[i].width,mips[i].height,compress? mips[i].compressed: mips[i].pixels,
+						compress? (size_t)mips[i].compressed_size: (size_t)channels*mips[i].width*mips[i].height};
+					levels.push_back(level);
+				}
+				const texture_cache_t::format_t format = compress? (dxt5()? texture_cache_t::DXT5: texture_cache_t::DXT1):
+					texture_cache_t::format_t(channels);
+				saved = texture_cache_t::save(format,levels);
+			} break;
+			case PACK:
+				for(size_t i=0; i<mips.size(); i++)
+					pad_level(i);
+				break;
+			default:;
+			}
+		}
+		void end_step() { // after its last band
+			switch(step) {
+			case SCALE:
+			case SHRINK:
+				SOIL_free_image_data(img);
+				img = resampled;
+				resampled = NULL;
+				width = resampled_width;
+				height = resampled_height;
+				break;
+			case MIPMAP:
+				if(band_levels < levels)
+					mipmap_image_sums(&sums[0],width,height,channels,gamma,band_levels,levels-band_levels,&mip_pixels[band_levels]);
+				std::vector<unsigned int>().swap(sums);
+				mip_pixels.clear();
+				break;
+			default:;
+			}
+		}
+		bool dxt5() const { return !(channels & 1); } // if there's alpha
+		bool packs() const { // once scaled
+			return pack_size && (width <= pack_size) && (height <= pack_size) &&
+				(width >= main_t::_pimpl_t::ATLAS_BORDER) && (height >= main_t::_pimpl_t::ATLAS_BORDER);
+		}
+		void pad_level(size_t level) { // as RGBA, with its edge texels repeated out as far as its border
+			const mip_t& mip = mips[level];
+			const int border = main_t::_pimpl_t::ATLAS_BORDER>>level, w = mip.width+2*border, h = mip.height+2*border;
+			std::vector<unsigned char>& out = padded[level];
+			out.resize(w*h*4);
+			unsigned char* dest = &out[0];
+			for(int y=0; y<h; y++) {
+				const unsigned char* row = mip.pixels+std::min(std::max(y-border,0),mip.height-1)*mip.width*channels;
+				for(int x=0; x<w; x++, dest+=4) {
+					const unsigned char* src = row+std::min(std::max(x-border,0),mip.width-1)*channels;
+					dest[0] = src[0];
+					dest[1] = src[(channels < 3)? 0: 1];
+					dest[2] = src[(channels < 3)? 0: 2];
+					dest[3] = (channels & 1)? 255: src[channels-1];
+				}
+			}
+		}
+		void upload_packed() { // main thread; into the first page with room
+			enum { BORDER = main_t::_pimpl_t::ATLAS_BORDER };
+			const int slot_width = width/BORDER+2, slot_height = height/BORDER+2;
+			int x, y;
+			size_t p = 0;
+			while((p < pimpl.atlas_pages.size()) && !pimpl.atlas_pages[p].packer.add(slot_width,slot_height,x,y))
+				p++;
+			if(p == pimpl.atlas_pages.size()) {
+				pimpl.atlas_pages.push_back(_atlas_page_t(page_size,BORDER));
+				new_page(pimpl.atlas_pages.back());
+				if(!pimpl.atlas_pages.back().packer.add(slot_width,slot_height,x,y))
+					graphics_error("cannot pack " << filename << " into an atlas page of " << page_size);
+			}
+			const _atlas_page_t& page = pimpl.atlas_pages[p];
+			x = (x+1)*BORDER; // the texture itself, within its border
+			y = (y+1)*BORDER;
+			gl_state_t::bind_texture(page.handle);
+			glPixelStorei(GL_UNPACK_ALIGNMENT,1);
+			// exact while there's a border, as the slots are aligned to it; after that, it's
+			// only as near as the page's texels allow
+			for(size_t i=0; i<padded.size(); i++) {
+				const int border = BORDER>>i;
+				glTexSubImage2D(GL_TEXTURE_2D,i,(x>>i)-border,(y>>i)-border,mips[i].width+2*border,mips[i].height+2*border,
+					GL_RGBA,GL_UNSIGNED_BYTE,&padded[i][0]);
+			}
+			glCheck();
+			std::vector<std::vector<unsigned char> >().swap(padded);
+			handle = page.handle;
+			const main_t::texture_rect_t r = {(float)x/page.size,(float)y/page.size,
+				(float)(x+width)/page.size,(float)(y+height)/page.size};
+			rect = r;
+		}
+		static void new_page(_atlas_page_t& page) {
+			glGenTextures(1,&page.handle);
+			gl_state_t::bind_texture(page.handle);
+			const std::vector<unsigned char> blank(page.size*page.size*4); // so the gaps are defined
+			for(int level=0; page.size>>level; level++)
+				glTexImage2D(GL_TEXTURE_2D,level,GL_RGBA,page.size>>level,page.size>>level,0,GL_RGBA,GL_UNSIGNED_BYTE,&blank[0]);
+			glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MAG_FILTER,GL_LINEAR);
+			glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MIN_FILTER,GL_LINEAR_MIPMAP_LINEAR);
+		#ifdef __native_client__
+			glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_WRAP_S,GL_CLAMP_TO_EDGE);
+			glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_WRAP_T,GL_CLAMP_TO_EDGE);
+		#else
+			glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_WRAP_S,GL_CLAMP);
+			glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_WRAP_T,GL_CLAMP);
+			// the smaller levels would blend neighbours together; GLES has to have them all, though
+			glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MAX_LEVEL,main_t::_pimpl_t::ATLAS_LEVELS);
+		#endif
+			glCheck();
+		}
+		void compress_rows(size_t first,size_t last) { // any thread
+			size_t row = 0; // of the mip level
+			for(size_t i=0; (i<mips.size()) && (row<last); i++) {
+				const mip_t& mip = mips[i];
+				const size_t rows = (mip.height+3)/4;
+				if(row+rows > first) {
+					const size_t from = std::max(first,row), to = std::min(last,row+rows);
+					convert_image_rows_to_DXT(mip.pixels,mip.width,mip.height,channels,dxt5(),from-row,to-from,mip.compressed);
+				}
+				row += rows;
+			}
+		}
+		void done() { // main thread, after this and after each band
+			if(--outstanding)
+				return;
+			if(LOOKUP == step) { // it's in the cache
+				outstanding = 1;
+				main.read_file(cache_path,this,LOAD_CACHE);
+				return;
+			}
+			if(UPLOAD != step) { // the last band of a step
+				end_step();
+				next_step(false);
+				if(outstanding)
+					return;
+			}
+			PROFILE_GPU_ZONE("texture upload");
+			if(padded.size()) {
+				upload_packed();
+				free_mips();
+			} else if(mips.size()) {
+				static const GLenum formats[] = {GL_LUMINANCE,GL_LUMINANCE_ALPHA,GL_RGB,GL_RGBA};
+				const GLenum format = formats[channels-1];
+				glGenTextures(1,&handle);
+				gl_state_t::bind_texture(handle);
+				glPixelStorei(GL_UNPACK_ALIGNMENT,1);
+				for(size_t i=0; i<mips.size(); i++) {
+					if(compress) {
+						glCompressedTexImage2D(GL_TEXTURE_2D,i,dxt5()? GL_COMPRESSED_RGBA_S3TC_DXT5_EXT: GL_COMPRESSED_RGB_S3TC_DXT1_EXT,
+							mips[i].width,mips[i].height,0,mips[i].compressed_size,mips[i].compressed);
+					} else
+						glTexImage2D(GL_TEXTURE_2D,i,format,mips[i].width,mips[i].height,0,format,GL_UNSIGNED_BYTE,mips[i].pixels);
+				}
+				free_mips();
+				glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MAG_FILTER,GL_LINEAR);
+				glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MIN_FILTER,GL_LINEAR_MIPMAP_LINEAR);
+			#ifdef __native_client__
+				glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_WRAP_S,GL_CLAMP_TO_EDGE);
+				glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_WRAP_T,GL_CLAMP_TO_EDGE);
+			#else
+				glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_WRAP_S,GL_CLAMP);
+				glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_WRAP_T,GL_CLAMP);
+			#endif
+				glCheck();
+			} else if(error)
+				std::cerr << "could not decode texture " << filename << ": " << error << std::endl;
+		#ifndef __native_client__
+			if(saved.size()) {
+				pimpl.io_pool.post(new _file_write_t(cache_path,saved));
+				pimpl.texture_cache_bytes += saved.size();
+				pimpl.trim_texture_cache();
+			}
+		#endif
+			saved = bytes_t();
+			loaded = true;
 			if(queue.size())
 				main.add_callback(this);
 		}
+		void free_mips() {
+			if(!cached.size())
+				for(size_t i=0; i<mips.size(); i++) {
+					free(mips[i].compressed);
+					SOIL_free_image_data(mips[i].pixels);
+				}
+			mips.clear();
+			cached = bytes_t();
+		}
 		void on_fire() {
 			queue_t q(queue); // copy for reentry
 			queue.clear();
 			for(queue_t::iterator i=q.begin(); i!=q.end(); i++)
-				i->callback->on_texture_loaded(filename,handle,i->data);
+				i->callback->on_texture_loaded(filename,handle,rect,i->data);
 		}
 		void add(main_t::texture_load_t* callback,intptr_t data) {
 			if(loaded && !queue.size())
@@ -182,10 +756,41 @@ namespace {
 			const waiting_t w = {callback,data};
 			queue.push_back(w);
 		}
+		main_t::_pimpl_t& pimpl;
 		main_t& main;
 		const std::string filename;
-		GLuint handle;
+		const bool packable;
+		GLuint handle; // or the atlas page
+		main_t::texture_rect_t rect;
 		bool loaded;
+		bytes_t bytes;
+		GLint max_size;
+		int channels;
+		bool compress; // to DXT1, or DXT5 if there's alpha
+		bool gamma; // scale and mipmap in linear light
+		int pack_size, page_size; // into the atlas if no bigger than pack_size; 0 if not packable
+		std::vector<std::vector<unsigned char> > padded; // mip levels bordered for the atlas
+		std::string cache_dir, cache_path; // cache_path is set once the source is hashed, if it's to be saved
+		bytes_t cached; // the cache file the mips point into, on a hit
+		bytes_t saved; // for the cache
+		step_t step;
+		int width, height; // of img, as it is so far
+		unsigned char* img;
+		unsigned char* resampled; // what img becomes after this step
+		int resampled_width, resampled_height;
+		int band_rows, levels, band_levels;
+		std::vector<unsigned int> sums; // of the last level that the mipmap bands make
+		std::vector<unsigned char*> mip_pixels; // levels 1 and on
+		std::vector<size_t> splits; // of the compress bands, in block rows counting on through the mip levels
+		size_t outstanding; // jobs to be done() before the next step
+		const char* error;
+		struct mip_t {
+			int width, height;
+			unsigned char* pixels;
+			unsigned char* compressed;
+			int compressed_size;
+		};
+		std::vector<mip_t> mips;
 		struct waiting_t {
 			main_t::texture_load_t* callback;
 			intptr_t data;
@@ -196,20 +801,69 @@ namespace {
 		typedef std::vector<waiting_t> queue_t;
 		queue_t queue;
 	};
+
+	void _texture_band_t::run() {
+		texture.run_band(band);
+	}
+
+	void _texture_band_t::done() {
+		texture.done();
+		delete this;
+	}
 } // anon namespace
 
+void main_t::_pimpl_t::drain_completed() {
+	PROFILE_ZONE("io delivery");
+	// always deliver at least one, so a tiny budget still makes progress
+	const uint64_t deadline = high_precision_time() + io_budget;
+	while(job_t* job = completed.pop()) {
+		job->done();
+		if(high_precision_time() >= deadline)
+			break;
+	}
+}
+
+void main_t::_pimpl_t::trim_texture_cache() { // a scan only once the running total goes over
+#ifndef __native_client__
+	if(texture_cache_trimming || (texture_cache_bytes <= texture_cache_max_bytes))
+		return;
+	texture_cache_trimming = true;
+	io_pool.post(new _texture_cache_trim_t(*this));
+#endif
+}
+
 bool main_t::_pimpl_t::tick() {
-	main._now = high_precision_time(); 
+	main._now = clock_step? main._now+clock_step: high_precision_time();
+	timings.begin_frame();
+	PROFILE_FRAME();
+	PROFILE_COUNTER("file reads pending",file_io_impls.size());
+	gl_state_t::invalidate(); // in case the game made raw GL calls last frame
+	drain_completed();
+	timings.lap(PHASE_IO);
 	if(callbacks.size()) {
+		PROFILE_ZONE("callbacks");
 		callbacks_t cb(callbacks); // from copy
 		callbacks.clear();
 		for(callbacks_t::iterator i=cb.begin(); i!=cb.end(); i++)
 			(*i)->on_fire();
 	}
-	return main.tick();
+	timings.lap(PHASE_CALLBACKS);
+	bool running;
+	{
+		PROFILE_GPU_ZONE("tick");
+		running = main.tick();
+	}
+	if(!gl_debug()) { // glCheck() hasn't been looking, so check the frame as a whole
+		const GLenum error = glGetError();
+		if(GL_NO_ERROR != error)
+			graphics_error("GL error 0x" << std::hex << error << " this frame; run with --gl-debug to find where");
+	}
+	timings.lap(PHASE_TICK);
+	return running;
 }
 
 main_t::main_t(void* platform_ptr): width(0), height(0), _pimpl(new _pimpl_t(*this,platform_ptr)) {
+	set_gl_debug(_gl_debug); // now there's a context to hook KHR_debug into
 	glCheck();
 	glDepthFunc(GL_LESS);
 	glEnable(GL_DEPTH_TEST);
@@ -231,6 +885,60 @@ main_t::~main_t() {
 const main_t::input_key_map_t& main_t::keys() const { return _pimpl->key_map; }
 const main_t::input_mouse_map_t& main_t::mouse() const { return _pimpl->mouse_map; }
 
+frame_timer_t::stats_t main_t::frame_timing(frame_phase_t phase,size_t window) const {
+	return _pimpl->timings.stats(phase,window);
+}
+
+void main_t::dump_frame_timings(const std::string& csv_filename) const {
+	std::ofstream csv(csv_filename.c_str());
+	if(!csv)
+		data_error("cannot write frame timings to " << csv_filename);
+	const frame_timer_t& timings = _pimpl->timings;
+	csv << "frame,io_ns,callbacks_ns,tick_ns,swap_ns,events_ns,frame_ns\n";
+	for(size_t ago=timings.history(); ago--; ) {
+		const uint64_t* frame = timings.frame(ago);
+		csv << (timings.count()-1-ago);
+		for(int phase=0; phase<=PHASE_FRAME; phase++)
+			csv << ',' << frame[phase];
+		csv << '\n';
+	}
+	if(!csv.flush())
+		data_error("error writing frame timings to " << csv_filename);
+}
+
+bool main_t::_gl_debug = false;
+
+#ifndef __native_client__
+static void GLAPIENTRY gl_debug_message(GLenum source,GLenum type,GLuint id,GLenum severity,GLsizei length,const GLchar* message,const void*) {
+	if(GL_DEBUG_SEVERITY_NOTIFICATION != severity)
+		std::cerr << "GL: " << message << std::endl;
+}
+#endif
+
+void main_t::set_gl_debug(bool on) {
+	_gl_debug = on;
+#ifndef __native_client__
+	if(GLEW_KHR_debug) {
+		if(on) {
+			glEnable(GL_DEBUG_OUTPUT);
+			glEnable(GL_DEBUG_OUTPUT_SYNCHRONOUS); // so a breakpoint in the callback has the culprit on the stack
+			glDebugMessageCallback(gl_debug_message,NULL);
+		} else {
+			glDebugMessageCallback(NULL,NULL);
+			glDisable(GL_DEBUG_OUTPUT);
+		}
+	}
+#endif
+}
+
+static bool is_linked(GLuint program) {
+	GLint linked = GL_FALSE;
+	if(glIsProgram(program))
+		glGetProgramiv(program,GL_LINK_STATUS,&linked);
+	glCheck();
+	return (GL_TRUE == linked);
+}
+
 static void glsl_log(GLuint obj,const std::string& src) {
 	int len = 0;
 	char log[4096];
@@ -261,6 +969,7 @@ static void glsl_log(GLuint obj,const std::string& src) {
 }
 
 GLuint main_t::create_program(const char* vertex,const char* fragment) {
+	PROFILE_ZONE("create_program");
 #ifdef __native_client__
 	const std::string precision("precision lowp float;\n");
 #else
@@ -293,59 +1002,106 @@ GLuint main_t::create_program(const char* vertex,const char* fragment) {
 	glDeleteShader(vs);
 	glDeleteShader(fs);
 	glCheck();
+	_pimpl->programs.erase(program); // the handle may have been recycled
+	if(is_linked(program))
+		_pimpl->program(program);
 	return program;
 }
 
-GLint main_t::get_uniform_loc(GLuint prog,const std::string& name,GLenum type,int size) {
-	glCheck();
-	graphics_assert(glIsProgram(prog));
-	GLint loc = glGetUniformLocation(prog,name.c_str());
-	glCheck();
-	if(loc == -1) graphics_error("could not get uniform " << name);
-	GLchar n[100];
-	GLint l;
-	GLint s;
-	GLenum t;
-	GLint num_uniforms = 0; // uniforms and attributes may be in same array :(
-	glGetProgramiv(prog,GL_ACTIVE_UNIFORMS,&num_uniforms);
+void _reflection_t::reflect(GLuint program,bool uniforms) {
+	vars.clear();
+	slots.clear();
+	GLint count = 0, max_len = 0;
+	glGetProgramiv(program,uniforms? GL_ACTIVE_UNIFORMS: GL_ACTIVE_ATTRIBUTES,&count);
+	glGetProgramiv(program,uniforms? GL_ACTIVE_UNIFORM_MAX_LENGTH: GL_ACTIVE_ATTRIBUTE_MAX_LENGTH,&max_len);
 	glCheck();
-	for(int idx=0; idx<num_uniforms; idx++) {
-		glGetActiveUniform(prog,idx,sizeof(n),&l,&s,&t,n);
+	std::vector<GLchar> n(std::max(max_len,1)+1);
+	for(GLint idx=0; idx<count; idx++) {
+		GLsizei len = 0;
+		var_t var;
+		if(uniforms)
+			glGetActiveUniform(program,idx,n.size(),&len,&var.size,&var.type,&n[0]);
+		else
+			glGetActiveAttrib(program,idx,n.size(),&len,&var.size,&var.type,&n[0]);
 		glCheck();
-		if(name == n) {
-			graphics_assert(!type || (type == t));
-			graphics_assert(size == s);
-			return loc;
+		var.name.assign(&n[0],len);
+		var.loc = uniforms? glGetUniformLocation(program,&n[0]): glGetAttribLocation(program,&n[0]);
+		glCheck();
+		if(var.loc == -1) // built-ins such as gl_Vertex are active but have no location
+			continue;
+		add(var);
+		// arrays are reported as name[0], but are looked up by their plain name
+		if((var.name.size() > 3) && !var.name.compare(var.name.size()-3,3,"[0]")) {
+			var.name.resize(var.name.size()-3);
+			add(var);
 		}
 	}
-	graphics_error(name.c_str());
-	return loc; // dumb compiler
+	slots.assign(16,-1);
+	while(slots.size() < vars.size()*2)
+		slots.resize(slots.size()*2,-1);
+	const size_t mask = slots.size()-1;
+	for(size_t v=0; v<vars.size(); v++) {
+		size_t slot = hash(vars[v].name)&mask;
+		while(slots[slot] != -1)
+			slot = (slot+1)&mask;
+		slots[slot] = v;
+	}
 }
 
-GLint main_t::get_attribute_loc(GLuint prog,const std::string& name,GLenum type,int size) {
-	glCheck();
-	graphics_assert(glIsProgram(prog));
-	GLint loc = glGetAttribLocation(prog,name.c_str());
+void _reflection_t::add(const var_t& var) {
+	if(!find(var.name))
+		vars.push_back(var);
+}
+
+const _reflection_t::var_t* _reflection_t::find(const std::string& name) const {
+	if(slots.empty()) { // still reflecting
+		for(std::vector<var_t>::const_iterator v=vars.begin(); v!=vars.end(); v++)
+			if(v->name == name)
+				return &*v;
+		return NULL;
+	}
+	const size_t mask = slots.size()-1;
+	for(size_t slot=hash(name)&mask; slots[slot] != -1; slot=(slot+1)&mask)
+		if(vars[slots[slot]].name == name)
+			return &vars[slots[slot]];
+	return NULL;
+}
+
+uint32_t _reflection_t::hash(const std::string& name) { // FNV-1a
+	uint32_t hash = 2166136261u;
+	for(size_t i=0; i<name.size(); i++)
+		hash = (hash ^ (uint8_t)name[i]) * 16777619u;
+	return hash;
+}
+
+// programs linked by create_program() are reflected straight away, others when first used
+const _program_t& main_t::_pimpl_t::program(GLuint handle) {
+	programs_t::iterator i = programs.find(handle);
+	if(i != programs.end())
+		return i->second;
+	if(!is_linked(handle)) graphics_error("program " << handle << " is not linked");
+	_program_t& reflected = programs[handle];
+	reflected.uniforms.reflect(handle,true);
+	reflected.attributes.reflect(handle,false);
+	return reflected;
+}
+
+GLint main_t::get_uniform_loc(GLuint prog,const std::string& name,GLenum type,int size) {
 	glCheck();
-	if(loc == -1) graphics_error("could not get attribute " << name);
-	GLchar n[100];
-	GLint l;
-	GLint s;
-	GLenum t;
-	GLint num_attributes = 0; // uniforms and attributes may be in same array :(
-	glGetProgramiv(prog,GL_ACTIVE_ATTRIBUTES,&num_attributes);
+	const _reflection_t::var_t* var = _pimpl->program(prog).uniforms.find(name);
+	if(!var) graphics_error("could not get uniform " << name);
+	graphics_assert(!type || (type == var->type));
+	graphics_assert(size == var->size);
+	return var->loc;
+}
+
+GLint main_t::get_attribute_loc(GLuint prog,const std::string& name,GLenum type,int size) {
 	glCheck();
-	for(int idx=0; idx<num_attributes; idx++) {
-		glGetActiveAttrib(prog,idx,sizeof(n),&l,&s,&t,n);
-		glCheck();
-		if(name == n) {
-			graphics_assert(!type || (type == t));
-			graphics_assert(size == s);
-			return loc;
-		}
-	}
-	graphics_error(name.c_str());
-	return loc; // dumb compiler
+	const _reflection_t::var_t* var = _pimpl->program(prog).attributes.find(name);
+	if(!var) graphics_error("could not get attribute " << name);
+	graphics_assert(!type || (type == var->type));
+	graphics_assert(size == var->size);
+	return var->loc;
 }
 
 void main_t::add_callback(callback_t* callback) {
@@ -365,6 +1121,66 @@ void main_t::read_file(const std::string& name,file_io_t* callback,intptr_t data
 	_pimpl->file_io_impls.push_back(new _file_io_impl_t(*_pimpl,name,callback,data));
 }
 
+void main_t::write_file(const std::string& name,const bytes_t& bytes) {
+#ifndef __native_client__
+	_pimpl->io_pool.post(new _file_write_t(name,bytes));
+#endif
+}
+
+int64_t main_t::file_mtime(const std::string& name) {
+#ifdef __native_client__
+	return -1;
+#else
+	struct stat st;
+	if(stat(name.c_str(),&st))
+		return -1;
+	return st.st_mtime;
+#endif
+}
+
+void main_t::set_io_threads(size_t threads) {
+#ifndef __native_client__
+	_pimpl->io_pool.resize(threads);
+#endif
+}
+
+void main_t::set_worker_threads(size_t threads) {
+	_pimpl->cpu_pool.resize(threads);
+}
+
+void main_t::set_texture_compression(bool compress) {
+	_pimpl->compress_textures = compress;
+}
+
+void main_t::set_texture_gamma_correction(bool gamma_correct) {
+	_pimpl->gamma_correct_textures = gamma_correct;
+}
+
+void main_t::set_texture_atlas(int page_size,int max_size) {
+	if(page_size && ((page_size & (page_size-1)) || (max_size+2*_pimpl_t::ATLAS_BORDER > page_size)))
+		data_error("atlas pages must be a power of two, with room for a texture of " << max_size << ": " << page_size);
+	_pimpl->atlas_page_size = page_size;
+	_pimpl->atlas_max_size = page_size? max_size: 0;
+}
+
+void main_t::set_texture_cache(const std::string& dir,uint64_t max_bytes) {
+#ifndef __native_client__
+	if(dir.size())
+		texture_cache_t::create_dir(dir);
+	_pimpl->texture_cache_dir = dir;
+	_pimpl->texture_cache_max_bytes = max_bytes;
+	_pimpl->texture_cache_bytes = 0;
+	if(dir.size()) { // what's already there is counted by a first scan
+		_pimpl->texture_cache_trimming = true;
+		_pimpl->io_pool.post(new _texture_cache_trim_t(*_pimpl));
+	}
+#endif
+}
+
+void main_t::set_io_budget(uint64_t nanosecs) {
+	_pimpl->io_budget = nanosecs;
+}
+
 void main_t::cancel_read_file(file_io_t* callback,intptr_t data) {
 	for(_pimpl_t::file_io_impls_t::iterator i=_pimpl->file_io_impls.begin(); i!=_pimpl->file_io_impls.end(); i++) {
 		if(((*i)->callback == callback) && ((*i)->data == data)) {
@@ -374,22 +1190,11 @@ void main_t::cancel_read_file(file_io_t* callback,intptr_t data) {
 	}
 }
 
-std::string main_t::relpath(const std::string& base,const std::string& path) {
-	if(!path.size()) data_error("empty path");
-	if(path.at(0) == '/')
-		return path;
-	if(!base.size() || (base.at(base.size()-1) == '/'))
-		return base+path;
-	const size_t ofs = base.rfind('/');
-	if(ofs == std::string::npos)
-		return path;
-	return base.substr(0,ofs+1) + path;
-}
-
-void main_t::load_texture(const std::string& name,texture_load_t* callback,intptr_t data) {
-	if(_pimpl->textures.find(name) == _pimpl->textures.end())
-		_pimpl->textures[name] = new _texture_t(*this,name);
-	_pimpl->textures.find(name)->second->add(callback,data);
+void main_t::load_texture(const std::string& name,texture_load_t* callback,intptr_t data,bool packable) {
+	const std::pair<std::string,bool> key(name,packable);
+	if(_pimpl->textures.find(key) == _pimpl->textures.end())
+		_pimpl->textures[key] = new _texture_t(*_pimpl,name,packable);
+	_pimpl->textures.find(key)->second->add(callback,data);
 }
 
 void main_t::cancel_load_texture(texture_load_t* callback,intptr_t data) {
@@ -411,13 +1216,18 @@ GLuint main_t::get_shared_program(const std::string& name) {
 }
 
 GLuint main_t::set_shared_program(const std::string& name,GLuint handle) {
+	if(is_linked(handle))
+		_pimpl->program(handle);
 	_pimpl->shared_programs[name] = handle;
 	return handle;
 }
 
 #ifdef __native_client__
 
-main_t::_pimpl_t::_pimpl_t(main_t& m,void* instance_ptr): main(m), instance(static_cast<pp::Instance*>(instance_ptr)) {}
+main_t::_pimpl_t::_pimpl_t(main_t& m,void* instance_ptr): main(m),
+	io_pool(completed,0), io_budget(DEFAULT_IO_BUDGET), cpu_pool(completed,0), compress_textures(false), gamma_correct_textures(false),
+	texture_cache_max_bytes(0), texture_cache_bytes(0), texture_cache_trimming(false), atlas_page_size(0), atlas_max_size(0), timings(PHASE_FRAME,FRAME_HISTORY), clock_step(0),
+	instance(static_cast<pp::Instance*>(instance_ptr)) {}
 
 struct _platform_main_t: public pp::Instance {
 public:
@@ -434,6 +1244,7 @@ private:
 	pp::Graphics3D context;
 private:
 	void Loop();
+	bool DispatchInputEvent(const pp::InputEvent& event);
 	static void Flushed(void* data,int32_t result);
 };
 
@@ -521,6 +1332,14 @@ static main_t::mouse_button_t map_nacl_mouse_button(uint32_t button) {
 }
 
 bool _platform_main_t::HandleInputEvent(const pp::InputEvent& nacl_event) {
+	// events arrive between frames rather than in a phase of the loop
+	const uint64_t start = high_precision_time();
+	const bool handled = DispatchInputEvent(nacl_event);
+	main->_pimpl->timings.add(main_t::PHASE_EVENTS,high_precision_time()-start);
+	return handled;
+}
+
+bool _platform_main_t::DispatchInputEvent(const pp::InputEvent& nacl_event) {
 	switch(nacl_event.GetType()) {
 	case PP_INPUTEVENT_TYPE_KEYDOWN: {
 		const uint32_t code = map_nacl_key(pp::KeyboardInputEvent(nacl_event).GetKeyCode());
@@ -560,8 +1379,10 @@ bool _platform_main_t::HandleInputEvent(const pp::InputEvent& nacl_event) {
 }
 
 void _platform_main_t::Loop() {
+	main->_pimpl->timings.lap(main_t::PHASE_FRAME); // waiting for Flushed is idle, not swapping
 	context.SwapBuffers(pp::CompletionCallback(Flushed,this));
 	glClear(GL_COLOR_BUFFER_BIT|GL_DEPTH_BUFFER_BIT);
+	main->_pimpl->timings.lap(main_t::PHASE_SWAP);
 	try {
 		main->_pimpl->tick();
 	} catch(std::exception& e) {
@@ -603,7 +1424,20 @@ namespace pp {
 
 #else
 
-main_t::_pimpl_t::_pimpl_t(main_t& m,void*): main(m) {}
+static long cpu_count() {
+#ifdef __WIN32
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return info.dwNumberOfProcessors;
+#else
+	return sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+}
+
+main_t::_pimpl_t::_pimpl_t(main_t& m,void*): main(m),
+	io_pool(completed,DEFAULT_IO_THREADS), io_budget(DEFAULT_IO_BUDGET),
+	cpu_pool(completed,std::max<long>(1,cpu_count()-1)), compress_textures(false), gamma_correct_textures(false),
+	texture_cache_max_bytes(0), texture_cache_bytes(0), texture_cache_trimming(false), atlas_page_size(0), atlas_max_size(0), timings(PHASE_FRAME,FRAME_HISTORY), clock_step(0) {}
 
 struct _platform_main_t {
 	_platform_main_t(main_t& m): main(m) {}
@@ -611,6 +1445,8 @@ struct _platform_main_t {
 		return main._pimpl->tick();
 	}
 	bool event(const SDL_Event&);
+	void set_fixed_clock(uint64_t step) { main._now = 0; main._pimpl->clock_step = step; }
+	void lap(main_t::frame_phase_t phase) { main._pimpl->timings.lap(phase); }
 	main_t& main;
 };
 
@@ -695,9 +1531,203 @@ bool _platform_main_t::event(const SDL_Event& sdl) {
 	}
 }
 
+/* Options that barebones takes out of the command line before the game sees it:
+	--frame-csv=FILE
+   writes the timings of the last main_t::FRAME_HISTORY frames to FILE on exit.
+	--profile=FILE
+   writes the profile to FILE on exit, if built with `make PROFILE=1`; see profile.hpp.
+	--headless=FRAMES [--fps=N] [--size=WxH]
+   is headless mode, for profiling and regression-testing games on machines without a display:
+   it renders FRAMES frames into an offscreen EGL pbuffer (Mesa's llvmpipe will do, and needs
+   no X server) with _now stepping at a fixed N frames per simulated second, and loads files
+   and textures synchronously so each run sees the same frames in the same order. It then
+   prints how long the frames took on the CPU.
+   Only available when built with `make HEADLESS=1`. */
+
+namespace {
+	struct _options_t {
+		_options_t(): headless(false), frames(0), fps(60), width(800), height(600) {}
+		void parse(int& argc,char** args); // removes the options it recognises
+		int run_headless(int argc,char** args);
+		std::string frame_csv, profile;
+		bool headless;
+		unsigned long frames, fps;
+		int width, height;
+	};
+
+	// writes the frame timings and profile on the way out, however that happens
+	struct _exit_dumps_t {
+		_exit_dumps_t(const main_t& m,const _options_t& o): main(m), options(o) {}
+		~_exit_dumps_t() {
+			try {
+				if(options.frame_csv.size())
+					main.dump_frame_timings(options.frame_csv);
+			#ifdef PROFILE
+				if(options.profile.size())
+					profile_write(options.profile);
+			#endif
+			} catch(std::exception& e) {
+				std::cerr << "Error dumping timings: " << e.what() << std::endl;
+			}
+		}
+		const main_t& main;
+		const _options_t& options;
+	};
+} // anon namespace
+
+void _options_t::parse(int& argc,char** args) {
+	int kept = 1;
+	for(int i=1; i<argc; i++) {
+		const char* arg = args[i];
+		if(!strncmp(arg,"--headless=",11)) {
+			headless = true;
+			frames = strtoul(arg+11,NULL,10);
+		} else if(!strncmp(arg,"--fps=",6))
+			fps = std::max(1ul,strtoul(arg+6,NULL,10));
+		else if(!strncmp(arg,"--size=",7)) {
+			if(2 != sscanf(arg+7,"%dx%d",&width,&height) || (width < 1) || (height < 1))
+				data_error("bad " << arg);
+		} else if(!strcmp(arg,"--gl-debug"))
+			main_t::set_gl_debug(true);
+		else if(!strncmp(arg,"--frame-csv=",12))
+			frame_csv = arg+12;
+		else if(!strncmp(arg,"--profile=",10)) {
+			profile = arg+10;
+		#ifndef PROFILE
+			std::cerr << "ignoring --profile; build with `make PROFILE=1`" << std::endl;
+		#endif
+		} else
+			args[kept++] = args[i];
+	}
+	argc = kept;
+	args[argc] = NULL;
+}
+
+#ifdef HEADLESS_EGL
+
+#include <EGL/egl.h>
+
+static EGLDisplay egl_display = EGL_NO_DISPLAY;
+
+static void egl_terminate() {
+	eglTerminate(egl_display);
+}
+
+static EGLDisplay egl_get_display() {
+	// the default display needs an X server; Mesa can do without
+	const char* extensions = eglQueryString(EGL_NO_DISPLAY,EGL_EXTENSIONS);
+	if(!getenv("DISPLAY") && extensions && strstr(extensions,"EGL_MESA_platform_surfaceless")) {
+		typedef EGLDisplay (*get_platform_display_t)(EGLenum platform,void* native_display,const EGLint* attribs);
+		if(get_platform_display_t get_platform_display = (get_platform_display_t)eglGetProcAddress("eglGetPlatformDisplayEXT"))
+			return get_platform_display(0x31DD,EGL_DEFAULT_DISPLAY,NULL); // EGL_PLATFORM_SURFACELESS_MESA
+	}
+	return eglGetDisplay(EGL_DEFAULT_DISPLAY);
+}
+
+static bool egl_init(int width,int height) {
+	egl_display = egl_get_display();
+	EGLint major, minor;
+	if((egl_display == EGL_NO_DISPLAY) || !eglInitialize(egl_display,&major,&minor)) {
+		fprintf(stderr,"Unable to initialise EGL: 0x%x\n",eglGetError());
+		return false;
+	}
+	atexit(egl_terminate);
+	static const EGLint config_attribs[] = {
+		EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+		EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+		EGL_RED_SIZE, 8, EGL_GREEN_SIZE, 8, EGL_BLUE_SIZE, 8,
+		EGL_DEPTH_SIZE, 24,
+		EGL_NONE};
+	EGLConfig config;
+	EGLint num_configs = 0;
+	if(!eglChooseConfig(egl_display,config_attribs,&config,1,&num_configs) || !num_configs) {
+		fprintf(stderr,"No EGL config for an offscreen OpenGL surface: 0x%x\n",eglGetError());
+		return false;
+	}
+	const EGLint pbuffer_attribs[] = {EGL_WIDTH, width, EGL_HEIGHT, height, EGL_NONE};
+	const EGLSurface surface = eglCreatePbufferSurface(egl_display,config,pbuffer_attribs);
+	if(!eglBindAPI(EGL_OPENGL_API) || (surface == EGL_NO_SURFACE)) {
+		fprintf(stderr,"Unable to create EGL pbuffer: 0x%x\n",eglGetError());
+		return false;
+	}
+	const EGLContext context = eglCreateContext(egl_display,config,EGL_NO_CONTEXT,NULL);
+	if((context == EGL_NO_CONTEXT) || !eglMakeCurrent(egl_display,surface,surface,context)) {
+		fprintf(stderr,"Unable to create EGL context: 0x%x\n",eglGetError());
+		return false;
+	}
+	fprintf(stderr,"EGL %d.%d %s, GL %s\n",major,minor,eglQueryString(egl_display,EGL_VENDOR),
+		(const char*)glGetString(GL_RENDERER));
+	return true;
+}
+
+int _options_t::run_headless(int argc,char** args) {
+	if(!egl_init(width,height))
+		return EXIT_FAILURE;
+	const GLenum glew_err = glewInit();
+#ifdef GLEW_ERROR_NO_GLX_DISPLAY
+	if((GLEW_OK != glew_err) && (GLEW_ERROR_NO_GLX_DISPLAY != glew_err)) { // GLEW built for GLX still loads GL fine
+#else
+	if(GLEW_OK != glew_err) {
+#endif
+		fprintf(stderr,"Cannot initialise GLEW: %s\n",glewGetErrorString(glew_err));
+		return EXIT_FAILURE;
+	}
+	std::auto_ptr<main_t> main(main_t::create(NULL,argc,args));
+	_exit_dumps_t exit_dumps(*main,*this);
+	main->set_io_threads(0);
+	main->set_worker_threads(0);
+	main->set_io_budget(1ULL<<62); // deliver everything the tick it completes
+	main->init();
+	_platform_main_t platform(*main.get());
+	platform.set_fixed_clock(1000000000/fps);
+	main->on_resize(width,height);
+	std::vector<uint64_t> times;
+	times.reserve(frames);
+	const uint64_t start = high_precision_time();
+	bool running = true;
+	glClear(GL_COLOR_BUFFER_BIT|GL_DEPTH_BUFFER_BIT);
+	while(running && (times.size() < frames)) {
+		const uint64_t frame_start = high_precision_time();
+		running = platform.tick();
+		glFinish(); // with a software renderer, drawing is CPU time too
+		glClear(GL_COLOR_BUFFER_BIT|GL_DEPTH_BUFFER_BIT);
+		platform.lap(main_t::PHASE_SWAP);
+		times.push_back(high_precision_time()-frame_start);
+	}
+	const uint64_t total = high_precision_time()-start;
+	if(times.empty())
+		return EXIT_SUCCESS;
+	std::vector<uint64_t> sorted(times);
+	std::sort(sorted.begin(),sorted.end());
+	std::cout << "headless frames=" << times.size() << " simulated_secs=" << (double)times.size()/fps <<
+		" total_us=" << total/1000 << " mean_us=" << total/times.size()/1000 <<
+		" min_us=" << sorted.front()/1000 << " p50_us=" << sorted[(sorted.size()-1)*50/100]/1000 <<
+		" p95_us=" << sorted[(sorted.size()-1)*95/100]/1000 << " p99_us=" << sorted[(sorted.size()-1)*99/100]/1000 <<
+		" max_us=" << sorted.back()/1000 << std::endl;
+	return EXIT_SUCCESS;
+}
+
+#else
+
+int _options_t::run_headless(int,char**) {
+	fprintf(stderr,"Headless mode needs building with `make HEADLESS=1`\n");
+	return EXIT_FAILURE;
+}
+
+#endif //HEADLESS_EGL
+
 int main(int argc,char** args) {
 	fprintf(stderr,"%s (c) William Edwards, 2012.  All rights reserved.\n",main_t::game_name);
 	fprintf(stderr,"(built %s, %s)\n",build_timestamp,git_info);
+	_options_t options;
+	try {
+		options.parse(argc,args);
+		if(options.headless)
+			return options.run_headless(argc,args);
+	} catch(std::exception& e) {
+		fprintf(stderr,"Error: %s\n",e.what());
+		return EXIT_FAILURE;
+	}
 	if(SDL_Init(SDL_INIT_VIDEO)) {
 		fprintf(stderr,"Unable to initialise SDL: %s\n",SDL_GetError());
 		return EXIT_FAILURE;
@@ -716,6 +1746,7 @@ int main(int argc,char** args) {
 	}
 	SDL_WM_SetCaption(main_t::game_name,main_t::game_name);
 	std::auto_ptr<main_t> main(main_t::create(NULL,argc,args));
+	_exit_dumps_t exit_dumps(*main,options);
 	main->init();
 	_platform_main_t platform(*main.get());
 	main->on_resize(window->w,window->h);
@@ -725,6 +1756,7 @@ int main(int argc,char** args) {
 		SDL_GL_SwapBuffers();
 		SDL_Flip(window);
 		glClear(GL_COLOR_BUFFER_BIT|GL_DEPTH_BUFFER_BIT);
+		platform.lap(main_t::PHASE_SWAP);
 		// handle events
 		SDL_Event event;
 		while(SDL_PollEvent(&event)) {
@@ -749,6 +1781,7 @@ int main(int argc,char** args) {
 				}
 			} catch(_discard_event& de) {}
 		}
+		platform.lap(main_t::PHASE_EVENTS);
 	}
 	return EXIT_SUCCESS;
 }
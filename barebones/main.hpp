@@ -7,8 +7,12 @@
 #include <string>
 #include <sstream>
 #include <cstdio>
+#include <cstring>
 #include <cassert>
+#include <stdexcept>
+#include <inttypes.h>
 #include <cmath> //#defines log2 etc, so must get its header-guard in before GLM #undefs it (_fixes.hpp) on NaCL
+#include "timing.hpp"
 
 #ifdef __native_client__
 	#include <GLES2/gl2.h>
@@ -24,6 +28,62 @@
 
 struct _platform_main_t;
 
+// read-only view of loaded file contents; copies are cheap and share a refcounted
+// buffer (a memory-mapped file where the platform supports it, else a heap string)
+class bytes_t {
+public:
+	struct buffer_t { // keep-alive handle; released when the last view goes
+		buffer_t(): refs(0) {}
+		virtual ~buffer_t() {}
+		int refs;
+	};
+	bytes_t(): ptr(NULL), len(0), buf(NULL) {}
+	bytes_t(const uint8_t* p,size_t l,buffer_t* b): ptr(p), len(l), buf(b) { ref(); }
+	explicit bytes_t(const std::string& s); // copies s
+	bytes_t(const bytes_t& copy): ptr(copy.ptr), len(copy.len), buf(copy.buf) { ref(); }
+	~bytes_t() { unref(); }
+	bytes_t& operator=(const bytes_t& copy) {
+		if(buf != copy.buf) {
+			unref();
+			buf = copy.buf;
+			ref();
+		}
+		ptr = copy.ptr;
+		len = copy.len;
+		return *this;
+	}
+	static bytes_t take(std::string& s); // steals the contents of s without copying
+	const uint8_t* data() const { return ptr; }
+	size_t size() const { return len; }
+	bool empty() const { return !len; }
+	uint8_t at(size_t i) const { if(i >= len) throw std::out_of_range("bytes_t::at"); return ptr[i]; }
+	bytes_t sub(size_t ofs,size_t l) const {
+		if((ofs > len) || (l > len-ofs)) throw std::out_of_range("bytes_t::sub");
+		return bytes_t(ptr+ofs,l,buf);
+	}
+	std::string str() const { return std::string(reinterpret_cast<const char*>(ptr),len); }
+private:
+	struct string_buffer_t: public buffer_t {
+		std::string str;
+	};
+	void ref() { if(buf) __sync_add_and_fetch(&buf->refs,1); }
+	void unref() { if(buf && !__sync_sub_and_fetch(&buf->refs,1)) delete buf; }
+	const uint8_t* ptr;
+	size_t len;
+	buffer_t* buf;
+};
+
+inline bytes_t::bytes_t(const std::string& s): ptr(NULL), len(0), buf(NULL) {
+	std::string copy(s);
+	*this = take(copy);
+}
+
+inline bytes_t bytes_t::take(std::string& s) {
+	string_buffer_t* b = new string_buffer_t();
+	b->str.swap(s);
+	return bytes_t(reinterpret_cast<const uint8_t*>(b->str.data()),b->str.size(),b);
+}
+
 class main_t {
 	friend struct _platform_main_t;
 public:
@@ -42,18 +102,47 @@ public:
 	GLuint create_program(const char* vertex,const char* fragment);
 	GLint get_uniform_loc(GLuint prog,const std::string& name,GLenum type=0,int size=1); 
 	GLint get_attribute_loc(GLuint prog,const std::string& name,GLenum type=0,int size=1);
+	// glCheck() makes the driver sync, so it only checks in GL debug mode (--gl-debug), which also
+	// logs KHR_debug messages as they happen; otherwise errors are picked up once a frame
+	static bool gl_debug() { return _gl_debug; }
+	static void set_gl_debug(bool on);
 	// file io
 	struct file_io_t {
-		virtual void on_io(const std::string& name,bool ok,const std::string& bytes,intptr_t data) = 0;
+		virtual void on_io(const std::string& name,bool ok,const bytes_t& bytes,intptr_t data) = 0;
 	};
 	void read_file(const std::string& name,file_io_t* callback,intptr_t data);
 	void cancel_read_file(file_io_t* callback,intptr_t data);
+	void set_io_threads(size_t threads); // 0 reads on the main thread; ignored on NaCl
+	void set_io_budget(uint64_t nanosecs); // per tick, for delivering completed reads
+	void write_file(const std::string& name,const bytes_t& bytes); // in the background; ignored on NaCl
+	static int64_t file_mtime(const std::string& name); // -1 if unknown
 	static std::string relpath(const std::string& base,const std::string& path);
 	// shared textures
+	struct texture_rect_t { // where a texture is in the GL texture it is in, in texture coordinates
+		float u0, v0, u1, v1;
+	};
 	struct texture_load_t {
-		virtual void on_texture_loaded(const std::string& name,GLuint handle,intptr_t data) = 0;
+		virtual void on_texture_loaded(const std::string& name,GLuint handle,const texture_rect_t& rect,intptr_t data) = 0;
 	};
-	void load_texture(const std::string& name,texture_load_t* callback,intptr_t data);
+	// a packable texture may be put in an atlas page shared with others (see set_texture_atlas),
+	// so the caller must keep within its rect and not tile it; otherwise the rect is 0,0 to 1,1
+	void load_texture(const std::string& name,texture_load_t* callback,intptr_t data,bool packable=false);
+	void set_worker_threads(size_t threads); // for decoding; 0 decodes on the main thread
+	// textures loaded after this are compressed, mip levels and all, to DXT1 (or DXT5 if they
+	// have alpha) on the workers, if the driver has S3TC; a quarter to an eighth of the memory
+	void set_texture_compression(bool compress);
+	// textures loaded after this are scaled and mipmapped in linear light rather than as sRGB
+	void set_texture_gamma_correction(bool gamma_correct);
+	// textures loaded after this are kept in dir, ready to upload, and taken from there next time
+	// their source and settings are the same; when it goes over max_bytes the least recently used
+	// are deleted down to three quarters of that. "" turns it off, as it starts. Ignored on NaCl
+	void set_texture_cache(const std::string& dir,uint64_t max_bytes);
+	// packable textures loaded after this that are no more than max_size a side once scaled (and
+	// at least 8) are packed into page_size atlas pages, so that the meshes using them can share
+	// binds; 0 turns it off, as it starts. Each is bordered with its edge texels for 8 texels,
+	// which keeps the first three mip levels from bleeding; desktop GL doesn't use the pages'
+	// smaller levels. Packed textures are not compressed
+	void set_texture_atlas(int page_size,int max_size);
 	void cancel_load_texture(texture_load_t* callback,intptr_t data);
 	// shared shader programs
 	GLuint get_shared_program(const std::string& name);
@@ -66,6 +155,18 @@ public:
 	};
 	void add_callback(callback_t* callback);
 	void remove_callback(callback_t* callback);
+	// every frame is timed, phase by phase, in nanoseconds
+	enum frame_phase_t {
+		PHASE_IO, // delivering completed file reads and texture decodes
+		PHASE_CALLBACKS, // add_callback()s firing
+		PHASE_TICK, // tick()
+		PHASE_SWAP, // swapping and clearing buffers, including waiting for vsync
+		PHASE_EVENTS, // input event handlers
+		PHASE_FRAME // all of it, from the start of one frame to the next
+	};
+	enum { FRAME_HISTORY = 4096 }; // frames kept for windowed stats and dumping
+	frame_timer_t::stats_t frame_timing(frame_phase_t phase,size_t window = 0) const; // over the last window frames; 0 for all
+	void dump_frame_timings(const std::string& csv_filename) const; // the last FRAME_HISTORY frames; throws data_error_t
 	// input handling
 	enum key_t {
 		// pretty mnemonics
@@ -115,6 +216,7 @@ protected:
 private:
 	_pimpl_t* _pimpl;
 	uint64_t _now;
+	static bool _gl_debug;
 };
 
 class gl_exception_t: public std::exception {
@@ -134,7 +236,7 @@ protected:
 #define graphics_assert(test) if(!(test)) graphics_error(#test);
 
 #define glCheck(...) { \
-	if(GL_NO_ERROR != glGetError()) \
+	if(main_t::gl_debug() && (GL_NO_ERROR != glGetError())) \
 		graphics_error(#__VA_ARGS__); \
 }
 
@@ -153,6 +255,19 @@ protected:
 	throw data_error_t(buf.str()); \
 }
 
+// pure string work, so it is here for code that doesn't link the platform layer
+inline std::string main_t::relpath(const std::string& base,const std::string& path) {
+	if(!path.size()) data_error("empty path");
+	if(path.at(0) == '/')
+		return path;
+	if(!base.size() || (base.at(base.size()-1) == '/'))
+		return base+path;
+	const size_t ofs = base.rfind('/');
+	if(ofs == std::string::npos)
+		return path;
+	return base.substr(0,ofs+1) + path;
+}
+
 class panic_t: public std::exception {
 public:
 	panic_t(const std::string& m): msg(m) {}
@@ -0,0 +1,195 @@
+#include "profile.hpp"
+
+#ifdef PROFILE
+
+#include "main.hpp"
+#include "rand.hpp"
+#include "thread.hpp"
+#include <iostream>
+#include <fstream>
+#include <set>
+
+namespace {
+	struct _event_t {
+		const char* name;
+		char type; // 'X' for a zone, 'C' for a counter
+		int thread;
+		uint64_t start, duration; // nanoseconds on the high_precision_time() clock
+		double value;
+		std::string detail;
+	};
+
+	enum {
+		MAX_EVENTS = 1<<21, // then we stop recording rather than eat all the memory
+		GPU_THREAD = 0 // pseudo-thread for the GPU track
+	};
+
+	mutex_t mutex;
+	std::vector<_event_t> events;
+	bool overflowed = false;
+	int next_thread = GPU_THREAD, main_thread = -1;
+	__thread int this_thread = -1;
+
+	int thread_id() {
+		if(this_thread < 0)
+			this_thread = __sync_add_and_fetch(&next_thread,1);
+		return this_thread;
+	}
+
+	void record(const _event_t& event) {
+		scoped_lock_t lock(mutex);
+		if(events.size() < MAX_EVENTS)
+			events.push_back(event);
+		else
+			overflowed = true;
+	}
+
+	// GPU zones bracket their GL calls with timestamp queries, and the results are collected
+	// a few frames later when they are sure to be ready; all on the main thread
+	struct _gpu_zone_t {
+		const char* name;
+		GLuint begin, end;
+		uint64_t frame;
+	};
+	std::vector<_gpu_zone_t> gpu_pending; // oldest first
+	std::vector<GLuint> gpu_queries; // free for reuse
+	uint64_t gpu_frame = 0;
+	int64_t gpu_offset = 0; // add to a GPU timestamp to get high_precision_time()
+	enum { GPU_UNKNOWN, GPU_UNSUPPORTED, GPU_SUPPORTED } gpu_timers = GPU_UNKNOWN;
+
+	bool gpu_supported() {
+	#ifdef __native_client__
+		return false; // GLES2 has no timer queries
+	#else
+		if(GPU_UNKNOWN == gpu_timers) {
+			gpu_timers = GLEW_ARB_timer_query? GPU_SUPPORTED: GPU_UNSUPPORTED;
+			if(GPU_SUPPORTED == gpu_timers) {
+				GLint64 gpu_now = 0;
+				glGetInteger64v(GL_TIMESTAMP,&gpu_now);
+				gpu_offset = (int64_t)high_precision_time()-gpu_now;
+			} else
+				std::cerr << "no GL timer queries; GPU zones will only be timed on the CPU" << std::endl;
+		}
+		return GPU_SUPPORTED == gpu_timers;
+	#endif
+	}
+
+	GLuint gpu_timestamp() {
+		GLuint query;
+		if(gpu_queries.size()) {
+			query = gpu_queries.back();
+			gpu_queries.pop_back();
+		} else
+			glGenQueries(1,&query);
+	#ifndef __native_client__
+		glQueryCounter(query,GL_TIMESTAMP);
+	#endif
+		return query;
+	}
+
+	void json_string(std::ostream& out,const char* str) {
+		out << '"';
+		for(; *str; str++) {
+			if((*str == '"') || (*str == '\\'))
+				out << '\\' << *str;
+			else if((unsigned char)*str < 32) {
+				char hex[8];
+				snprintf(hex,sizeof(hex),"\\u%04x",*str);
+				out << hex;
+			} else
+				out << *str;
+		}
+		out << '"';
+	}
+} // anon namespace
+
+profile_zone_t::profile_zone_t(const char* n): name(n), start(high_precision_time()) {}
+
+profile_zone_t::profile_zone_t(const char* n,const std::string& d): name(n), detail(d), start(high_precision_time()) {}
+
+profile_zone_t::~profile_zone_t() {
+	const _event_t event = {name,'X',thread_id(),start,high_precision_time()-start,0,detail};
+	record(event);
+}
+
+profile_gpu_zone_t::profile_gpu_zone_t(const char* n): cpu(n), name(n), begin(0) {
+	if(gpu_supported())
+		begin = gpu_timestamp();
+}
+
+profile_gpu_zone_t::~profile_gpu_zone_t() {
+	if(begin) {
+		const _gpu_zone_t zone = {name,begin,gpu_timestamp(),gpu_frame};
+		gpu_pending.push_back(zone);
+	}
+}
+
+void profile_counter(const char* name,double value) {
+	const _event_t event = {name,'C',thread_id(),high_precision_time(),0,value,std::string()};
+	record(event);
+}
+
+void profile_frame() {
+	main_thread = thread_id();
+	gpu_frame++;
+#ifndef __native_client__
+	size_t done = 0;
+	for(; done<gpu_pending.size(); done++) {
+		const _gpu_zone_t& zone = gpu_pending[done];
+		if(zone.frame+PROFILE_GPU_LATENCY > gpu_frame)
+			break;
+		GLint available = 0;
+		glGetQueryObjectiv(zone.end,GL_QUERY_RESULT_AVAILABLE,&available);
+		if(!available)
+			break;
+		GLuint64 begin = 0, end = 0;
+		glGetQueryObjectui64v(zone.begin,GL_QUERY_RESULT,&begin);
+		glGetQueryObjectui64v(zone.end,GL_QUERY_RESULT,&end);
+		const _event_t event = {zone.name,'X',GPU_THREAD,begin+gpu_offset,end-begin,0,std::string()};
+		record(event);
+		gpu_queries.push_back(zone.begin);
+		gpu_queries.push_back(zone.end);
+	}
+	gpu_pending.erase(gpu_pending.begin(),gpu_pending.begin()+done);
+#endif
+}
+
+void profile_write(const std::string& filename) {
+	std::ofstream out(filename.c_str());
+	if(!out)
+		data_error("cannot write profile to " << filename);
+	scoped_lock_t lock(mutex);
+	out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+	std::set<int> threads;
+	char num[64];
+	for(std::vector<_event_t>::const_iterator e=events.begin(); e!=events.end(); e++) {
+		threads.insert(e->thread);
+		out << "{\"name\":";
+		json_string(out,e->name);
+		snprintf(num,sizeof(num),"%.3f",e->start/1000.);
+		out << ",\"ph\":\"" << e->type << "\",\"pid\":1,\"tid\":" << e->thread << ",\"ts\":" << num;
+		if('X' == e->type) {
+			snprintf(num,sizeof(num),"%.3f",e->duration/1000.);
+			out << ",\"dur\":" << num;
+			if(e->detail.size()) {
+				out << ",\"args\":{\"detail\":";
+				json_string(out,e->detail.c_str());
+				out << '}';
+			}
+		} else
+			out << ",\"args\":{\"value\":" << e->value << '}';
+		out << "},\n";
+	}
+	for(std::set<int>::const_iterator t=threads.begin(); t!=threads.end(); t++)
+		out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << *t << ",\"args\":{\"name\":\"" <<
+			((GPU_THREAD == *t)? "GPU": (main_thread == *t)? "main": "worker") << "\"}},\n";
+	out << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":";
+	json_string(out,main_t::game_name);
+	out << "}}\n]}\n";
+	if(!out.flush())
+		data_error("error writing profile to " << filename);
+	if(overflowed)
+		std::cerr << "profile stopped recording after " << events.size() << " events" << std::endl;
+}
+
+#endif //PROFILE
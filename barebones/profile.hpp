@@ -0,0 +1,66 @@
+#ifndef __PROFILE_HPP__
+#define __PROFILE_HPP__
+
+/* Profiling zones and counters, for looking at frames and loading on a timeline in
+   chrome://tracing or Perfetto. Build with `make PROFILE=1` and run with --profile=FILE
+   to get a Chrome trace-event JSON file on exit; otherwise it all compiles to nothing.
+
+	PROFILE_ZONE("name"); // CPU time from here to the end of the scope
+	PROFILE_ZONE_DETAIL("name",str); // ditto, with a string such as a filename attached
+	PROFILE_GPU_ZONE("name"); // CPU time, and the GPU time of the GL calls made in the scope
+	PROFILE_COUNTER("name",value); // a value plotted over time
+
+   Names must be string literals. CPU zones and counters work on any thread; GPU zones
+   only where the GL context is current, and they are timed with timestamp queries read
+   back PROFILE_GPU_LATENCY frames later, so the pipeline is never stalled. */
+
+#ifdef PROFILE
+
+#include <string>
+#include <inttypes.h>
+
+class profile_zone_t {
+public:
+	profile_zone_t(const char* name);
+	profile_zone_t(const char* name,const std::string& detail);
+	~profile_zone_t();
+private:
+	const char* const name;
+	const std::string detail;
+	const uint64_t start;
+};
+
+class profile_gpu_zone_t {
+public:
+	profile_gpu_zone_t(const char* name);
+	~profile_gpu_zone_t();
+private:
+	profile_zone_t cpu;
+	const char* const name;
+	unsigned begin; // GL query, or 0 if timer queries aren't supported
+};
+
+enum { PROFILE_GPU_LATENCY = 3 };
+void profile_counter(const char* name,double value);
+void profile_frame(); // main_t calls this at the start of every frame
+void profile_write(const std::string& filename); // throws data_error_t
+
+#define _PROFILE_CAT2(a,b) a##b
+#define _PROFILE_CAT(a,b) _PROFILE_CAT2(a,b)
+#define PROFILE_ZONE(name) profile_zone_t _PROFILE_CAT(_profile_zone_,__LINE__)(name)
+#define PROFILE_ZONE_DETAIL(name,detail) profile_zone_t _PROFILE_CAT(_profile_zone_,__LINE__)(name,detail)
+#define PROFILE_GPU_ZONE(name) profile_gpu_zone_t _PROFILE_CAT(_profile_zone_,__LINE__)(name)
+#define PROFILE_COUNTER(name,value) profile_counter(name,value)
+#define PROFILE_FRAME() profile_frame()
+
+#else
+
+#define PROFILE_ZONE(name)
+#define PROFILE_ZONE_DETAIL(name,detail)
+#define PROFILE_GPU_ZONE(name)
+#define PROFILE_COUNTER(name,value)
+#define PROFILE_FRAME()
+
+#endif //PROFILE
+
+#endif//__PROFILE_HPP__
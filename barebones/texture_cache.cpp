@@ -0,0 +1,194 @@
+#include "texture_cache.hpp"
+#include <algorithm>
+#include <cstring>
+#include <cstdio>
+
+#include "../external/SOIL/image_DXT.h"
+
+#ifndef __native_client__
+	#include <sys/types.h>
+	#include <sys/stat.h>
+	#include <dirent.h>
+	#include <utime.h>
+	#ifdef __WIN32
+		#include <io.h>
+	#endif
+#endif
+
+namespace {
+	const uint32_t DDS_MAGIC = 0x20534444, // "DDS "
+		FOURCC_DXT1 = 0x31545844, FOURCC_DXT5 = 0x35545844,
+		DDPF_LUMINANCE = 0x00020000;
+
+	void pixel_format(texture_cache_t::format_t format,DDS_header& header) {
+		memset(&header.sPixelFormat,0,sizeof(header.sPixelFormat));
+		header.sPixelFormat.dwSize = sizeof(header.sPixelFormat);
+		switch(format) {
+		case texture_cache_t::DXT1:
+		case texture_cache_t::DXT5:
+			header.sPixelFormat.dwFlags = DDPF_FOURCC;
+			header.sPixelFormat.dwFourCC = (texture_cache_t::DXT1 == format)? FOURCC_DXT1: FOURCC_DXT5;
+			break;
+		default: {
+			const int channels = format, alpha = !(channels & 1);
+			header.sPixelFormat.dwFlags = ((channels < 3)? DDPF_LUMINANCE: DDPF_RGB) | (alpha? DDPF_ALPHAPIXELS: 0);
+			header.sPixelFormat.dwRGBBitCount = 8*channels;
+			header.sPixelFormat.dwRBitMask = 0xff;
+			if(channels >= 3) {
+				header.sPixelFormat.dwGBitMask = 0xff00;
+				header.sPixelFormat.dwBBitMask = 0xff0000;
+			}
+			if(alpha)
+				header.sPixelFormat.dwAlphaBitMask = 0xff << (8*(channels-1));
+		}
+		}
+	}
+
+	// a word at a time, as FNV-1a is a byte at a time, with the high bits folded back down each step
+	uint64_t hash(const uint8_t* data,size_t len,uint64_t h) {
+		const uint64_t prime = 0x100000001b3ULL;
+		for(; len >= 8; data += 8, len -= 8) {
+			uint64_t word;
+			memcpy(&word,data,8);
+			h = (h ^ word) * prime;
+			h ^= h >> 29;
+		}
+		for(; len; data++, len--)
+			h = (h ^ *data) * prime;
+		h ^= h >> 33;
+		h *= 0xff51afd7ed558ccdULL;
+		h ^= h >> 33;
+		return h;
+	}
+
+#ifndef __native_client__
+	struct cached_file_t {
+		std::string path;
+		int64_t mtime;
+		uint64_t size;
+		bool operator<(const cached_file_t& rhs) const { return mtime < rhs.mtime; }
+	};
+#endif
+} // anon namespace
+
+std::string texture_cache_t::path(const std::string& dir,const bytes_t& source,int max_size,int pack_size,bool compress,bool gamma) {
+	const uint32_t settings[] = {VERSION,(uint32_t)source.size(),(uint32_t)max_size,(uint32_t)pack_size,compress,gamma};
+	const uint64_t h = hash(source.data(),source.size(),
+		hash(reinterpret_cast<const uint8_t*>(settings),sizeof(settings),0xcbf29ce484222325ULL));
+	char name[17];
+	snprintf(name,sizeof(name),"%08x%08x",(unsigned)(h >> 32),(unsigned)h);
+	return dir + "/" + name + ".dds";
+}
+
+size_t texture_cache_t::level_size(format_t format,int width,int height) {
+	if((DXT1 == format) || (DXT5 == format))
+		return DXT_image_size(width,height,DXT5 == format);
+	return (size_t)width*height*format;
+}
+
+bytes_t texture_cache_t::save(format_t format,const levels_t& levels) {
+	DDS_header header;
+	memset(&header,0,sizeof(header));
+	header.dwMagic = DDS_MAGIC;
+	header.dwSize = sizeof(header)-sizeof(header.dwMagic);
+	header.dwWidth = levels[0].width;
+	header.dwHeight = levels[0].height;
+	header.dwMipMapCount = levels.size();
+	pixel_format(format,header);
+	const bool compressed = (DXT1 == format) || (DXT5 == format);
+	header.dwFlags = DDSD_CAPS | DDSD_HEIGHT | DDSD_WIDTH | DDSD_PIXELFORMAT | DDSD_MIPMAPCOUNT |
+		(compressed? DDSD_LINEARSIZE: DDSD_PITCH);
+	header.dwPitchOrLinearSize = compressed? levels[0].size: levels[0].width*(int)format;
+	header.sCaps.dwCaps1 = DDSCAPS_COMPLEX | DDSCAPS_TEXTURE | DDSCAPS_MIPMAP;
+	std::string buf(reinterpret_cast<const char*>(&header),sizeof(header));
+	for(levels_t::const_iterator l=levels.begin(); l!=levels.end(); l++)
+		buf.append(reinterpret_cast<const char*>(l->data),l->size);
+	return bytes_t::take(buf);
+}
+
+bool texture_cache_t::load(const bytes_t& bytes,format_t& format,levels_t& levels) {
+	levels.clear();
+	DDS_header header;
+	if(bytes.size() < sizeof(header))
+		return false;
+	memcpy(&header,bytes.data(),sizeof(header));
+	if((DDS_MAGIC != header.dwMagic) || (sizeof(header)-sizeof(header.dwMagic) != header.dwSize) ||
+		!header.dwWidth || !header.dwHeight || (header.dwWidth > 1<<16) || (header.dwHeight > 1<<16) ||
+		!header.dwMipMapCount || (header.dwMipMapCount > 17))
+		return false;
+	// only the pixel formats that save() writes
+	for(int f=LUMINANCE; f<=DXT5; f++) {
+		DDS_header expected;
+		pixel_format(format_t(f),expected);
+		if(!memcmp(&expected.sPixelFormat,&header.sPixelFormat,sizeof(expected.sPixelFormat))) {
+			format = format_t(f);
+			size_t ofs = sizeof(header);
+			for(unsigned i=0; i<header.dwMipMapCount; i++) {
+				level_t level;
+				level.width = std::max<int>(header.dwWidth>>i,1);
+				level.height = std::max<int>(header.dwHeight>>i,1);
+				level.size = level_size(format,level.width,level.height);
+				if(level.size > bytes.size()-ofs)
+					break;
+				level.data = bytes.data()+ofs;
+				ofs += level.size;
+				levels.push_back(level);
+			}
+			if((levels.size() == header.dwMipMapCount) && (ofs == bytes.size()))
+				return true;
+			break;
+		}
+	}
+	levels.clear();
+	return false;
+}
+
+void texture_cache_t::create_dir(const std::string& dir) {
+#ifndef __native_client__
+	#ifdef __WIN32
+	mkdir(dir.c_str());
+	#else
+	mkdir(dir.c_str(),0755);
+	#endif
+#endif
+}
+
+void texture_cache_t::touch(const std::string& path) {
+#ifndef __native_client__
+	utime(path.c_str(),NULL);
+#endif
+}
+
+uint64_t texture_cache_t::trim(const std::string& dir,uint64_t max_bytes,uint64_t keep_bytes) {
+#ifndef __native_client__
+	DIR* d = opendir(dir.c_str());
+	if(!d)
+		return 0;
+	std::vector<cached_file_t> files;
+	uint64_t total = 0;
+	while(const dirent* entry = readdir(d)) {
+		const std::string name(entry->d_name);
+		if((name.size() < 4) || name.compare(name.size()-4,4,".dds"))
+			continue;
+		cached_file_t file;
+		file.path = dir + "/" + name;
+		struct stat st;
+		if(stat(file.path.c_str(),&st) || !S_ISREG(st.st_mode))
+			continue;
+		file.mtime = st.st_mtime;
+		file.size = st.st_size;
+		total += file.size;
+		files.push_back(file);
+	}
+	closedir(d);
+	if(total <= max_bytes)
+		return total;
+	std::sort(files.begin(),files.end());
+	for(std::vector<cached_file_t>::const_iterator f=files.begin(); (f!=files.end()) && (total>keep_bytes); f++)
+		if(!remove(f->path.c_str()))
+			total -= f->size;
+	return total;
+#else
+	return 0;
+#endif
+}
@@ -0,0 +1,34 @@
+#ifndef __TEXTURE_CACHE_HPP__
+#define __TEXTURE_CACHE_HPP__
+
+#include "main.hpp"
+
+// textures kept on disk just as they are uploaded, mip levels and all, so that the next run
+// needn't decode, scale, mipmap or compress them again. Each is a DDS file named by a hash of
+// the source image's bytes and the settings it was made with, so a changed image or setting
+// simply misses. The directory is kept under a size by deleting the least recently used;
+// a hit touches its file, so modification times order them.
+class texture_cache_t {
+public:
+	enum format_t { LUMINANCE = 1, LUMINANCE_ALPHA, RGB, RGBA, DXT1, DXT5 }; // uncompressed ones are their channels
+	struct level_t {
+		int width, height;
+		const uint8_t* data;
+		size_t size;
+	};
+	typedef std::vector<level_t> levels_t;
+	// pack_size is the biggest that would be put in an atlas, or 0 if it wouldn't be
+	static std::string path(const std::string& dir,const bytes_t& source,int max_size,int pack_size,bool compress,bool gamma);
+	static bytes_t save(format_t format,const levels_t& levels);
+	// false if not a DDS as saved; the levels then point into bytes
+	static bool load(const bytes_t& bytes,format_t& format,levels_t& levels);
+	static size_t level_size(format_t format,int width,int height);
+	// none of these do anything on NaCl
+	static void create_dir(const std::string& dir);
+	static void touch(const std::string& path);
+	// if over max_bytes, deletes the least recently used until down to keep_bytes; returns the bytes left
+	static uint64_t trim(const std::string& dir,uint64_t max_bytes,uint64_t keep_bytes);
+	enum { VERSION = 1 }; // hashed into every name
+};
+
+#endif//__TEXTURE_CACHE_HPP__
@@ -0,0 +1,112 @@
+#include "thread.hpp"
+#include "main.hpp"
+
+void completion_queue_t::push(job_t* job) {
+	job_t* old = NULL; // a guess; a failed swap tells us the real head
+	for(;;) {
+		job->next = old;
+		job_t* const seen = __sync_val_compare_and_swap(&head,old,job);
+		if(seen == old)
+			return;
+		old = seen;
+	}
+}
+
+job_t* completion_queue_t::pop() {
+	if(!pending) {
+		// take everything pushed so far in one go, and reverse it into arrival order
+		job_t* list = __sync_lock_test_and_set(&head,(job_t*)NULL);
+		while(list) {
+			job_t* next = list->next;
+			list->next = pending;
+			pending = list;
+			list = next;
+		}
+		if(!pending)
+			return NULL;
+	}
+	job_t* job = pending;
+	pending = job->next;
+	job->next = NULL;
+	return job;
+}
+
+namespace {
+	struct _worker_arg_t {
+		worker_pool_t* pool;
+		size_t idx;
+	};
+} // anon namespace
+
+worker_pool_t::worker_pool_t(completion_queue_t& c,size_t n): completed(c), target(0) {
+	pthread_cond_init(&wake,NULL);
+	resize(n);
+}
+
+worker_pool_t::~worker_pool_t() {
+	resize(0);
+	pthread_cond_destroy(&wake);
+}
+
+void worker_pool_t::post(job_t* job) {
+	if(threads.empty()) {
+		job->run();
+		completed.push(job);
+		return;
+	}
+	scoped_lock_t lock(mutex);
+	queue.push_back(job);
+	pthread_cond_signal(&wake);
+}
+
+void worker_pool_t::resize(size_t n) {
+	mutex.lock();
+	target = n;
+	pthread_cond_broadcast(&wake);
+	mutex.unlock();
+	while(threads.size() > n) {
+		pthread_join(threads.back(),NULL);
+		threads.pop_back();
+	}
+	while(threads.size() < n) {
+		_worker_arg_t* arg = new _worker_arg_t;
+		arg->pool = this;
+		arg->idx = threads.size();
+		pthread_t thread;
+		if(pthread_create(&thread,NULL,worker,arg)) {
+			delete arg;
+			panic("could not start worker thread " << threads.size());
+		}
+		threads.push_back(thread);
+	}
+	if(!n) { // nobody left to run them
+		scoped_lock_t lock(mutex);
+		while(queue.size()) {
+			job_t* job = queue.front();
+			queue.pop_front();
+			job->run();
+			completed.push(job);
+		}
+	}
+}
+
+void* worker_pool_t::worker(void* ptr) {
+	worker_pool_t& pool = *static_cast<_worker_arg_t*>(ptr)->pool;
+	const size_t idx = static_cast<_worker_arg_t*>(ptr)->idx;
+	delete static_cast<_worker_arg_t*>(ptr);
+	pool.mutex.lock();
+	for(;;) {
+		while((idx < pool.target) && pool.queue.empty())
+			pthread_cond_wait(&pool.wake,&pool.mutex.mutex);
+		if(idx >= pool.target)
+			break;
+		job_t* job = pool.queue.front();
+		pool.queue.pop_front();
+		pool.mutex.unlock();
+		job->run();
+		pool.completed.push(job);
+		pool.mutex.lock();
+	}
+	pool.mutex.unlock();
+	return NULL;
+}
@@ -0,0 +1,70 @@
+#ifndef __THREAD_HPP__
+#define __THREAD_HPP__
+
+#include <vector>
+#include <deque>
+#include <pthread.h>
+
+class mutex_t {
+public:
+	mutex_t() { pthread_mutex_init(&mutex,NULL); }
+	~mutex_t() { pthread_mutex_destroy(&mutex); }
+	void lock() { pthread_mutex_lock(&mutex); }
+	void unlock() { pthread_mutex_unlock(&mutex); }
+private:
+	friend class worker_pool_t;
+	pthread_mutex_t mutex;
+	mutex_t(const mutex_t&);
+	void operator=(const mutex_t&);
+};
+
+class scoped_lock_t {
+public:
+	scoped_lock_t(mutex_t& m): mutex(m) { mutex.lock(); }
+	~scoped_lock_t() { mutex.unlock(); }
+private:
+	mutex_t& mutex;
+};
+
+// a unit of background work: run() happens on a worker thread, and then
+// done() happens on the main thread when the completion queue is drained
+struct job_t {
+	job_t(): next(NULL) {}
+	virtual ~job_t() {}
+	virtual void run() = 0;
+	virtual void done() = 0;
+	job_t* next; // intrusive link; a job is only ever in one queue at a time
+};
+
+// many producers, one consumer; push() never blocks nor allocates
+class completion_queue_t {
+public:
+	completion_queue_t(): head(NULL), pending(NULL) {}
+	void push(job_t* job); // any thread
+	job_t* pop(); // consumer only; FIFO per producer, NULL if empty
+private:
+	job_t* volatile head; // lock-free stack of pushed jobs, newest first
+	job_t* pending; // consumer-private, oldest first
+};
+
+// fixed set of threads that run() posted jobs and push them onto a completion queue
+class worker_pool_t {
+public:
+	worker_pool_t(completion_queue_t& completed,size_t threads);
+	~worker_pool_t(); // any jobs still queued are run on the calling thread
+	void post(job_t* job); // with no threads, runs the job immediately on the caller
+	void resize(size_t threads);
+	size_t size() const { return threads.size(); }
+private:
+	static void* worker(void* ptr);
+	completion_queue_t& completed;
+	mutex_t mutex;
+	pthread_cond_t wake;
+	std::deque<job_t*> queue;
+	std::vector<pthread_t> threads;
+	size_t target; // threads with an index >= target exit
+	worker_pool_t(const worker_pool_t&);
+	void operator=(const worker_pool_t&);
+};
+
+#endif//__THREAD_HPP__
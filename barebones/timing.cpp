@@ -0,0 +1,107 @@
+#include "timing.hpp"
+#include "rand.hpp"
+#include <algorithm>
+#include <cstring>
+#include <cmath>
+
+void hdr_histogram_t::reset() {
+	memset(counts,0,sizeof(counts));
+	total = largest = 0;
+}
+
+size_t hdr_histogram_t::bucket(uint64_t value) {
+	if(value < SUB_COUNT)
+		return value;
+	const int shift = (63-__builtin_clzll(value))-(SUB_BITS-1); // top SUB_BITS-1 bits after the leading one
+	return SUB_COUNT+(shift-1)*HALF_COUNT+((value>>shift)-HALF_COUNT);
+}
+
+uint64_t hdr_histogram_t::highest(size_t bucket) {
+	if(bucket < SUB_COUNT)
+		return bucket;
+	const int shift = (bucket-SUB_COUNT)/HALF_COUNT+1;
+	const uint64_t sub = (bucket-SUB_COUNT)%HALF_COUNT+HALF_COUNT;
+	return ((sub+1)<<shift)-1;
+}
+
+void hdr_histogram_t::record(uint64_t value) {
+	counts[bucket(value)]++;
+	total++;
+	largest = std::max(largest,value);
+}
+
+uint64_t hdr_histogram_t::percentile(double p) const {
+	if(!total)
+		return 0;
+	const uint64_t rank = std::max<uint64_t>(1,std::ceil(std::min(p,100.)/100*total));
+	uint64_t seen = 0;
+	for(size_t i=0; i<BUCKETS; i++) {
+		seen += counts[i];
+		if(seen >= rank)
+			return std::min(highest(i),largest);
+	}
+	return largest;
+}
+
+frame_timer_t::frame_timer_t(size_t p,size_t h): phases(p), capacity(std::max<size_t>(1,h)),
+	ring(capacity*(phases+1)), current(phases+1), histograms(phases+1),
+	frames(0), frame_start(0), lap_start(0), started(false) {}
+
+void frame_timer_t::begin_frame() {
+	const uint64_t now = high_precision_time();
+	if(started) {
+		current[phases] = now-frame_start;
+		std::copy(current.begin(),current.end(),ring.begin()+(frames%capacity)*(phases+1));
+		for(size_t i=0; i<=phases; i++)
+			histograms[i].record(current[i]);
+		frames++;
+	}
+	std::fill(current.begin(),current.end(),0);
+	frame_start = lap_start = now;
+	started = true;
+}
+
+void frame_timer_t::lap(size_t phase) {
+	const uint64_t now = high_precision_time();
+	if(started && (phase < phases))
+		current[phase] += now-lap_start;
+	lap_start = now;
+}
+
+void frame_timer_t::add(size_t phase,uint64_t nanosecs) {
+	if(phase < phases)
+		current[phase] += nanosecs;
+}
+
+const uint64_t* frame_timer_t::frame(size_t ago) const {
+	if(ago >= history())
+		return NULL;
+	return &ring[((frames-1-ago)%capacity)*(phases+1)];
+}
+
+frame_timer_t::stats_t frame_timer_t::stats(size_t phase,size_t window) const {
+	stats_t stats = {0,0,0,0,0};
+	if(phase > phases)
+		return stats;
+	if(!window) {
+		const hdr_histogram_t& h = histograms[phase];
+		stats.frames = h.count();
+		stats.p50 = h.percentile(50);
+		stats.p95 = h.percentile(95);
+		stats.p99 = h.percentile(99);
+		stats.max = h.max();
+		return stats;
+	}
+	std::vector<uint64_t> sorted(std::min(window,history()));
+	if(sorted.empty())
+		return stats;
+	for(size_t i=0; i<sorted.size(); i++)
+		sorted[i] = frame(i)[phase];
+	std::sort(sorted.begin(),sorted.end());
+	stats.frames = sorted.size();
+	stats.p50 = sorted[(sorted.size()-1)*50/100];
+	stats.p95 = sorted[(sorted.size()-1)*95/100];
+	stats.p99 = sorted[(sorted.size()-1)*99/100];
+	stats.max = sorted.back();
+	return stats;
+}
@@ -0,0 +1,57 @@
+#ifndef __TIMING_HPP__
+#define __TIMING_HPP__
+
+#include <vector>
+#include <algorithm>
+#include <cstddef>
+#include <inttypes.h>
+
+// log-linear histogram of durations, as HdrHistogram does it: each power of two is split into
+// 64 buckets, so a value is kept to within 1.6% in fixed memory and recording is constant time
+class hdr_histogram_t {
+public:
+	hdr_histogram_t() { reset(); }
+	void reset();
+	void record(uint64_t value);
+	uint64_t count() const { return total; }
+	uint64_t max() const { return largest; }
+	uint64_t percentile(double p) const; // p is 0..100; the bucket's upper bound, or 0 if empty
+private:
+	enum {
+		SUB_BITS = 7, // values below 1<<SUB_BITS get a bucket each
+		SUB_COUNT = 1<<SUB_BITS,
+		HALF_COUNT = SUB_COUNT/2,
+		BUCKETS = SUB_COUNT+(64-SUB_BITS)*HALF_COUNT
+	};
+	static size_t bucket(uint64_t value);
+	static uint64_t highest(size_t bucket);
+	uint32_t counts[BUCKETS];
+	uint64_t total, largest;
+};
+
+// times a fixed set of phases each frame, keeping the last few frames in a ring buffer and
+// every frame in a histogram per phase; the frame as a whole, from one begin_frame() to the
+// next, is the extra phase numbered phases
+class frame_timer_t {
+public:
+	frame_timer_t(size_t phases,size_t history);
+	void begin_frame(); // ends the previous frame, if any
+	void lap(size_t phase); // the time since begin_frame() or the last lap() goes to phase; pass phases to skip idle time
+	void add(size_t phase,uint64_t nanosecs); // for work timed outside the laps, e.g. on another callback
+	struct stats_t {
+		uint64_t frames, p50, p95, p99, max;
+	};
+	stats_t stats(size_t phase,size_t window = 0) const; // over the last window frames, or all if 0
+	size_t history() const { return std::min<uint64_t>(frames,capacity); } // frames in the ring
+	const uint64_t* frame(size_t ago) const; // phases+1 durations; 0 is the most recent frame
+	uint64_t count() const { return frames; }
+private:
+	const size_t phases, capacity;
+	std::vector<uint64_t> ring; // capacity rows of phases+1
+	std::vector<uint64_t> current;
+	std::vector<hdr_histogram_t> histograms;
+	uint64_t frames, frame_start, lap_start;
+	bool started;
+};
+
+#endif//__TIMING_HPP__
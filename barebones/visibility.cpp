@@ -0,0 +1,303 @@
+#include "visibility.hpp"
+#include "profile.hpp"
+#include <algorithm>
+
+namespace {
+	void join(const glm::vec3& a_min,const glm::vec3& a_max,const glm::vec3& b_min,const glm::vec3& b_max,glm::vec3& min,glm::vec3& max) {
+		min = glm::vec3(std::min(a_min.x,b_min.x),std::min(a_min.y,b_min.y),std::min(a_min.z,b_min.z));
+		max = glm::vec3(std::max(a_max.x,b_max.x),std::max(a_max.y,b_max.y),std::max(a_max.z,b_max.z));
+	}
+
+	float perimeter(const glm::vec3& min,const glm::vec3& max) { // half the surface area, as the cost of a box
+		const float x = max.x-min.x, y = max.y-min.y, z = max.z-min.z;
+		return x*y+y*z+z*x;
+	}
+
+	bool contains(const glm::vec3& outer_min,const glm::vec3& outer_max,const glm::vec3& min,const glm::vec3& max) {
+		return (outer_min.x <= min.x) && (outer_min.y <= min.y) && (outer_min.z <= min.z) &&
+			(max.x <= outer_max.x) && (max.y <= outer_max.y) && (max.z <= outer_max.z);
+	}
+
+	const float MARGIN = 0.1f; // leaves are loosened by this much of their size on each side
+} // anon namespace
+
+visibility_t::visibility_t(): root(NONE), free_nodes(NONE), free_instances(NONE), count(0) {
+	const stats_t zero = {0,0,0};
+	last_stats = zero;
+}
+
+visibility_t::handle_t visibility_t::add(g3d_t& model,const glm::mat4& transform,intptr_t data) {
+	if(!model.is_ready())
+		data_error("cannot place " << model.filename << " before it is loaded");
+	handle_t handle;
+	if(NONE != free_instances) {
+		handle = free_instances;
+		free_instances = instances[handle].leaf;
+	} else {
+		handle = instances.size();
+		instances.push_back(instance_t());
+	}
+	instance_t& instance = instances[handle];
+	instance.model = &model;
+	instance.transform = transform;
+	instance.colour = glm::vec4(1,1,1,1);
+	instance.time = 0;
+	instance.data = data;
+	place(instance);
+	const int leaf = alloc_node();
+	nodes[leaf].instance = handle;
+	instance.leaf = leaf;
+	insert_leaf(leaf);
+	count++;
+	return handle;
+}
+
+void visibility_t::move(handle_t handle,const glm::mat4& transform) {
+	instance_t& instance = get(handle);
+	instance.transform = transform;
+	place(instance);
+	if(contains(nodes[instance.leaf].min,nodes[instance.leaf].max,instance.min,instance.max))
+		return;
+	remove_leaf(instance.leaf);
+	insert_leaf(instance.leaf);
+}
+
+void visibility_t::set(handle_t handle,const glm::vec4& colour,float time) {
+	instance_t& instance = get(handle);
+	instance.colour = colour;
+	instance.time = time;
+}
+
+void visibility_t::remove(handle_t handle) {
+	instance_t& instance = get(handle);
+	remove_leaf(instance.leaf);
+	free_node(instance.leaf);
+	instance.model = NULL;
+	instance.leaf = free_instances;
+	free_instances = handle;
+	count--;
+}
+
+g3d_t& visibility_t::model(handle_t handle) const { return *get(handle).model; }
+
+const glm::mat4& visibility_t::transform(handle_t handle) const { return get(handle).transform; }
+
+intptr_t visibility_t::data(handle_t handle) const { return get(handle).data; }
+
+visibility_t::instance_t& visibility_t::get(handle_t handle) {
+	if((handle < 0) || ((size_t)handle >= instances.size()) || !instances[handle].model)
+		data_error("bad visibility handle " << handle);
+	return instances[handle];
+}
+
+const visibility_t::instance_t& visibility_t::get(handle_t handle) const {
+	return const_cast<visibility_t*>(this)->get(handle);
+}
+
+void visibility_t::place(instance_t& instance) {
+	instance.model->bounds(instance.min,instance.max);
+	frustum_t::transform(instance.transform,instance.min,instance.max);
+}
+
+int visibility_t::alloc_node() {
+	int node;
+	if(NONE != free_nodes) {
+		node = free_nodes;
+		free_nodes = nodes[node].parent;
+	} else {
+		node = nodes.size();
+		nodes.push_back(node_t());
+	}
+	node_t& n = nodes[node];
+	n.parent = n.child[0] = n.child[1] = NONE;
+	n.height = 0;
+	n.instance = NONE;
+	return node;
+}
+
+void visibility_t::free_node(int node) {
+	nodes[node].parent = free_nodes;
+	nodes[node].height = -1;
+	free_nodes = node;
+}
+
+void visibility_t::insert_leaf(int leaf) {
+	// loosen the box by a margin, so it needn't move again until the instance has moved some way
+	{
+		const instance_t& instance = instances[nodes[leaf].instance];
+		const glm::vec3 margin = (instance.max-instance.min)*MARGIN;
+		nodes[leaf].min = instance.min-margin;
+		nodes[leaf].max = instance.max+margin;
+	}
+	if(NONE == root) {
+		root = leaf;
+		nodes[leaf].parent = NONE;
+		return;
+	}
+	// find the cheapest sibling by the surface area heuristic, descending while it's cheaper
+	// to push the leaf down than to pair it here
+	const glm::vec3 leaf_min = nodes[leaf].min, leaf_max = nodes[leaf].max;
+	int sibling = root;
+	while(!nodes[sibling].is_leaf()) {
+		const node_t& node = nodes[sibling];
+		glm::vec3 min, max;
+		join(node.min,node.max,leaf_min,leaf_max,min,max);
+		const float area = perimeter(node.min,node.max), joined = perimeter(min,max),
+			cost = 2*joined, // of a new parent for this node and the leaf
+			inherited = 2*(joined-area); // that every node below pays for growing this one
+		float child_cost[2];
+		for(int i=0; i<2; i++) {
+			const node_t& child = nodes[node.child[i]];
+			join(child.min,child.max,leaf_min,leaf_max,min,max);
+			child_cost[i] = perimeter(min,max)+inherited;
+			if(!child.is_leaf())
+				child_cost[i] -= perimeter(child.min,child.max);
+		}
+		if((cost < child_cost[0]) && (cost < child_cost[1]))
+			break;
+		sibling = node.child[(child_cost[0] < child_cost[1])? 0: 1];
+	}
+	// pair them under a new parent where the sibling was
+	const int old_parent = nodes[sibling].parent, parent = alloc_node();
+	node_t& p = nodes[parent];
+	p.parent = old_parent;
+	join(nodes[sibling].min,nodes[sibling].max,leaf_min,leaf_max,p.min,p.max);
+	p.height = nodes[sibling].height+1;
+	p.child[0] = sibling;
+	p.child[1] = leaf;
+	nodes[sibling].parent = nodes[leaf].parent = parent;
+	if(NONE == old_parent)
+		root = parent;
+	else
+		nodes[old_parent].child[(nodes[old_parent].child[0] == sibling)? 0: 1] = parent;
+	refit(old_parent);
+}
+
+void visibility_t::remove_leaf(int leaf) {
+	if(leaf == root) {
+		root = NONE;
+		return;
+	}
+	// the sibling takes the parent's place
+	const int parent = nodes[leaf].parent, grandparent = nodes[parent].parent,
+		sibling = nodes[parent].child[(nodes[parent].child[0] == leaf)? 1: 0];
+	nodes[sibling].parent = grandparent;
+	if(NONE == grandparent)
+		root = sibling;
+	else
+		nodes[grandparent].child[(nodes[grandparent].child[0] == parent)? 0: 1] = sibling;
+	free_node(parent);
+	refit(grandparent);
+}
+
+void visibility_t::refit(int node) {
+	while(NONE != node) {
+		node = balance(node);
+		node_t& n = nodes[node];
+		const node_t &a = nodes[n.child[0]], &b = nodes[n.child[1]];
+		n.height = 1+std::max(a.height,b.height);
+		join(a.min,a.max,b.min,b.max,n.min,n.max);
+		node = n.parent;
+	}
+}
+
+// if one child is more than one taller than the other, rotate its taller child up into this
+// node's place, as an AVL tree does; returns the node now in this one's place
+int visibility_t::balance(int a) {
+	if(nodes[a].is_leaf() || (nodes[a].height < 2))
+		return a;
+	const int diff = nodes[nodes[a].child[1]].height-nodes[nodes[a].child[0]].height;
+	if((diff >= -1) && (diff <= 1))
+		return a;
+	const int up_side = (diff > 1)? 1: 0, // the taller child, which goes up
+		b = nodes[a].child[up_side],
+		f = nodes[b].child[0], g = nodes[b].child[1],
+		keep = (nodes[f].height > nodes[g].height)? f: g, // stays with b
+		give = (keep == f)? g: f; // goes to a
+	const int a_parent = nodes[a].parent;
+	nodes[b].parent = a_parent;
+	if(NONE == a_parent)
+		root = b;
+	else
+		nodes[a_parent].child[(nodes[a_parent].child[0] == a)? 0: 1] = b;
+	nodes[b].child[0] = a;
+	nodes[b].child[1] = keep;
+	nodes[a].parent = b;
+	nodes[a].child[up_side] = give;
+	nodes[give].parent = a;
+	node_t &na = nodes[a], &nb = nodes[b];
+	const node_t &other = nodes[na.child[1-up_side]], &ng = nodes[give], &nk = nodes[keep];
+	join(other.min,other.max,ng.min,ng.max,na.min,na.max);
+	na.height = 1+std::max(other.height,ng.height);
+	join(na.min,na.max,nk.min,nk.max,nb.min,nb.max);
+	nb.height = 1+std::max(na.height,nk.height);
+	return b;
+}
+
+void visibility_t::cull(const glm::mat4& projection,const glm::mat4& view,std::vector<handle_t>& visible) {
+	PROFILE_ZONE("visibility cull");
+	const frustum_t frustum(projection*view);
+	const size_t first = visible.size();
+	last_stats.nodes_tested = 0;
+	// entries are nodes to test, or ~node for nodes known to be wholly inside
+	stack.clear();
+	if(NONE != root)
+		stack.push_back(root);
+	while(stack.size()) {
+		const int entry = stack.back();
+		stack.pop_back();
+		const bool inside = (entry < 0);
+		const node_t& node = nodes[inside? ~entry: entry];
+		frustum_t::cull_t cull = frustum_t::INSIDE;
+		if(!inside) {
+			cull = frustum.test(node.min,node.max);
+			last_stats.nodes_tested++;
+			if(frustum_t::OUTSIDE == cull)
+				continue;
+		}
+		if(node.is_leaf()) {
+			const instance_t& instance = instances[node.instance];
+			if(frustum_t::INTERSECTS == cull) { // the loosened box is, but perhaps not the instance
+				last_stats.nodes_tested++;
+				if(frustum_t::OUTSIDE == frustum.test(instance.min,instance.max))
+					continue;
+			}
+			visible.push_back(node.instance);
+		} else
+			for(int i=0; i<2; i++)
+				stack.push_back((frustum_t::INSIDE == cull)? ~node.child[i]: node.child[i]);
+	}
+	last_stats.visible = visible.size()-first;
+	last_stats.culled = count-last_stats.visible;
+	PROFILE_COUNTER("visible instances",last_stats.visible);
+	PROFILE_COUNTER("culled instances",last_stats.culled);
+}
+
+namespace {
+	struct by_model_t {
+		by_model_t(const visibility_t& v): visibility(v) {}
+		const visibility_t& visibility;
+		bool operator()(visibility_t::handle_t a,visibility_t::handle_t b) const {
+			return &visibility.model(a) < &visibility.model(b);
+		}
+	};
+} // anon namespace
+
+void visibility_t::draw(const glm::mat4& projection,const glm::mat4& view,const glm::vec3& light_0,bool cycles) {
+	to_draw.clear();
+	cull(projection,view,to_draw);
+	std::sort(to_draw.begin(),to_draw.end(),by_model_t(*this));
+	for(size_t first=0, last; first<to_draw.size(); first=last) {
+		g3d_t* model = instances[to_draw[first]].model;
+		batch.clear();
+		for(last=first; (last<to_draw.size()) && (instances[to_draw[last]].model == model); last++) {
+			const instance_t& instance = instances[to_draw[last]];
+			g3d_t::instance_t drawn;
+			drawn.modelview = view*instance.transform;
+			drawn.colour = instance.colour;
+			drawn.time = instance.time;
+			batch.push_back(drawn);
+		}
+		model->draw(&batch[0],batch.size(),projection,light_0,cycles);
+	}
+}
@@ -0,0 +1,71 @@
+#ifndef __VISIBILITY_HPP__
+#define __VISIBILITY_HPP__
+
+#include "g3d.hpp"
+#include "frustum.hpp"
+
+/* The placed models of a scene, kept in a dynamic bounding volume hierarchy so that only
+   those that may be on screen are visited each frame. Each leaf is an instance's world-space
+   box, loosened by a margin so that small moves don't touch the tree; branches are kept
+   balanced by rotations as they are inserted, as in Box2D's dynamic tree. draw() culls the
+   tree against the view frustum and hands each model its visible instances in one instanced
+   draw; the models then cull the meshes of instances that straddle the frustum. */
+
+class visibility_t {
+public:
+	typedef int handle_t;
+	visibility_t();
+	// the model must be loaded; transform takes it to world space
+	handle_t add(g3d_t& model,const glm::mat4& transform,intptr_t data=0);
+	void move(handle_t handle,const glm::mat4& transform);
+	void set(handle_t handle,const glm::vec4& colour,float time); // passed on to the model's draw
+	void remove(handle_t handle);
+	g3d_t& model(handle_t handle) const;
+	const glm::mat4& transform(handle_t handle) const;
+	intptr_t data(handle_t handle) const;
+	size_t size() const { return count; }
+	// the instances that may be visible through projection*view, in no particular order
+	void cull(const glm::mat4& projection,const glm::mat4& view,std::vector<handle_t>& visible);
+	void draw(const glm::mat4& projection,const glm::mat4& view,const glm::vec3& light_0,bool cycles);
+	struct stats_t { // of the last cull
+		size_t visible, culled, nodes_tested;
+	};
+	const stats_t& stats() const { return last_stats; }
+private:
+	enum { NONE = -1 };
+	struct node_t {
+		glm::vec3 min, max; // loosened, for leaves
+		int parent, child[2], height; // height is 0 for a leaf; parent links up the free list
+		int instance; // NONE unless a leaf
+		bool is_leaf() const { return NONE == child[0]; }
+	};
+	struct instance_t {
+		g3d_t* model; // NULL if free
+		glm::mat4 transform;
+		glm::vec4 colour;
+		float time;
+		intptr_t data;
+		glm::vec3 min, max; // tight
+		int leaf; // or the next free instance
+	};
+	instance_t& get(handle_t handle);
+	const instance_t& get(handle_t handle) const;
+	void place(instance_t& instance); // works out its box
+	int alloc_node();
+	void free_node(int node);
+	void insert_leaf(int leaf);
+	void remove_leaf(int leaf);
+	int balance(int node);
+	void refit(int node);
+	std::vector<node_t> nodes;
+	std::vector<instance_t> instances;
+	int root, free_nodes, free_instances;
+	size_t count;
+	stats_t last_stats;
+	// scratch
+	std::vector<int> stack;
+	std::vector<handle_t> to_draw;
+	std::vector<g3d_t::instance_t> batch;
+};
+
+#endif//__VISIBILITY_HPP__
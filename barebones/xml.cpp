@@ -1,47 +1,27 @@
-#include <cstdarg>
 #include <cstdlib>
 #include <cerrno>
 #include <cstring>
 #include <cmath>
 #include <iostream>
+#include <new>
+#include <algorithm>
 
 #include "xml.hpp"
 #include "main.hpp"
 
+// tokens live in one array and link to each other by index relative to themselves (0 meaning none),
+// so the array can grow while parsing and there is just the one free on destruction
 struct xml_parser_t::token_t {
-	token_t(xml_type_t t,const char* s): 
-		type(t), start(s), len(0),
-		visit(false), error(NULL),
-		parent(NULL), first_child(NULL), next_peer(NULL) {}
-	~token_t() { free(error); delete first_child; delete next_peer; }
-	token_t* add_child(xml_type_t t,const char* s) {
-		if(first_child)
-			return first_child->add_peer(t,s);
-		first_child = new token_t(t,s);
-		first_child->parent = this;
-		return first_child;
-	}
-	token_t* add_peer(xml_type_t t,const char* s) {
-		if(!next_peer) {
-			next_peer = new token_t(t,s);
-			next_peer->parent = parent;
-			return next_peer;
-		} else {
-			token_t* peer = next_peer;
-			while(peer->next_peer)
-				peer = peer->next_peer;
-			peer = peer->next_peer = new token_t(t,s);
-			peer->parent = parent;
-			return peer;
-		}
-	}
-	const xml_type_t type; 
-	const char* const start;
-	size_t len;
-	mutable bool visit;
-	mutable char* error;
-	bool set_error(const char* fmt,...) const;
-	token_t *parent, *first_child, *next_peer;
+	const char* start;
+	uint32_t len;
+	uint8_t type; // xml_type_t
+	mutable uint8_t visit: 1, indexed: 1;
+	uint16_t atom; // of the name, for opens and keys
+	int32_t parent_rel, first_child_rel, last_child_rel, next_peer_rel;
+	token_t* link(int32_t rel) const { return rel? const_cast<token_t*>(this)+rel: NULL; }
+	token_t* parent() const { return link(parent_rel); }
+	token_t* first_child() const { return link(first_child_rel); }
+	token_t* next_peer() const { return link(next_peer_rel); }
 	std::string str() const {
 		return std::string(start,len);
 	}
@@ -53,43 +33,296 @@ struct xml_parser_t::token_t {
 	}
 	std::string path() const {
 		std::string ret = str();
-		for(const token_t* p=parent; p; p = p->parent)
+		for(const token_t* p=parent(); p; p = p->parent())
 			ret = p->str() + '/' + ret;
 		return ret;
 	}
 	bool equals(const char* s) const {
-		if(strlen(s) != len) return false;
-		for(size_t i=0; i<len; i++)
-			if(s[i] != start[i])
-				return false;
-		return true;
+		return (strlen(s) == len) && !memcmp(s,start,len);
 	}
 	bool equals(const token_t* t) const {
-		if(t->len != len) return false;
-		for(size_t i=0; i<len; i++)
-			if(start[i] != t->start[i])
-				return false;
-		return true;
+		return (t->len == len) && !memcmp(start,t->start,len);
 	}
 };
 
-bool xml_parser_t::token_t::set_error(const char* fmt,...) const {
-	va_list args;
-	va_start(args,fmt);
-	// had problems finding vsnprintf
-	const size_t len = __builtin_vsnprintf(NULL,0,fmt,args);
-	if(char* e = (char*)malloc(len+1)) {
-		free(error);
-		error = e;
-		va_start(args,fmt);
-		__builtin_vsnprintf(error,len+1,fmt,args);
-		return true;
+uint32_t xml_parser_t::add_token(int type,const char* start,uint32_t parent) {
+	if(num_tokens == max_tokens) {
+		const uint32_t grow = max_tokens? max_tokens*2: buf.size()/32+16;
+		token_t* t = (token_t*)realloc(tokens,grow*sizeof(token_t));
+		if(!t) throw std::bad_alloc();
+		tokens = t;
+		max_tokens = grow;
 	}
-	return false;
+	const uint32_t idx = num_tokens++;
+	token_t& tok = tokens[idx];
+	tok.start = start;
+	tok.len = 0;
+	tok.type = type;
+	tok.visit = tok.indexed = false;
+	tok.atom = NO_ATOM;
+	tok.first_child_rel = tok.last_child_rel = tok.next_peer_rel = 0;
+	uint32_t tail;
+	if(NONE == parent) {
+		tok.parent_rel = 0;
+		tail = root_tail;
+		root_tail = idx;
+	} else {
+		token_t& p = tokens[parent];
+		tok.parent_rel = parent-idx;
+		tail = p.last_child_rel? parent+p.last_child_rel: NONE;
+		if(NONE == tail)
+			p.first_child_rel = idx-parent;
+		p.last_child_rel = idx-parent;
+	}
+	if(NONE != tail)
+		tokens[tail].next_peer_rel = idx-tail;
+	return idx;
+}
+
+uint32_t xml_parser_t::add_peer(uint32_t tok,int type,const char* start) {
+	return add_token(type,start,parent(tok));
+}
+
+uint32_t xml_parser_t::parent(uint32_t tok) const {
+	return tokens[tok].parent_rel? tok+tokens[tok].parent_rel: NONE;
+}
+
+static uint32_t hash_name(const char* str,size_t len) { // FNV-1a
+	uint32_t hash = 2166136261u;
+	for(size_t i=0; i<len; i++)
+		hash = (hash ^ (uint8_t)str[i]) * 16777619u;
+	return hash;
+}
+
+// the slot in atom_table holding the name, or the empty one it would go in
+size_t xml_parser_t::atom_slot(const char* str,size_t len) const {
+	const size_t mask = atom_table.size()-1;
+	for(size_t slot = hash_name(str,len)&mask; ; slot = (slot+1)&mask) {
+		const uint16_t atom = atom_table[slot];
+		if(NO_ATOM == atom)
+			return slot;
+		const token_t& first = tokens[atoms[atom]];
+		if((first.len == len) && !memcmp(first.start,str,len))
+			return slot;
+	}
+}
+
+void xml_parser_t::intern(uint32_t tok) {
+	token_t& t = tokens[tok];
+	if(atom_table.empty())
+		atom_table.resize(64,NO_ATOM);
+	size_t slot = atom_slot(t.start,t.len);
+	if(NO_ATOM == atom_table[slot]) {
+		if(atoms.size() == NO_ATOM) {
+			atoms_full = true; // lookups of names without atoms fall back to comparing strings
+			return;
+		}
+		if(atoms.size()*2 >= atom_table.size()) {
+			std::vector<uint16_t>(atom_table.size()*2,NO_ATOM).swap(atom_table);
+			for(size_t atom=0; atom<atoms.size(); atom++) {
+				const token_t& first = tokens[atoms[atom]];
+				atom_table[atom_slot(first.start,first.len)] = atom;
+			}
+			slot = atom_slot(t.start,t.len);
+		}
+		atom_table[slot] = atoms.size();
+		atoms.push_back(tok);
+	}
+	t.atom = atom_table[slot];
+}
+
+xml_name_t xml_parser_t::name(const char* str) const {
+	if(atom_table.empty())
+		return xml_name_t(str,NO_ATOM);
+	return xml_name_t(str,atom_table[atom_slot(str,strlen(str))]);
+}
+
+namespace {
+	struct _index_key_t {
+		_index_key_t(int t,uint16_t a): type(t), atom(a) {}
+		int type;
+		uint16_t atom;
+	};
+	struct _index_order_t {
+		typedef xml_parser_t::token_t token_t;
+		bool operator()(const token_t* a,const token_t* b) const {
+			if(a->type != b->type) return a->type < b->type;
+			if(a->atom != b->atom) return a->atom < b->atom;
+			return a < b; // document order
+		}
+		bool operator()(const token_t* a,const _index_key_t& b) const {
+			return (a->type < b.type) || ((a->type == b.type) && (a->atom < b.atom));
+		}
+		bool operator()(const _index_key_t& a,const token_t* b) const {
+			return (a.type < b->type) || ((a.type == b->type) && (a.atom < b->atom));
+		}
+	};
+} // anon namespace
+
+// the i'th child of parent with the type and name, or NULL.  Small nodes are scanned; the
+// first query that has to look past INDEX_THRESHOLD children builds an index for the node
+const xml_parser_t::token_t* xml_parser_t::find(const token_t* parent,int type,const xml_name_t& name,size_t i) {
+	if(NO_ATOM == name.atom) {
+		if(!atoms_full)
+			return NULL; // not in the document at all
+		for(const token_t* child = parent->first_child(); child; child = child->next_peer())
+			if((type == child->type) && (NO_ATOM == child->atom) && child->equals(name.name) && !i--)
+				return child;
+		return NULL;
+	}
+	if(!parent->indexed) {
+		size_t seen = 0, n = i;
+		const token_t* child = parent->first_child();
+		for(; child && (seen < INDEX_THRESHOLD); child = child->next_peer(), seen++)
+			if((type == child->type) && (name.atom == child->atom) && !n--)
+				return child;
+		if(!child)
+			return NULL;
+		index_t& index = indexes[parent];
+		for(child = parent->first_child(); child; child = child->next_peer())
+			if(NO_ATOM != child->atom)
+				index.push_back(child);
+		std::sort(index.begin(),index.end(),_index_order_t());
+		parent->indexed = true;
+	}
+	const index_t& index = indexes[parent];
+	const std::pair<index_t::const_iterator,index_t::const_iterator> range =
+		std::equal_range(index.begin(),index.end(),_index_key_t(type,name.atom),_index_order_t());
+	if(i < (size_t)(range.second-range.first))
+		return range.first[i];
+	return NULL;
+}
+
+/* Scanning kernels for the tokenizer's inner loops.  Each returns the first character that
+   stops the scan; the terminating NUL always stops it.  Note char is signed, so bytes >= 0x80
+   count as whitespace (and so end names), just as they always have.
+   The SIMD versions only ever load aligned blocks, which cannot straddle a page, so reading
+   past the NUL is harmless; bytes before ch in the first block are masked off. */
+
+enum {
+	SCAN_WHITESPACE, // first non-whitespace
+	SCAN_NAME, // first whitespace or one of /, > and =
+	SCAN_QUOTE, // first "
+	SCAN_DATA // first < or >
+};
+
+template<int SCAN> static inline bool scan_stop(char c) {
+	switch(SCAN) {
+	case SCAN_WHITESPACE: return !c || (c > ' ');
+	case SCAN_NAME: return (c <= ' ') || ('/' == c) || ('>' == c) || ('=' == c);
+	case SCAN_QUOTE: return !c || ('\"' == c);
+	default: return !c || ('<' == c) || ('>' == c); // SCAN_DATA
+	}
+}
+
+template<int SCAN> static const char* scan_scalar(const char* ch) {
+	while(!scan_stop<SCAN>(*ch)) ch++;
+	return ch;
+}
+
+#if defined(__SSE2__) && (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__) && !defined(__native_client__)
+	#include <immintrin.h>
+	#define XML_SCAN_SIMD
+	#if defined(__SANITIZE_ADDRESS__)
+		#define XML_SCAN_OVERREAD __attribute__((no_sanitize_address))
+	#elif defined(__has_feature)
+		#if __has_feature(address_sanitizer)
+			#define XML_SCAN_OVERREAD __attribute__((no_sanitize_address))
+		#endif
+	#endif
+	#ifndef XML_SCAN_OVERREAD
+		#define XML_SCAN_OVERREAD
+	#endif
+
+template<int SCAN> static inline int scan_mask_sse2(__m128i v) {
+	__m128i stop;
+	switch(SCAN) {
+	case SCAN_WHITESPACE:
+		stop = _mm_or_si128(_mm_cmpgt_epi8(v,_mm_set1_epi8(' ')),_mm_cmpeq_epi8(v,_mm_setzero_si128()));
+		break;
+	case SCAN_NAME:
+		stop = _mm_or_si128(_mm_cmplt_epi8(v,_mm_set1_epi8(' '+1)),
+			_mm_or_si128(_mm_cmpeq_epi8(v,_mm_set1_epi8('/')),
+			_mm_or_si128(_mm_cmpeq_epi8(v,_mm_set1_epi8('>')),_mm_cmpeq_epi8(v,_mm_set1_epi8('=')))));
+		break;
+	case SCAN_QUOTE:
+		stop = _mm_or_si128(_mm_cmpeq_epi8(v,_mm_set1_epi8('\"')),_mm_cmpeq_epi8(v,_mm_setzero_si128()));
+		break;
+	default:
+		stop = _mm_or_si128(_mm_cmpeq_epi8(v,_mm_setzero_si128()),
+			_mm_or_si128(_mm_cmpeq_epi8(v,_mm_set1_epi8('<')),_mm_cmpeq_epi8(v,_mm_set1_epi8('>'))));
+	}
+	return _mm_movemask_epi8(stop);
+}
+
+template<int SCAN> XML_SCAN_OVERREAD static const char* scan_sse2(const char* ch) {
+	const uintptr_t skip = (uintptr_t)ch & 15;
+	const __m128i* block = reinterpret_cast<const __m128i*>(ch-skip);
+	unsigned mask = (unsigned)scan_mask_sse2<SCAN>(_mm_load_si128(block)) >> skip;
+	if(mask)
+		return ch + __builtin_ctz(mask);
+	for(;;)
+		if((mask = scan_mask_sse2<SCAN>(_mm_load_si128(++block))))
+			return reinterpret_cast<const char*>(block) + __builtin_ctz(mask);
+}
+
+template<int SCAN> __attribute__((target("avx2"))) static inline unsigned scan_mask_avx2(__m256i v) {
+	__m256i stop;
+	switch(SCAN) {
+	case SCAN_WHITESPACE:
+		stop = _mm256_or_si256(_mm256_cmpgt_epi8(v,_mm256_set1_epi8(' ')),_mm256_cmpeq_epi8(v,_mm256_setzero_si256()));
+		break;
+	case SCAN_NAME:
+		stop = _mm256_or_si256(_mm256_cmpgt_epi8(_mm256_set1_epi8(' '+1),v),
+			_mm256_or_si256(_mm256_cmpeq_epi8(v,_mm256_set1_epi8('/')),
+			_mm256_or_si256(_mm256_cmpeq_epi8(v,_mm256_set1_epi8('>')),_mm256_cmpeq_epi8(v,_mm256_set1_epi8('=')))));
+		break;
+	case SCAN_QUOTE:
+		stop = _mm256_or_si256(_mm256_cmpeq_epi8(v,_mm256_set1_epi8('\"')),_mm256_cmpeq_epi8(v,_mm256_setzero_si256()));
+		break;
+	default:
+		stop = _mm256_or_si256(_mm256_cmpeq_epi8(v,_mm256_setzero_si256()),
+			_mm256_or_si256(_mm256_cmpeq_epi8(v,_mm256_set1_epi8('<')),_mm256_cmpeq_epi8(v,_mm256_set1_epi8('>'))));
+	}
+	return (unsigned)_mm256_movemask_epi8(stop);
+}
+
+template<int SCAN> XML_SCAN_OVERREAD __attribute__((target("avx2"))) static const char* scan_avx2(const char* ch) {
+	const uintptr_t skip = (uintptr_t)ch & 31;
+	const __m256i* block = reinterpret_cast<const __m256i*>(ch-skip);
+	unsigned mask = scan_mask_avx2<SCAN>(_mm256_load_si256(block)) >> skip;
+	if(mask)
+		return ch + __builtin_ctz(mask);
+	for(;;)
+		if((mask = scan_mask_avx2<SCAN>(_mm256_load_si256(++block))))
+			return reinterpret_cast<const char*>(block) + __builtin_ctz(mask);
+}
+
+static bool detect_avx2() {
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2");
 }
 
-static const char* eat_whitespace(const char* ch) { while(*ch && *ch <= ' ') ch++; return ch; }
-static const char* eat_name(const char* ch) { while((*ch>' ')&&!strchr("/>=",*ch)) ch++; return ch; }
+static const bool has_avx2 = detect_avx2(); // false (so SSE2) until static init gets here
+#endif
+
+template<int SCAN> static inline const char* scan(const char* ch) {
+#ifdef XML_SCAN_SIMD
+	// most runs are short; don't pay for setting up a block unless it's needed
+	if(scan_stop<SCAN>(*ch)) return ch;
+	return has_avx2? scan_avx2<SCAN>(ch+1): scan_sse2<SCAN>(ch+1);
+#else
+	return scan_scalar<SCAN>(ch);
+#endif
+}
+
+static const char* eat_whitespace(const char* ch) { return scan<SCAN_WHITESPACE>(ch); }
+static const char* eat_name(const char* ch) { return scan<SCAN_NAME>(ch); }
+static const char* eat_data(const char* ch) { return scan<SCAN_DATA>(ch); }
+static const char* find_quote(const char* ch) {
+	ch = scan<SCAN_QUOTE>(ch);
+	return *ch? ch: NULL;
+}
 
 static bool starts_with(const char* str,const char* pre) {
 	while(*pre)
@@ -97,36 +330,60 @@ static bool starts_with(const char* str,const char* pre) {
 	return true;
 }
 
-xml_parser_t::xml_parser_t(): title("<empty xml>"), doc(NULL) {}
+xml_parser_t::xml_parser_t(): title("<empty xml>"), tokens(NULL), num_tokens(0), max_tokens(0), root_tail(NONE), atoms_full(false) {}
 
-xml_parser_t::xml_parser_t(const xml_parser_t& copy): title(copy.title), buf(copy.buf), doc(NULL) {
-	parse();
+xml_parser_t::xml_parser_t(const xml_parser_t& copy): title(copy.title), buf(copy.buf),
+	tokens(NULL), num_tokens(0), max_tokens(0), root_tail(NONE), atoms_full(false) {
+	construct();
 }
 
-xml_parser_t::xml_parser_t(const std::string t,const char* xml):
-	title(t), buf(xml), doc(NULL) {
-	parse();
+xml_parser_t::xml_parser_t(const std::string& t,const char* xml):
+	title(t), buf(xml), tokens(NULL), num_tokens(0), max_tokens(0), root_tail(NONE), atoms_full(false) {
+	construct();
+}
+
+void xml_parser_t::reset() {
+	free(tokens); tokens = NULL;
+	num_tokens = max_tokens = 0;
+	root_tail = NONE;
+	error.clear();
+	atoms.clear();
+	atom_table.clear();
+	atoms_full = false;
+	indexes.clear();
 }
 
 xml_parser_t& xml_parser_t::operator=(const xml_parser_t& copy) {
-	delete doc; doc = NULL;
+	reset();
 	const_cast<std::string&>(title) = copy.title;
 	const_cast<std::string&>(buf) = copy.buf;
 	parse();
 	return *this;
 }
 
-xml_parser_t::xml_parser_t(const std::string t,const std::string xml):
-	title(t), buf(xml), doc(NULL) {
-	parse();
+xml_parser_t::xml_parser_t(const std::string& t,const std::string& xml):
+	title(t), buf(xml), tokens(NULL), num_tokens(0), max_tokens(0), root_tail(NONE), atoms_full(false) {
+	construct();
 }
 	
+void xml_parser_t::construct() {
+	try {
+		parse();
+	} catch(...) {
+		reset(); // the destructor won't run
+		throw;
+	}
+}
+
 void xml_parser_t::parse() {
-	if(doc) return;
+	if(num_tokens) return;
 	if(!buf.size())
 		data_error("empty document"); // outside try so no dom objects created
+	if(buf.size() >= NONE)
+		data_error("document too big");
 	const char *ch = buf.c_str();
-	token_t* tok = NULL;
+	uint32_t tok = NONE;
+	#define T(idx) (tokens[idx])
 	try {
 		ch = eat_whitespace(ch);
 		if(*ch!='<')
@@ -140,11 +397,11 @@ void xml_parser_t::parse() {
 			if('<' == *ch) {
 				if(in_tag)
 					data_error("unexpected <");
-				if(tok && (XML_DATA == tok->type)) {
-					if(eat_whitespace(tok->start) == ch)
-						data_error("unexpected empty token "<<tok->repr());
-					tok->len = (ch-tok->start);
-					tok = tok->parent;
+				if((NONE != tok) && (XML_DATA == T(tok).type)) {
+					if(eat_whitespace(T(tok).start) == ch)
+						data_error("unexpected empty token "<<T(tok).repr());
+					T(tok).len = (ch-T(tok).start);
+					tok = parent(tok);
 				}
 				if(starts_with(ch,"<!--")) {
 					if(const char* t = strstr(ch,"-->"))
@@ -157,101 +414,109 @@ void xml_parser_t::parse() {
 				} else {
 					ch = eat_whitespace(ch+1);
 					if('/' == *ch) {
-						if(!tok) data_error("unexpected close of tag");
+						if(NONE == tok) data_error("unexpected close of tag");
 						ch = eat_whitespace(ch+1);
-						token_t* open = tok;
-						if(tok->type != XML_OPEN) {
-							if(tok->type != XML_DATA)
+						uint32_t open = tok;
+						if(T(tok).type != XML_OPEN) {
+							if(T(tok).type != XML_DATA)
 								data_error("expecting closing tag to be after data");
-							open = tok->parent;
+							open = parent(tok);
 						}
-						tok = open->add_peer(XML_CLOSE,ch);
+						tok = add_peer(open,XML_CLOSE,ch);
 						ch = eat_name(ch);
-						tok->len = ch - tok->start;
-						if(!tok->equals(open))
-							data_error(tok->str()<<" mismatches "<<open->str());
+						T(tok).len = ch - T(tok).start;
+						if(!T(tok).equals(&T(open)))
+							data_error(T(tok).str()<<" mismatches "<<T(open).str());
 						ch = eat_whitespace(ch);
 						if('>'!=*ch) data_error("unclosed close tag "<<*ch);
 						const char* peek = eat_whitespace(++ch);
-						if(*peek == '<')
-							ch = peek;
-						else if(!tok->parent) {
+						if(NONE == parent(tok)) {
 							if(*peek)
 								data_error("unexpected content at top level: "<<peek);
 							break; // all done
 						}
-						if(XML_OPEN!=tok->parent->type)
-							data_error("unexpected "<<tok->repr()<<" after "<<tok->parent->repr());
-						tok = tok->parent;
+						if(*peek == '<')
+							ch = peek;
+						if(XML_OPEN!=T(parent(tok)).type)
+							data_error("unexpected "<<T(tok).repr()<<" after "<<T(parent(tok)).repr());
+						tok = parent(tok);
 					} else {
 						in_tag = true;
-						if(!tok)
-							doc = tok = new token_t(XML_OPEN,ch);
-						else if(XML_DATA == tok->type)
-							tok = tok->add_peer(XML_OPEN,ch);
-						else if(XML_OPEN == tok->type)
-							tok = tok->add_child(XML_OPEN,ch);
-						else data_error("was not expecting a new tag after "<<tok->repr());
+						if(NONE == tok)
+							tok = add_token(XML_OPEN,ch,NONE);
+						else if(XML_DATA == T(tok).type)
+							tok = add_peer(tok,XML_OPEN,ch);
+						else if(XML_OPEN == T(tok).type)
+							tok = add_child(tok,XML_OPEN,ch);
+						else data_error("was not expecting a new tag after "<<T(tok).repr());
 						ch = eat_name(ch);
-						tok->len = ch - tok->start;
+						T(tok).len = ch - T(tok).start;
+						intern(tok);
 						ch = eat_whitespace(ch);
 					}
 				}
-			} else if(!tok) {
+			} else if(NONE == tok) {
 				data_error("expecting <");
-			} else if(XML_DATA == tok->type) {
+			} else if(XML_DATA == T(tok).type) {
 				if('>' == *ch)
 					data_error("stray > found outside tag");
-				ch++;
+				ch = eat_data(ch+1);
 			} else if('>' == *ch) {
-				if(XML_OPEN == tok->type) {
+				if(XML_OPEN == T(tok).type) {
 					const char* peek = ch+1;
 					if(!*peek) break;
 					peek = eat_whitespace(peek);
 					if(*peek != '<')
-						tok = tok->add_child(XML_DATA,ch);
+						tok = add_child(tok,XML_DATA,++ch);
 					else
 						ch = peek;
-				} else if(XML_KEY != tok->type)
-					tok = tok->parent;
+				} else if(XML_KEY == T(tok).type) {
+					data_error("was expecting = after "<<T(tok).repr());
+				} else
+					tok = parent(tok);
 				in_tag = false;
 			} else if('=' == *ch) {
-				if(XML_KEY != tok->type)
-					data_error("was not expecting = after "<<tok->repr());
-				if(tok->first_child)
-					data_error("was not expecting = after "<<tok->first_child->repr());
+				if(XML_KEY != T(tok).type)
+					data_error("was not expecting = after "<<T(tok).repr());
+				if(T(tok).first_child())
+					data_error("was not expecting = after "<<T(tok).first_child()->repr());
 				ch = eat_whitespace(ch+1);
 				if('\"' != *ch)
-					data_error("was expecting \" after "<<tok->repr());
+					data_error("was expecting \" after "<<T(tok).repr());
 				ch++;
-				tok = tok->add_child(XML_VALUE,ch);
-				ch = strchr(ch,'\"');
-				if(!ch) data_error("unclosed attribute "<<tok->parent->repr());
-				tok->len = (ch - tok->start);
-				tok = tok->parent->parent;
+				tok = add_child(tok,XML_VALUE,ch);
+				ch = find_quote(ch);
+				if(!ch) data_error("unclosed attribute "<<T(parent(tok)).repr());
+				T(tok).len = (ch - T(tok).start);
+				tok = parent(parent(tok));
 				ch = eat_whitespace(ch+1);
 			} else if('/' == *ch) {
-				if(XML_OPEN != tok->type)
-					data_error("not expecting / after "<<tok->repr());
-				token_t* close = tok->add_peer(XML_CLOSE,tok->start);
-				close->len = tok->len;
-				tok = tok->parent;
+				if(XML_OPEN != T(tok).type)
+					data_error("not expecting / after "<<T(tok).repr());
+				const uint32_t close = add_peer(tok,XML_CLOSE,T(tok).start);
+				T(close).len = T(tok).len;
+				tok = parent(tok);
 				ch = eat_whitespace(ch+1);
 				if('>' != *ch)
-					data_error("not expecting "<<*ch<<" after "<<close->repr());
+					data_error("not expecting "<<*ch<<" after "<<T(close).repr());
 				in_tag = false;
 				const char* peek = eat_whitespace(++ch);
-				if(*peek == '<')
+				if(NONE == tok) {
+					if(*peek)
+						data_error("unexpected content at top level: "<<peek);
+					break; // all done
+				} else if(*peek == '<')
 					ch = peek;
 				else
-					tok = tok->add_child(XML_DATA,ch++);
-			} else if(XML_OPEN == tok->type) {
-				tok = tok->add_child(XML_KEY,ch);
+					tok = add_child(tok,XML_DATA,ch);
+			} else if(XML_OPEN == T(tok).type) {
+				tok = add_child(tok,XML_KEY,ch);
 				ch = eat_name(ch);
-				tok->len = (ch - tok->start);
+				T(tok).len = (ch - T(tok).start);
+				intern(tok);
 				ch = eat_whitespace(ch);
 			} else 
-				data_error("did not understand "<<*ch<<" after"<<tok->repr());
+				data_error("did not understand "<<*ch<<" after"<<T(tok).repr());
 		}
 		/*## BUG/LIMITATION/OMISSION ##*
 		#### when the input stream is consumed, we aren't checking here that the root tag
@@ -260,41 +525,41 @@ void xml_parser_t::parse() {
 	} catch(data_error_t& de) {
 		if(!ch) ch = buf.c_str() + buf.size();
 		std::cerr << "Error parsing " << title << " @" << (ch-buf.c_str()) << ": " << de.what() << std::endl;
-		if(!doc)
-			tok = doc = new token_t(XML_ERROR,ch);
+		if(NONE == tok)
+			tok = add_token(XML_ERROR,ch,NONE);
 		else
-			tok = tok->add_peer(XML_ERROR,ch);
-		tok->len = buf.size()-(ch-buf.c_str());
-		tok->error = strdup(de.what());
+			tok = add_peer(tok,XML_ERROR,ch);
+		T(tok).len = buf.size()-(ch-buf.c_str());
+		error = de.what();
 		throw;
 	}
+	#undef T
 }
 	
 xml_parser_t::~xml_parser_t() {
-	delete doc;
+	free(tokens);
 }
 
 xml_type_t xml_walker_t::type() const {
 	if(!ok()) data_error("no token");
-	if(tok->error) return XML_ERROR;
-	return tok->type;
+	return (xml_type_t)tok->type;
 }
 
 bool xml_walker_t::next() {
 	if(!ok()) data_error("no token");
-	if(tok->first_child) {
-		tok = tok->first_child;
+	if(tok->first_child()) {
+		tok = tok->first_child();
 		return true;
 	}
-	if(tok->next_peer) {
-		tok = tok->next_peer;
+	if(tok->next_peer()) {
+		tok = tok->next_peer();
 		return true;
 	}
 	while(true) {
-		tok = tok->parent;
+		tok = tok->parent();
 		if(!tok) return false;
-		if(tok->next_peer) {
-			tok = tok->next_peer;
+		if(tok->next_peer()) {
+			tok = tok->next_peer();
 			return true;
 		}
 	}
@@ -303,7 +568,7 @@ bool xml_walker_t::next() {
 void xml_walker_t::get_tag() {
 	if(!ok()) data_error("no token");
 	if(XML_KEY == tok->type)
-		tok = tok->parent;
+		tok = tok->parent();
 	if(XML_OPEN != tok->type)
 		data_error("was expecting an open tag, got "<<tok->repr());
 }
@@ -312,36 +577,42 @@ std::string xml_walker_t::tag() const {
 	if(!ok()) data_error("no token");
 	const xml_parser_t::token_t* tag = tok;
 	if(XML_KEY == tag->type)
-		tag = tag->parent;
+		tag = tag->parent();
 	if(XML_OPEN != tag->type)
 		data_error("was expecting an open tag, got "<<tok->repr());
 	return tag->str();
 }
 
-void xml_walker_t::get_key(const char* key) {
+void xml_walker_t::get_key(const xml_name_t& key) {
 	get_tag();
-	for(xml_parser_t::token_t* child = tok->first_child; child; child = child->next_peer)
-		if((XML_KEY == child->type) && child->equals(key)) {
-			tok = child;
-			tok->visit = true;
-			return;
-		}
-	data_error(key << " not found in " << tok->str() << " tag");
+	if(const xml_parser_t::token_t* child = parser.find(tok,XML_KEY,key,0)) {
+		tok = child;
+		tok->visit = true;
+		return;
+	}
+	data_error(key.str() << " not found in " << tok->str() << " tag");
 }
 
 bool xml_walker_t::has_key(const char* key) {
+	return has_key(parser.name(key));
+}
+
+bool xml_walker_t::has_key(const xml_name_t& key) {
 	get_tag();
-	for(xml_parser_t::token_t* child = tok->first_child; child; child = child->next_peer)
-		if((XML_KEY == child->type) && child->equals(key)) {
-			child->visit = true;
-			return true;
-		}
+	if(const xml_parser_t::token_t* child = parser.find(tok,XML_KEY,key,0)) {
+		child->visit = true;
+		return true;
+	}
 	return false;
 }
 
 xml_walker_t& xml_walker_t::get_child(const char* tag) {
+	return get_child(parser.name(tag));
+}
+
+xml_walker_t& xml_walker_t::get_child(const xml_name_t& tag) {
 	if(get_child(tag,0)) return *this;
-	data_error(tok->str()<<" tag has no child tag called "<<tag);
+	data_error(tok->str()<<" tag has no child tag called "<<tag.str());
 }
 
 xml_walker_t& xml_walker_t::get_peer(const char* tag) {
@@ -349,27 +620,31 @@ xml_walker_t& xml_walker_t::get_peer(const char* tag) {
 }
 
 bool xml_walker_t::get_child(const char* tag,size_t i) {
+	return get_child(parser.name(tag),i);
+}
+
+bool xml_walker_t::get_child(const xml_name_t& tag,size_t i) {
 	get_tag();
-	for(xml_parser_t::token_t* child = tok->first_child; child; child = child->next_peer)
-		if((XML_OPEN == child->type) && child->equals(tag) && (!i--)) {
-			tok = child;
-			tok->visit = true;
-			return true;
-		}
+	if(const xml_parser_t::token_t* child = parser.find(tok,XML_OPEN,tag,i)) {
+		tok = child;
+		tok->visit = true;
+		return true;
+	}
 	return false;
 }
 
 bool xml_walker_t::has_child(const char* tag) {
+	return has_child(parser.name(tag));
+}
+
+bool xml_walker_t::has_child(const xml_name_t& tag) {
 	get_tag();
-	for(xml_parser_t::token_t* child = tok->first_child; child; child = child->next_peer)
-		if((XML_OPEN == child->type) && child->equals(tag))
-			return true;
-	return false;
+	return parser.find(tok,XML_OPEN,tag,0);
 }
      
 bool xml_walker_t::first_child() {
 	get_tag();
-	for(xml_parser_t::token_t* child = tok->first_child; child; child = child->next_peer)
+	for(xml_parser_t::token_t* child = tok->first_child(); child; child = child->next_peer())
 		if(XML_OPEN == child->type) {
 			tok = child;
 			tok->visit = true;
@@ -380,9 +655,9 @@ bool xml_walker_t::first_child() {
 
 bool xml_walker_t::next_peer() {
 	get_tag();
-	const xml_parser_t::token_t* peer = tok->next_peer;
+	const xml_parser_t::token_t* peer = tok->next_peer();
 	while(peer && (XML_OPEN != peer->type))
-		peer = peer->next_peer;
+		peer = peer->next_peer();
 	if(peer) {
 		tok = peer;
 		tok->visit = true;
@@ -393,81 +668,113 @@ bool xml_walker_t::next_peer() {
 
 xml_walker_t& xml_walker_t::up() {
 	get_tag();
-	if(!tok->parent)
+	if(!tok->parent())
 		data_error("cannot go up from root");
-	tok = tok->parent;
+	tok = tok->parent();
 	return *this;
 }
 
 xml_walker_t& xml_walker_t::check(const char* tag) {
+	return check(parser.name(tag));
+}
+
+xml_walker_t& xml_walker_t::check(const xml_name_t& tag) {
 	get_tag();
-	if(strncmp(tag,tok->start,strlen(tag)))
-		data_error("expecting "<<tag<<" tag, got "<<tok->str());
+	if(((tag.atom != tok->atom) || (xml_parser_t::NO_ATOM == tag.atom)) && strncmp(tag.str(),tok->start,strlen(tag.str())))
+		data_error("expecting "<<tag.str()<<" tag, got "<<tok->str());
 	tok->visit = true;
 	return *this;
 }
 
 std::string xml_walker_t::value_string(const char* key) {
+	return value_string(parser.name(key));
+}
+
+std::string xml_walker_t::value_string(const xml_name_t& key) {
 	get_key(key);
-	if(!tok->first_child || (XML_VALUE != tok->first_child->type))
+	if(!tok->first_child() || (XML_VALUE != tok->first_child()->type))
 		data_error("expecting key "<<tok->path()<<" to have a value child");
-	tok = tok->first_child;
+	tok = tok->first_child();
 	tok->visit = true;
 	std::string str = tok->str();
-	tok = tok->parent;
+	tok = tok->parent();
 	return str;
 }
 
 float xml_walker_t::value_float(const char* key) {
+	return value_float(parser.name(key));
+}
+
+float xml_walker_t::value_float(const xml_name_t& key) {
 	const std::string value(value_string(key));
 	if(!value.size()) data_error(tok->path()<<" should be a float");
-	tok = tok->first_child; // ensure errors are assigned to child leaf
+	tok = tok->first_child(); // ensure errors are assigned to child leaf
 	errno = 0;
 	char* endptr;
 	const float val = strtof(value.c_str(),&endptr);
 	if(errno) data_error("could not convert "<<tok->path()<<" to float: "<<value<<" ("<<errno<<": "<<strerror(errno));
 	if(endptr != value.c_str()+value.size()) data_error(tok->path()<<" is not a float: "<<value);
 	if(!std::isnormal(val) && FP_ZERO!=std::fpclassify(val)) data_error(tok->path()<<" is not a valid float: "<<value);
-	tok = tok->parent;
+	tok = tok->parent();
 	return val;
 }
 
 int xml_walker_t::value_int(int def,const char* key) {
+	return value_int(def,parser.name(key));
+}
+
+int xml_walker_t::value_int(int def,const xml_name_t& key) {
 	if(has_key(key)) return value_int(key);
 	return def;
 }
 
 int xml_walker_t::value_int(const char* key) {
+	return value_int(parser.name(key));
+}
+
+int xml_walker_t::value_int(const xml_name_t& key) {
 	const std::string value(value_string(key));
 	if(!value.size()) data_error(tok->path()<<" should be an int");
-	tok = tok->first_child; // ensure errors are assigned to child leaf
+	tok = tok->first_child(); // ensure errors are assigned to child leaf
 	errno = 0;
 	char* endptr;
 	const int i = strtol(value.c_str(),&endptr,10);
 	if(errno) data_error("could not convert "<<tok->path()<<" to int: "<<value<<" ("<<errno<<": "<<strerror(errno));
 	if(endptr != value.c_str()+value.size()) data_error(tok->path()<<" is not an int: "<<value);
-	tok = tok->parent;
+	tok = tok->parent();
 	return i;
 }
 
 bool xml_walker_t::value_bool(bool def,const char* key) {
+	return value_bool(def,parser.name(key));
+}
+
+bool xml_walker_t::value_bool(bool def,const xml_name_t& key) {
 	if(has_key(key)) return value_bool(key);
 	return def;
 }
 
 bool xml_walker_t::value_bool(const char* key) {
+	return value_bool(parser.name(key));
+}
+
+bool xml_walker_t::value_bool(const xml_name_t& key) {
 	const std::string value(value_string(key));
 	if(!value.size()) data_error(tok->path()<<" should be boolean");
 	if(value == "true") return true;
 	if(value == "false") return false;
-	tok = tok->first_child; // errors are assigned to child leaf
+	tok = tok->first_child(); // errors are assigned to child leaf
 	data_error(tok->path()<<" is not boolean: "<<value);
 }
 
 uint64_t xml_walker_t::value_hex(const char* key) {
+	return value_hex(parser.name(key));
+}
+
+uint64_t xml_walker_t::value_hex(const xml_name_t& key) {
 	const std::string value(value_string(key));
 	if(!value.size() || value.size() > 16) data_error(tok->path()<<" should be uint64_t");
-	tok = tok->first_child; // ensure errors are assigned to child leaf
+	tok = tok->first_child(); // ensure errors are assigned to child leaf
 	uint64_t ret = 0;
 	for(const char* ch = value.c_str(); *ch; ch++) {
 		ret <<= 4;
@@ -480,18 +787,18 @@ uint64_t xml_walker_t::value_hex(const char* key) {
 		else
 			data_error(tok->path()<<" should be uint64_t");
 	}
-	tok = tok->parent;
+	tok = tok->parent();
 	return ret;
 }
 
 std::string xml_walker_t::get_data_as_string() {
 	get_tag();
-	xml_parser_t::token_t* child = tok->first_child;
+	xml_parser_t::token_t* child = tok->first_child();
 	while(child && (XML_DATA != child->type))
-		child = child->next_peer;
+		child = child->next_peer();
 	if(!child)
 		data_error("expecting tag "<<tok->path()<<" to have data");
-	if(child->next_peer)
+	if(child->next_peer())
 		data_error("cannot cope that tag "<<tok->path()<<" has nested tags when extracting data");
 	child->visit = true;
 	std::string str = child->str();
@@ -515,7 +822,7 @@ std::string xml_walker_t::str() const {
 
 const char* xml_walker_t::error_str() const {
 	if(!ok()) data_error("no token");
-	return tok->error;
+	return (XML_ERROR == tok->type)? parser.error.c_str(): NULL;
 }
 
 bool xml_walker_t::visited() const {
@@ -526,6 +833,202 @@ bool xml_walker_t::visited() const {
 xml_walker_t::xml_walker_t(xml_parser_t& p,const xml_parser_t::token_t* t): parser(p), tok(t) {}
 
 xml_walker_t xml_parser_t::walker() {
-	if(!doc) parse();
-	return xml_walker_t(*this,doc);
+	if(!num_tokens) parse();
+	return xml_walker_t(*this,tokens);
+}
+
+xml_stream_t::xml_stream_t(const std::string& t): title(t), state(START), peek(PEEK_NONE),
+	in_tag(false), finished(false), truncated(false), pos(0), consumed(0) {}
+
+void xml_stream_t::feed(const char* buf,size_t len) {
+	if(error.size()) data_error("already failed: "<<error);
+	if(finished) data_error("more input after finish()");
+	if(truncated) return;
+	if(const char* nul = (const char*)memchr(buf,'\0',len)) { // parse() stops at a NUL too
+		len = nul-buf;
+		truncated = true;
+	}
+	pending.append(buf,len);
+	run();
+}
+
+void xml_stream_t::finish() {
+	if(error.size()) data_error("already failed: "<<error);
+	if(finished) return;
+	finished = true;
+	run();
+	if(START == state)
+		data_error("empty document");
+	/*## BUG/LIMITATION/OMISSION ##*
+	#### as with xml_parser_t, open tags at the end of the input are not reported
+	#####*/
+}
+
+void xml_stream_t::run() {
+	try {
+		while(step());
+	} catch(data_error_t& de) {
+		std::cerr << "Error parsing " << title << " @" << (consumed+pos) << ": " << de.what() << std::endl;
+		error = de.what();
+		throw;
+	}
+	pending.erase(0,pos);
+	consumed += pos;
+	pos = 0;
+}
+
+// these return NULL if they reach the end of what has been fed so far and more might follow
+const char* xml_stream_t::skip_whitespace(const char* ch) const {
+	ch = eat_whitespace(ch);
+	return (*ch || finished)? ch: NULL;
+}
+
+const char* xml_stream_t::skip_name(const char* ch) const {
+	ch = eat_name(ch);
+	return (*ch || finished)? ch: NULL;
+}
+
+// one go round xml_parser_t::parse()'s loop; false if it needs more input first
+bool xml_stream_t::step() {
+	#define NEED(expr) if(!(expr)) return false
+	const char* const base = pending.c_str(), *ch = base+pos, *t;
+	if(!*ch) return false;
+	if(PEEK_NONE != peek) {
+		NEED(t = skip_whitespace(ch));
+		if(('<' == *t) || (PEEK_WHITESPACE == peek))
+			pos = t-base;
+		else if(PEEK_DATA == peek)
+			state = DATA;
+		peek = PEEK_NONE;
+		return true;
+	}
+	if(START == state) {
+		NEED(t = skip_whitespace(ch));
+		if(*t!='<')
+			data_error("malformed XML, expecting <");
+		pos = t-base;
+		state = TOP;
+		return true;
+	}
+	if(DONE == state) {
+		NEED(t = skip_whitespace(ch));
+		if(*t)
+			data_error("unexpected content at top level: "<<t);
+		pos = t-base;
+		return true;
+	}
+	if('<' == *ch) {
+		if(in_tag)
+			data_error("unexpected <");
+		if(DATA == state) {
+			if(!*eat_whitespace(data.c_str()))
+				data_error("unexpected empty token "<<data);
+			state = OPEN;
+			on_data(data);
+			data.clear();
+			return true;
+		}
+		NEED(finished || (pending.size()-pos >= 4));
+		if(starts_with(ch,"<!--")) {
+			if(!(t = strstr(ch,"-->"))) {
+				if(finished) data_error("unclosed comment");
+				return false;
+			}
+			pos = t+3-base;
+			peek = PEEK_WHITESPACE;
+		} else if(starts_with(ch,"<?")) {
+			if(!(t = strstr(ch,"?>"))) {
+				if(finished) data_error("unclosed processing tag");
+				return false;
+			}
+			pos = t+2-base;
+			peek = PEEK_WHITESPACE;
+		} else {
+			NEED(t = skip_whitespace(ch+1));
+			const char* end;
+			if('/' == *t) {
+				if(TOP == state) data_error("unexpected close of tag");
+				NEED(t = skip_whitespace(t+1));
+				if(OPEN != state)
+					data_error("expecting closing tag to be after data");
+				NEED(end = skip_name(t));
+				const std::string tag(t,end-t);
+				if(tag != open.back())
+					data_error(tag<<" mismatches "<<open.back());
+				NEED(t = skip_whitespace(end));
+				if('>'!=*t) data_error("unclosed close tag "<<*t);
+				pos = t+1-base;
+				open.pop_back();
+				if(open.size())
+					peek = PEEK_TAG;
+				else
+					state = DONE;
+				on_close(tag);
+			} else {
+				if(KEY == state)
+					data_error("was not expecting a new tag after "<<key);
+				NEED(end = skip_name(t));
+				in_tag = true;
+				state = OPEN;
+				open.push_back(std::string(t,end-t));
+				pos = end-base;
+				peek = PEEK_WHITESPACE;
+				on_open(open.back());
+			}
+		}
+	} else if(TOP == state) {
+		data_error("expecting <");
+	} else if(DATA == state) {
+		t = eat_data(ch);
+		if('>' == *t)
+			data_error("stray > found outside tag");
+		data.append(ch,t-ch);
+		pos = t-base;
+	} else if('>' == *ch) {
+		if(KEY == state)
+			data_error("was expecting = after "<<key);
+		in_tag = false;
+		pos = ch+1-base;
+		peek = PEEK_DATA;
+	} else if('=' == *ch) {
+		if(KEY != state)
+			data_error("was not expecting = after "<<open.back());
+		NEED(t = skip_whitespace(ch+1));
+		if('\"' != *t)
+			data_error("was expecting \" after "<<key);
+		const char* end = find_quote(++t);
+		if(!end) {
+			if(finished) data_error("unclosed attribute "<<key);
+			return false;
+		}
+		pos = end+1-base;
+		state = OPEN;
+		peek = PEEK_WHITESPACE;
+		on_attribute(key,std::string(t,end-t));
+	} else if('/' == *ch) {
+		if(OPEN != state)
+			data_error("not expecting / after "<<key);
+		NEED(t = skip_whitespace(ch+1));
+		if('>' != *t)
+			data_error("not expecting "<<*t<<" after "<<open.back());
+		const std::string tag = open.back();
+		open.pop_back();
+		in_tag = false;
+		pos = t+1-base;
+		if(open.size())
+			peek = PEEK_DATA;
+		else
+			state = DONE;
+		on_close(tag);
+	} else if(OPEN == state) {
+		const char* end;
+		NEED(end = skip_name(ch));
+		key.assign(ch,end-ch);
+		state = KEY;
+		pos = end-base;
+		peek = PEEK_WHITESPACE;
+	} else
+		data_error("did not understand "<<*ch<<" after"<<key);
+	return true;
+	#undef NEED
 }
@@ -3,25 +3,95 @@
 
 #include <string>
 #include <sstream>
+#include <vector>
+#include <map>
 #include <inttypes.h>
 
 class xml_walker_t;
 
+// a tag or attribute name looked up in a document once, so hot loaders can skip the string
+// work on every query; only meaningful to walkers of the parser that made it, and the string
+// it was made from must outlive it
+class xml_name_t {
+public:
+	const char* str() const { return name; }
+private:
+	friend class xml_parser_t;
+	friend class xml_walker_t;
+	xml_name_t(const char* n,uint16_t a): name(n), atom(a) {}
+	const char* name;
+	uint16_t atom;
+};
+
 class xml_parser_t {
 public:
 	struct token_t;
 	xml_parser_t();
 	xml_parser_t(const xml_parser_t& copy);
-	xml_parser_t(const std::string title,const char* xml);
-	xml_parser_t(const std::string title,const std::string xml);
+	xml_parser_t(const std::string& title,const char* xml);
+	xml_parser_t(const std::string& title,const std::string& xml);
 	~xml_parser_t();
 	xml_parser_t& operator=(const xml_parser_t& copy);
 	xml_walker_t walker();
+	xml_name_t name(const char* str) const;
 	const std::string title;
 	const std::string buf;
 private:
+	friend class xml_walker_t;
+	void construct();
 	void parse();
-	token_t *doc;
+	void reset();
+	enum { NONE = 0xffffffff };
+	uint32_t add_token(int type,const char* start,uint32_t parent);
+	uint32_t add_child(uint32_t tok,int type,const char* start) { return add_token(type,start,tok); }
+	uint32_t add_peer(uint32_t tok,int type,const char* start);
+	uint32_t parent(uint32_t tok) const;
+	token_t* tokens; // one arena for the whole document, tokens[0] being the root
+	uint32_t num_tokens, max_tokens, root_tail;
+	std::string error;
+	// tag and key names are interned to atoms as they are parsed
+	enum { NO_ATOM = 0xffff, INDEX_THRESHOLD = 16 };
+	void intern(uint32_t tok);
+	size_t atom_slot(const char* str,size_t len) const;
+	std::vector<uint32_t> atoms; // the first token with each name
+	std::vector<uint16_t> atom_table; // open addressed by hash
+	bool atoms_full; // some names didn't get an atom
+	// children of nodes with many of them, sorted by type, atom then document order
+	const token_t* find(const token_t* parent,int type,const xml_name_t& name,size_t i);
+	typedef std::vector<const token_t*> index_t;
+	std::map<const token_t*,index_t> indexes;
+};
+
+// push parser: feed() it a document in as many pieces as you like and it calls back as each
+// bit of markup completes, without building a tree or needing the whole document in memory.
+// Same rules as xml_parser_t; attributes follow their open tag and self-closing tags get a close.
+class xml_stream_t {
+public:
+	xml_stream_t(const std::string& title);
+	virtual ~xml_stream_t() {}
+	void feed(const char* data,size_t len); // throws data_error_t
+	void feed(const std::string& data) { feed(data.data(),data.size()); }
+	void finish(); // end of the document; throws data_error_t
+	size_t depth() const { return open.size(); }
+	const std::string title;
+protected:
+	virtual void on_open(const std::string& tag) {}
+	virtual void on_attribute(const std::string& key,const std::string& value) {}
+	virtual void on_data(const std::string& data) {}
+	virtual void on_close(const std::string& tag) {}
+private:
+	void run();
+	bool step();
+	const char* skip_whitespace(const char* ch) const;
+	const char* skip_name(const char* ch) const;
+	enum { START, TOP, OPEN, KEY, DATA, DONE } state;
+	enum { PEEK_NONE, PEEK_WHITESPACE, PEEK_DATA, PEEK_TAG } peek; // what to do at the next non-whitespace
+	bool in_tag, finished, truncated;
+	std::string pending; // input not yet consumed
+	size_t pos;
+	uint64_t consumed; // document offset of pending
+	std::vector<std::string> open;
+	std::string key, data, error;
 };
 
 enum xml_type_t {
@@ -42,22 +112,34 @@ public:
 	bool ok() const { return tok; }
 	// navigation API; preferred way of extracting things
 	xml_walker_t& check(const char* tag);
+	xml_walker_t& check(const xml_name_t& tag);
 	xml_walker_t& get_child(const char* tag);
+	xml_walker_t& get_child(const xml_name_t& tag);
 	xml_walker_t& get_peer(const char* tag);
 	bool has_child(const char* tag);
+	bool has_child(const xml_name_t& tag);
 	bool get_child(const char* tag,size_t i);
+	bool get_child(const xml_name_t& tag,size_t i);
 	bool first_child();
 	bool next_peer();
 	xml_walker_t& up();
 	// extract attributes
 	bool has_key(const char* key = "value");
+	bool has_key(const xml_name_t& key);
 	float value_float(const char* key = "value");
+	float value_float(const xml_name_t& key);
 	std::string value_string(const char* key = "value");
+	std::string value_string(const xml_name_t& key);
 	int value_int(int def,const char* key = "value");
+	int value_int(int def,const xml_name_t& key);
 	int value_int(const char* key = "value");
+	int value_int(const xml_name_t& key);
 	bool value_bool(bool def,const char* key = "value");
+	bool value_bool(bool def,const xml_name_t& key);
 	bool value_bool(const char* key = "value");
+	bool value_bool(const xml_name_t& key);
 	uint64_t value_hex(const char* key = "value");
+	uint64_t value_hex(const xml_name_t& key);
 	std::string get_data_as_string();
 	// query current node
 	xml_type_t type() const;
@@ -72,7 +154,7 @@ private:
 	xml_walker_t(xml_parser_t& parser,const xml_parser_t::token_t* tok);
 	xml_parser_t& parser;
 	const xml_parser_t::token_t* tok;
-	void get_key(const char* key);
+	void get_key(const xml_name_t& key);
 	void get_tag();
 };
 
@@ -0,0 +1,765 @@
+/* headless micro-benchmarks of the CPU-side hot paths; `make bench` builds and runs them.
+   Everything runs on generated inputs, so numbers are comparable between checkouts and
+   between machines, and no GL context, window or data files are needed.
+
+	usage: bench [-scale N] [-secs S] [name-prefix...]
+
+   -scale multiplies the size of every generated input (default 1); -secs is how long
+   each benchmark is timed for (default 0.5). Each result is one line of JSON on stdout:
+
+	{"name":"xml_parse","scale":1,"ops":2048,"bytes_per_op":211305,"ns_per_op":...,"mb_per_s":...,"allocs_per_op":...}
+
+   mb_per_s is null for benchmarks that don't have a meaningful input size, and
+   allocs_per_op is null where allocations can't be counted. */
+
+#include "../barebones/main.hpp"
+#include "../barebones/xml.hpp"
+#include "../barebones/g3d_data.hpp"
+#include "../barebones/rand.hpp"
+#include "../barebones/frustum.hpp"
+#include "../barebones/texture_cache.hpp"
+#include "../barebones/atlas.hpp"
+#include "../external/SOIL/image_helper.h"
+#include "../external/SOIL/stb_image_aug.h"
+#include "../external/SOIL/image_DXT.h"
+#include <iostream>
+#include <cstdlib>
+
+// allocation counting; glibc lets the program supply malloc, which catches both
+// operator new and the C code in SOIL
+static uint64_t allocs = 0;
+
+#if defined(__GLIBC__) && !defined(__SANITIZE_ADDRESS__)
+	#define BENCH_COUNTS_ALLOCS
+	extern "C" {
+		void* __libc_malloc(size_t n);
+		void* __libc_calloc(size_t n,size_t size);
+		void* __libc_realloc(void* p,size_t n);
+		void* malloc(size_t n) __THROW { allocs++; return __libc_malloc(n); }
+		void* calloc(size_t n,size_t size) __THROW { allocs++; return __libc_calloc(n,size); }
+		void* realloc(void* p,size_t n) __THROW { allocs++; return __libc_realloc(p,n); }
+	}
+#endif
+
+static volatile uint64_t sink; // results go here so the optimiser can't drop the work
+
+class bench_t {
+public:
+	bench_t(const char* n): name(n), bytes(0) {}
+	virtual ~bench_t() {}
+	virtual void setup(size_t scale) = 0; // generate inputs; not timed
+	virtual void run(size_t ops) = 0; // do the work ops times
+	const char* const name;
+	uint64_t bytes; // input consumed per op, if meaningful
+};
+
+static void measure(bench_t& bench,size_t scale,double secs) {
+	bench.setup(scale);
+	bench.run(1); // warm caches and lazily-built state
+	const uint64_t budget = secs*1000000000;
+	uint64_t ops = 0, elapsed = 0, allocated = 0;
+	for(size_t batch = 1; elapsed < budget; ) {
+		const uint64_t allocs_before = allocs, start = high_precision_time();
+		bench.run(batch);
+		elapsed += high_precision_time()-start;
+		allocated += allocs-allocs_before;
+		ops += batch;
+		if(batch < (1<<24))
+			batch *= 2;
+	}
+	const double ns_per_op = (double)elapsed/ops;
+	std::stringstream line;
+	line.setf(std::ios::fixed);
+	line.precision(3);
+	line << "{\"name\":\"" << bench.name << "\",\"scale\":" << scale << ",\"ops\":" << ops <<
+		",\"bytes_per_op\":" << bench.bytes << ",\"ns_per_op\":" << ns_per_op << ",\"mb_per_s\":";
+	if(bench.bytes)
+		line << (bench.bytes/ns_per_op*1000000000/(1024*1024));
+	else
+		line << "null";
+	line << ",\"allocs_per_op\":";
+#ifdef BENCH_COUNTS_ALLOCS
+	line << ((double)allocated/ops);
+#else
+	line << "null";
+#endif
+	line << '}';
+	std::cout << line.str() << std::endl;
+}
+
+// ---- XML
+
+static std::string make_xml(size_t units) {
+	static const char* const types[] = {"tank","scout","harvester","tower"};
+	static const char* const weapons[] = {"cannon","laser","rocket"};
+	rand_t r(1);
+	std::stringstream xml;
+	xml << "<scene name=\"bench\" version=\"3\">\n";
+	for(size_t i=0; i<units; i++) {
+		xml << "\t<unit name=\"unit" << i << "\" type=\"" << types[r.rand(4)] << "\" x=\"" << r.randf(-100,100) <<
+			"\" y=\"" << r.randf(-100,100) << "\" hp=\"" << r.rand(1,500) << "\" visible=\"" << (r.rand(2)?"true":"false") <<
+			"\" colour=\"" << std::hex << r.rand(0x1000000) << std::dec << "\">\n";
+		for(uint32_t w=r.rand(1,4); w--; )
+			xml << "\t\t<weapon name=\"" << weapons[r.rand(3)] << "\" damage=\"" << r.rand(1,50) <<
+				"\" range=\"" << r.randf(1,20) << "\"/>\n";
+		xml << "\t\t<description>unit " << i << " &amp; its crew of " << r.rand(1,9) << "</description>\n\t</unit>\n";
+	}
+	xml << "</scene>\n";
+	return xml.str();
+}
+
+class xml_parse_bench_t: public bench_t {
+public:
+	xml_parse_bench_t(): bench_t("xml_parse") {}
+	void setup(size_t scale) { doc = make_xml(1000*scale); bytes = doc.size(); }
+	void run(size_t ops) {
+		while(ops--) {
+			xml_parser_t parser(name,doc);
+			sink += parser.walker().len();
+		}
+	}
+private:
+	std::string doc;
+};
+
+class xml_stream_bench_t: public bench_t {
+public:
+	xml_stream_bench_t(): bench_t("xml_stream") {}
+	void setup(size_t scale) { doc = make_xml(1000*scale); bytes = doc.size(); }
+	void run(size_t ops) {
+		while(ops--) {
+			stream_t stream;
+			for(size_t ofs=0; ofs<doc.size(); ofs+=CHUNK) // as if read from a socket or file
+				stream.feed(doc.data()+ofs,std::min<size_t>(CHUNK,doc.size()-ofs));
+			stream.finish();
+		}
+	}
+private:
+	enum { CHUNK = 4096 };
+	struct stream_t: public xml_stream_t {
+		stream_t(): xml_stream_t("xml_stream") {}
+		void on_open(const std::string& tag) { sink += tag.size(); }
+		void on_attribute(const std::string& key,const std::string& value) { sink += value.size(); }
+		void on_data(const std::string& data) { sink += data.size(); }
+	};
+	std::string doc;
+};
+
+// one op is looking up a unit and reading everything a loader would from it
+class xml_query_bench_t: public bench_t {
+public:
+	xml_query_bench_t(const char* name,bool interned): bench_t(name), interned(interned), parser(NULL) {}
+	~xml_query_bench_t() { delete parser; }
+	void setup(size_t scale) {
+		units = 1000*scale;
+		delete parser;
+		parser = new xml_parser_t(name,make_xml(units));
+	}
+	void run(size_t ops) {
+		if(interned)
+			run_interned(ops);
+		else
+			run_strings(ops);
+	}
+private:
+	void run_strings(size_t ops) {
+		xml_walker_t scene = parser->walker();
+		scene.check("scene");
+		for(size_t i=0; i<ops; i++) {
+			xml_walker_t unit(scene);
+			if(!unit.get_child("unit",i%units))
+				panic("unit " << (i%units) << " missing");
+			sink += unit.value_string("name").size() + unit.value_string("type").size();
+			sink += unit.value_float("x") + unit.value_float("y");
+			sink += unit.value_int("hp") + unit.value_bool("visible") + unit.value_hex("colour");
+			for(size_t w=0; unit.get_child("weapon",w); w++, unit.up())
+				sink += unit.value_int("damage") + unit.value_float("range");
+		}
+	}
+	void run_interned(size_t ops) {
+		const xml_name_t scene_tag = parser->name("scene"), unit_tag = parser->name("unit"),
+			weapon_tag = parser->name("weapon"), name_key = parser->name("name"),
+			type_key = parser->name("type"), x_key = parser->name("x"), y_key = parser->name("y"),
+			hp_key = parser->name("hp"), visible_key = parser->name("visible"),
+			colour_key = parser->name("colour"), damage_key = parser->name("damage"),
+			range_key = parser->name("range");
+		xml_walker_t scene = parser->walker();
+		scene.check(scene_tag);
+		for(size_t i=0; i<ops; i++) {
+			xml_walker_t unit(scene);
+			if(!unit.get_child(unit_tag,i%units))
+				panic("unit " << (i%units) << " missing");
+			sink += unit.value_string(name_key).size() + unit.value_string(type_key).size();
+			sink += unit.value_float(x_key) + unit.value_float(y_key);
+			sink += unit.value_int(hp_key) + unit.value_bool(visible_key) + unit.value_hex(colour_key);
+			for(size_t w=0; unit.get_child(weapon_tag,w); w++, unit.up())
+				sink += unit.value_int(damage_key) + unit.value_float(range_key);
+		}
+	}
+	const bool interned;
+	xml_parser_t* parser;
+	size_t units;
+};
+
+// ---- G3D
+
+// a G3D v4 file of random meshes; written in host order, so only valid on little-endian hosts
+static std::string make_g3d(size_t meshes,uint32_t frames,uint32_t vertices,uint32_t triangles) {
+	struct writer_t {
+		std::string buf;
+		void uint32(uint32_t v) { buf.append(reinterpret_cast<const char*>(&v),sizeof(v)); }
+		void float32(float v) { buf.append(reinterpret_cast<const char*>(&v),sizeof(v)); }
+		void str64(const std::string& s) { std::string f(s); f.resize(64,'\0'); buf += f; }
+	} out;
+	rand_t r(1);
+	out.uint32('G'|('3'<<8)|('D'<<16)|(4u<<24));
+	out.buf.push_back(meshes&0xff);
+	out.buf.push_back(meshes>>8);
+	out.buf.push_back(0); // mtMorphMesh
+	for(size_t m=0; m<meshes; m++) {
+		std::stringstream name;
+		name << "mesh" << m;
+		out.str64(name.str());
+		out.uint32(frames);
+		out.uint32(vertices);
+		out.uint32(triangles*3);
+		for(int i=0; i<9; i++) out.uint32(0); // diffuse colour, specular etc
+		out.uint32(1); // has a diffuse texture
+		out.str64("textures/bench.png");
+		for(int pass=0; pass<2; pass++) // vertices then normals
+			for(uint32_t i=0; i<frames*vertices*3; i++)
+				out.float32(r.randf(-10,10));
+		for(uint32_t i=0; i<vertices*2; i++)
+			out.float32(r.randf());
+		for(uint32_t i=0; i<triangles*3; i++)
+			out.uint32(r.rand(vertices));
+	}
+	return out.buf;
+}
+
+class g3d_load_bench_t: public bench_t {
+public:
+	g3d_load_bench_t(): bench_t("g3d_load") {}
+	void setup(size_t scale) {
+		std::string g3d = make_g3d(4,10,1000*scale,2000*scale);
+		file = bytes_t::take(g3d);
+		bytes = file.size();
+	}
+	void run(size_t ops) {
+		while(ops--) {
+			g3d_data_t data;
+			data.load_g3d("models/bench.g3d",file);
+			sink += data.meshes.size();
+		}
+	}
+private:
+	bytes_t file;
+};
+
+class g3d_cache_bench_t: public bench_t {
+public:
+	g3d_cache_bench_t(const char* name,bool save): bench_t(name), save(save) {}
+	void setup(size_t scale) {
+		std::string g3d = make_g3d(4,10,1000*scale,2000*scale);
+		data.load_g3d("models/bench.g3d",bytes_t::take(g3d));
+		cache = data.save_cache();
+		bytes = cache.size();
+	}
+	void run(size_t ops) {
+		while(ops--)
+			if(save) {
+				sink += data.save_cache().size();
+			} else {
+				g3d_data_t loaded;
+				if(!loaded.load_cache(cache))
+					panic("cache rejected");
+				sink += loaded.meshes.size();
+			}
+	}
+private:
+	const bool save;
+	g3d_data_t data;
+	bytes_t cache;
+};
+
+class g3d_optimise_bench_t: public bench_t {
+public:
+	g3d_optimise_bench_t(): bench_t("g3d_optimise") {}
+	void setup(size_t scale) {
+		std::string g3d = make_g3d(4,10,1000*scale,2000*scale);
+		file = bytes_t::take(g3d);
+		bytes = file.size();
+	}
+	void run(size_t ops) {
+		while(ops--) {
+			g3d_data_t data;
+			data.load_g3d("models/bench.g3d",file);
+			data.optimise();
+			sink += data.vertex_cache_stats().misses;
+		}
+	}
+private:
+	bytes_t file;
+};
+
+class frustum_bench_t: public bench_t {
+public:
+	frustum_bench_t(): bench_t("frustum_test") {}
+	void setup(size_t scale) {
+		// boxes scattered around a camera looking down -z, most of them off to the sides
+		glm::mat4 projection(0);
+		projection[0][0] = projection[1][1] = 1.5f;
+		projection[2][2] = -1.002f;
+		projection[2][3] = -1;
+		projection[3][2] = -1.001f;
+		frustum.set(projection);
+		rand_t r(1);
+		boxes.resize(4096*scale*2);
+		for(size_t i=0; i<boxes.size(); i+=2) {
+			boxes[i] = glm::vec3(r.randf(-500,500),r.randf(-500,500),r.randf(-500,500));
+			boxes[i+1] = boxes[i]+glm::vec3(r.randf(1,10),r.randf(1,10),r.randf(1,10));
+		}
+	}
+	void run(size_t ops) {
+		while(ops--)
+			for(size_t i=0; i<boxes.size(); i+=2)
+				sink += frustum.test(boxes[i],boxes[i+1]);
+	}
+private:
+	frustum_t frustum;
+	std::vector<glm::vec3> boxes;
+};
+
+class binary_reader_bench_t: public bench_t {
+public:
+	enum mode_t { FLOAT32, FLOAT32S, NARROW_UINT32S };
+	binary_reader_bench_t(const char* name,mode_t mode): bench_t(name), mode(mode) {}
+	void setup(size_t scale) {
+		count = 65536*scale;
+		rand_t r(1);
+		std::string buf;
+		for(size_t i=0; i<count; i++) {
+			const uint32_t v = r.rand(0x10000);
+			buf.append(reinterpret_cast<const char*>(&v),sizeof(v));
+		}
+		data = bytes_t::take(buf);
+		floats.resize(count);
+		shorts.resize(count);
+		bytes = data.size();
+	}
+	void run(size_t ops) {
+		while(ops--) {
+			binary_reader_t in(data);
+			switch(mode) {
+			case FLOAT32:
+				for(size_t i=0; i<count; i++)
+					floats[i] = in.float32();
+				break;
+			case FLOAT32S:
+				in.float32s(&floats[0],count);
+				break;
+			case NARROW_UINT32S:
+				sink += in.narrow_uint32s(&shorts[0],count,0x10000);
+				break;
+			}
+			sink += shorts[count/2] + (uint64_t)floats[count/2];
+		}
+	}
+private:
+	const mode_t mode;
+	size_t count;
+	bytes_t data;
+	std::vector<float> floats;
+	std::vector<uint16_t> shorts;
+};
+
+// ---- images
+
+/* SOIL only writes images to files, and an uncompressed image wouldn't exercise much
+   of the decoder anyway; so this writes an RGBA PNG with every row Sub-filtered and
+   the deflate stream coded with the fixed Huffman codes and distance-1 runs. The
+   picture is sprite-like: flat tiles that compress and noisy tiles that don't. */
+
+namespace {
+	struct _bit_writer_t {
+		_bit_writer_t(): bits(0), count(0) {}
+		std::string buf;
+		uint32_t bits, count;
+		void put(uint32_t v,int n) { // LSB first
+			bits |= v<<count;
+			count += n;
+			while(count >= 8) {
+				buf.push_back(bits&0xff);
+				bits >>= 8;
+				count -= 8;
+			}
+		}
+		void huffman(uint32_t code,int n) { // huffman codes are stored MSB first
+			uint32_t rev = 0;
+			for(int i=0; i<n; i++)
+				rev |= ((code>>i)&1)<<(n-1-i);
+			put(rev,n);
+		}
+		void flush() { if(count) put(0,8-count); }
+	};
+
+	void _deflate_symbol(_bit_writer_t& out,int sym) {
+		if(sym < 144) out.huffman(0x30+sym,8);
+		else if(sym < 256) out.huffman(0x190+sym-144,9);
+		else if(sym < 280) out.huffman(sym-256,7);
+		else out.huffman(0xc0+sym-280,8);
+	}
+
+	void _deflate_run(_bit_writer_t& out,int len) { // 3..258 copies of the previous byte
+		static const int base[] = {3,4,5,6,7,8,9,10,11,13,15,17,19,23,27,31,35,43,51,59,67,83,99,115,131,163,195,227,258};
+		static const int extra[] = {0,0,0,0,0,0,0,0,1,1,1,1,2,2,2,2,3,3,3,3,4,4,4,4,5,5,5,5,0};
+		int code = 28;
+		while(base[code] > len) code--;
+		_deflate_symbol(out,257+code);
+		out.put(len-base[code],extra[code]);
+		out.huffman(0,5); // distance code 0: distance 1
+	}
+
+	uint32_t _crc32(const std::string& s,size_t ofs) {
+		uint32_t crc = 0xffffffff;
+		for(size_t i=ofs; i<s.size(); i++) {
+			crc ^= (uint8_t)s[i];
+			for(int k=0; k<8; k++)
+				crc = (crc>>1)^(0xedb88320&-(crc&1));
+		}
+		return ~crc;
+	}
+
+	void _be32(std::string& s,uint32_t v) {
+		for(int i=24; i>=0; i-=8)
+			s.push_back((v>>i)&0xff);
+	}
+
+	void _png_chunk(std::string& png,const char* type,const std::string& data) {
+		_be32(png,data.size());
+		const size_t start = png.size();
+		png += type;
+		png += data;
+		_be32(png,_crc32(png,start));
+	}
+}
+
+static std::string make_png(int width,int height) {
+	rand_t r(1);
+	std::string raw;
+	for(int y=0; y<height; y++) {
+		raw.push_back(1); // Sub filter
+		uint8_t prev[4] = {0,0,0,0};
+		for(int x=0; x<width; x++) {
+			const uint32_t tile = (x/16)*7919+(y/16)*104729;
+			for(int c=0; c<4; c++) {
+				const uint8_t v = (tile%3)? (tile>>(c*3))&0xff: r.rand(256);
+				raw.push_back(v-prev[c]);
+				prev[c] = v;
+			}
+		}
+	}
+	_bit_writer_t out;
+	out.put(0x78,8); out.put(0x01,8); // zlib header
+	out.put(1,1); out.put(1,2); // final block, fixed Huffman codes
+	for(size_t i=0; i<raw.size(); ) {
+		_deflate_symbol(out,(uint8_t)raw[i]);
+		size_t run = 0;
+		while((run < 258) && (i+1+run < raw.size()) && (raw[i+1+run] == raw[i]))
+			run++;
+		if(run >= 3) {
+			_deflate_run(out,run);
+			i += 1+run;
+		} else
+			i++;
+	}
+	_deflate_symbol(out,256);
+	out.flush();
+	uint32_t a = 1, b = 0; // adler32
+	for(size_t i=0; i<raw.size(); i++) {
+		a = (a+(uint8_t)raw[i])%65521;
+		b = (b+a)%65521;
+	}
+	_be32(out.buf,(b<<16)|a);
+	std::string ihdr;
+	_be32(ihdr,width);
+	_be32(ihdr,height);
+	ihdr += std::string("\x08\x06\x00\x00\x00",5); // 8 bit RGBA, not interlaced
+	std::string png("\x89PNG\r\n\x1a\n");
+	_png_chunk(png,"IHDR",ihdr);
+	_png_chunk(png,"IDAT",out.buf);
+	_png_chunk(png,"IEND","");
+	return png;
+}
+
+static int scaled_side(int side,size_t scale) {
+	return side*std::sqrt((double)scale); // so pixel count goes up with scale
+}
+
+class image_decode_bench_t: public bench_t {
+public:
+	image_decode_bench_t(): bench_t("image_decode_png") {}
+	void setup(size_t scale) {
+		side = scaled_side(512,scale);
+		png = make_png(side,side);
+		bytes = png.size();
+	}
+	void run(size_t ops) {
+		while(ops--) {
+			int width, height, channels;
+			unsigned char* img = stbi_load_from_memory(reinterpret_cast<const unsigned char*>(png.data()),png.size(),&width,&height,&channels,0);
+			if(!img || (width != side) || (height != side) || (channels != 4))
+				panic("could not decode generated PNG: " << stbi_failure_reason());
+			sink += img[width*height*channels/2];
+			stbi_image_free(img);
+		}
+	}
+private:
+	int side;
+	std::string png;
+};
+
+// the resampling main_t does to loaded textures: NPOT images are scaled up, then every mip
+// level is reduced from the full image
+class image_resample_bench_t: public bench_t {
+public:
+	// chain is the band functions the texture loader uses, rather than SOIL's originals
+	image_resample_bench_t(const char* name,bool mipmap,bool chain=false,bool gamma=false):
+		bench_t(name), mipmap(mipmap), chain(chain), gamma(gamma) {}
+	void setup(size_t scale) {
+		width = scaled_side(mipmap? 512: 300,scale);
+		height = scaled_side(mipmap? 512: 200,scale);
+		if(mipmap) { // keep power of two
+			int pot = 1;
+			while(pot*2 <= width) pot *= 2;
+			width = height = pot;
+		}
+		rand_t r(1);
+		img.resize(width*height*4);
+		for(size_t i=0; i<img.size(); i++)
+			img[i] = r.rand(256);
+		pot_width = pot_height = 1;
+		while(pot_width < width) pot_width *= 2;
+		while(pot_height < height) pot_height *= 2;
+		out.resize(mipmap? width*height*4: pot_width*pot_height*4);
+		levels.clear();
+		for(unsigned char* dest = &out[0]; mipmap && ((1<<(levels.size()+1)) <= width); ) {
+			levels.push_back(dest);
+			dest += std::max(width>>levels.size(),1)*std::max(height>>levels.size(),1)*4;
+		}
+		bytes = img.size();
+	}
+	void run(size_t ops) {
+		while(ops--) {
+			if(mipmap && chain) {
+				mipmap_image_band(&img[0],width,height,4,gamma,0,height,levels.size(),&levels[0],NULL);
+			} else if(mipmap) {
+				unsigned char* dest = &out[0];
+				for(int level=1; ((1<<level) <= width) || ((1<<level) <= height); level++) {
+					mipmap_image(&img[0],width,height,4,dest,1<<level,1<<level);
+					dest += std::max(width>>level,1)*std::max(height>>level,1)*4;
+				}
+			} else if(chain) // in bands, as the texture loader does
+				for(int row=0; row<pot_height; row+=16)
+					up_scale_image_band(&img[0],width,height,4,&out[0],pot_width,pot_height,gamma,row,std::min(16,pot_height-row));
+			else
+				up_scale_image(&img[0],width,height,4,&out[0],pot_width,pot_height);
+			sink += out[out.size()/3];
+		}
+	}
+private:
+	const bool mipmap, chain, gamma;
+	int width, height, pot_width, pot_height;
+	std::vector<unsigned char> img, out;
+	std::vector<unsigned char*> levels;
+};
+
+class image_compress_bench_t: public bench_t {
+public:
+	image_compress_bench_t(const char* name,bool dxt5): bench_t(name), dxt5(dxt5) {}
+	void setup(size_t scale) {
+		// smooth gradients with some noise, as photos are; random pixels are the worst case
+		width = scaled_side(512,scale);
+		height = scaled_side(512,scale);
+		rand_t r(1);
+		img.resize(width*height*4);
+		for(int y=0; y<height; y++)
+			for(int x=0; x<width; x++) {
+				unsigned char* px = &img[(y*width+x)*4];
+				px[0] = (x*255/width+r.rand(16))&0xff;
+				px[1] = (y*255/height+r.rand(16))&0xff;
+				px[2] = ((x+y)*127/width+r.rand(16))&0xff;
+				px[3] = ((x^y)&0xff);
+			}
+		out.resize(DXT_image_size(width,height,dxt5));
+		bytes = img.size();
+	}
+	void run(size_t ops) {
+		while(ops--) {
+			convert_image_rows_to_DXT(&img[0],width,height,4,dxt5,0,(height+3)/4,&out[0]);
+			sink += out[out.size()/3];
+		}
+	}
+private:
+	const bool dxt5;
+	int width, height;
+	std::vector<unsigned char> img, out;
+};
+
+// filling atlas pages with small power-of-two textures and their borders, in units of the border
+class atlas_bench_t: public bench_t {
+public:
+	atlas_bench_t(): bench_t("atlas_pack") {}
+	void setup(size_t scale) {
+		rand_t r(1);
+		sizes.resize(1000*scale*2);
+		for(size_t i=0; i<sizes.size(); i++)
+			sizes[i] = (1<<r.rand(6))+2; // 8 to 256 texels, bordered
+	}
+	void run(size_t ops) {
+		while(ops--) {
+			std::vector<atlas_t> pages;
+			for(size_t i=0; i<sizes.size(); i+=2) {
+				int x, y;
+				size_t p = 0;
+				while((p < pages.size()) && !pages[p].add(sizes[i],sizes[i+1],x,y))
+					p++;
+				if(p == pages.size()) {
+					pages.push_back(atlas_t(256,256)); // 2048 texel pages
+					pages.back().add(sizes[i],sizes[i+1],x,y);
+				}
+			}
+			sink += pages.size();
+		}
+	}
+private:
+	std::vector<int> sizes;
+};
+
+// what a texture cache hit costs on the CPU: hashing the source file, then checking the DDS
+class texture_cache_bench_t: public bench_t {
+public:
+	texture_cache_bench_t(const char* name,bool load): bench_t(name), load(load) {}
+	void setup(size_t scale) {
+		rand_t r(1);
+		std::string buf(1000000*scale,0);
+		for(size_t i=0; i<buf.size(); i++)
+			buf[i] = r.rand();
+		source = bytes_t::take(buf);
+		const int side = scaled_side(512,scale);
+		pixels.resize(side*side*4);
+		texture_cache_t::levels_t levels;
+		for(size_t ofs=0, i=0; (side>>i) > 0; ofs += levels.back().size, i++) {
+			const texture_cache_t::level_t level = {side>>i,side>>i,&pixels[0]+ofs,(size_t)4*(side>>i)*(side>>i)};
+			levels.push_back(level);
+		}
+		dds = texture_cache_t::save(texture_cache_t::RGBA,levels);
+		bytes = load? dds.size(): source.size();
+	}
+	void run(size_t ops) {
+		while(ops--)
+			if(load) {
+				texture_cache_t::format_t format;
+				texture_cache_t::levels_t levels;
+				if(!texture_cache_t::load(dds,format,levels))
+					panic("DDS rejected");
+				sink += levels.size();
+			} else
+				sink += texture_cache_t::path("cache",source,4096,0,false,false).size();
+	}
+private:
+	const bool load;
+	bytes_t source, dds;
+	std::vector<uint8_t> pixels;
+};
+
+// ---- misc
+
+class rand_bench_t: public bench_t {
+public:
+	rand_bench_t(const char* name,bool floats): bench_t(name), floats(floats) {}
+	void setup(size_t) {}
+	void run(size_t ops) {
+		uint64_t sum = 0;
+		if(floats)
+			while(ops--) sum += r.randf(1000);
+		else
+			while(ops--) sum += r.rand();
+		sink += sum;
+	}
+private:
+	const bool floats;
+	rand_t r;
+};
+
+class time_bench_t: public bench_t {
+public:
+	time_bench_t(): bench_t("high_precision_time") {}
+	void setup(size_t) {}
+	void run(size_t ops) {
+		uint64_t sum = 0;
+		while(ops--) sum += high_precision_time();
+		sink += sum;
+	}
+};
+
+int main(int argc,char* args[]) {
+	size_t scale = 1;
+	double secs = 0.5;
+	std::vector<std::string> filters;
+	for(int i=1; i<argc; i++) {
+		const std::string arg(args[i]);
+		if((arg == "-scale") && (i+1 < argc))
+			scale = std::max(1,atoi(args[++i]));
+		else if((arg == "-secs") && (i+1 < argc))
+			secs = atof(args[++i]);
+		else if(arg.size() && (arg[0] == '-')) {
+			std::cerr << "usage: " << args[0] << " [-scale N] [-secs S] [name-prefix...]" << std::endl;
+			return 1;
+		} else
+			filters.push_back(arg);
+	}
+	std::vector<bench_t*> benches;
+	benches.push_back(new xml_parse_bench_t());
+	benches.push_back(new xml_stream_bench_t());
+	benches.push_back(new xml_query_bench_t("xml_query",false));
+	benches.push_back(new xml_query_bench_t("xml_query_interned",true));
+	benches.push_back(new g3d_load_bench_t());
+	benches.push_back(new g3d_cache_bench_t("g3d_load_cache",false));
+	benches.push_back(new g3d_cache_bench_t("g3d_save_cache",true));
+	benches.push_back(new g3d_optimise_bench_t());
+	benches.push_back(new frustum_bench_t());
+	benches.push_back(new binary_reader_bench_t("binary_reader_float32",binary_reader_bench_t::FLOAT32));
+	benches.push_back(new binary_reader_bench_t("binary_reader_float32s",binary_reader_bench_t::FLOAT32S));
+	benches.push_back(new binary_reader_bench_t("binary_reader_narrow_uint32s",binary_reader_bench_t::NARROW_UINT32S));
+	benches.push_back(new image_decode_bench_t());
+	benches.push_back(new image_resample_bench_t("image_up_scale",false));
+	benches.push_back(new image_resample_bench_t("image_mipmap",true));
+	benches.push_back(new image_resample_bench_t("image_up_scale_band",false,true));
+	benches.push_back(new image_resample_bench_t("image_mipmap_chain",true,true));
+	benches.push_back(new image_resample_bench_t("image_mipmap_chain_gamma",true,true,true));
+	benches.push_back(new image_compress_bench_t("image_dxt1",false));
+	benches.push_back(new image_compress_bench_t("image_dxt5",true));
+	benches.push_back(new atlas_bench_t());
+	benches.push_back(new texture_cache_bench_t("texture_cache_hash",false));
+	benches.push_back(new texture_cache_bench_t("texture_cache_load",true));
+	benches.push_back(new rand_bench_t("rand",false));
+	benches.push_back(new rand_bench_t("randf",true));
+	benches.push_back(new time_bench_t());
+	int ret = 0;
+	for(std::vector<bench_t*>::iterator b=benches.begin(); b!=benches.end(); b++) {
+		bool wanted = filters.empty();
+		for(std::vector<std::string>::const_iterator f=filters.begin(); f!=filters.end(); f++)
+			wanted |= !strncmp((*b)->name,f->c_str(),f->size());
+		if(wanted) {
+			try {
+				measure(**b,scale,secs);
+			} catch(std::exception& e) {
+				std::cerr << (*b)->name << " failed: " << e.what() << std::endl;
+				ret = 1;
+			}
+		}
+		delete *b;
+	}
+	return ret;
+}
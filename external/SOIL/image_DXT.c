@@ -12,6 +12,9 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#ifdef __SSE2__
+	#include <emmintrin.h>
+#endif
 
 /*	set this =1 if you want to use the covarince matrix method...
 	which is better than my method of using standard deviations
@@ -104,11 +107,6 @@ unsigned char* convert_image_to_DXT1(
 		int *out_size )
 {
 	unsigned char *compressed;
-	int i, j, x, y;
-	unsigned char ublock[16*3];
-	unsigned char cblock[8];
-	int index = 0, chan_step = 1;
-	int block_count = 0;
 	/*	error check	*/
 	*out_size = 0;
 	if( (width < 1) || (height < 1) ||
@@ -117,65 +115,12 @@ unsigned char* convert_image_to_DXT1(
 	{
 		return NULL;
 	}
-	/*	for channels == 1 or 2, I do not step forward for R,G,B values	*/
-	if( channels < 3 )
-	{
-		chan_step = 0;
-	}
 	/*	get the RAM for the compressed image
 		(8 bytes per 4x4 pixel block)	*/
-	*out_size = ((width+3) >> 2) * ((height+3) >> 2) * 8;
+	*out_size = DXT_image_size( width, height, 0 );
 	compressed = (unsigned char*)malloc( *out_size );
-	/*	go through each block	*/
-	for( j = 0; j < height; j += 4 )
-	{
-		for( i = 0; i < width; i += 4 )
-		{
-			/*	copy this block into a new one	*/
-			int idx = 0;
-			int mx = 4, my = 4;
-			if( j+4 >= height )
-			{
-				my = height - j;
-			}
-			if( i+4 >= width )
-			{
-				mx = width - i;
-			}
-			for( y = 0; y < my; ++y )
-			{
-				for( x = 0; x < mx; ++x )
-				{
-					ublock[idx++] = uncompressed[(j+y)*width*channels+(i+x)*channels];
-					ublock[idx++] = uncompressed[(j+y)*width*channels+(i+x)*channels+chan_step];
-					ublock[idx++] = uncompressed[(j+y)*width*channels+(i+x)*channels+chan_step+chan_step];
-				}
-				for( x = mx; x < 4; ++x )
-				{
-					ublock[idx++] = ublock[0];
-					ublock[idx++] = ublock[1];
-					ublock[idx++] = ublock[2];
-				}
-			}
-			for( y = my; y < 4; ++y )
-			{
-				for( x = 0; x < 4; ++x )
-				{
-					ublock[idx++] = ublock[0];
-					ublock[idx++] = ublock[1];
-					ublock[idx++] = ublock[2];
-				}
-			}
-			/*	compress the block	*/
-			++block_count;
-			compress_DDS_color_block( 3, ublock, cblock );
-			/*	copy the data from the block into the main block	*/
-			for( x = 0; x < 8; ++x )
-			{
-				compressed[index++] = cblock[x];
-			}
-		}
-	}
+	convert_image_rows_to_DXT( uncompressed, width, height, channels, 0,
+			0, (height+3) >> 2, compressed );
 	return compressed;
 }
 
@@ -185,11 +130,6 @@ unsigned char* convert_image_to_DXT5(
 		int *out_size )
 {
 	unsigned char *compressed;
-	int i, j, x, y;
-	unsigned char ublock[16*4];
-	unsigned char cblock[8];
-	int index = 0, chan_step = 1;
-	int block_count = 0, has_alpha;
 	/*	error check	*/
 	*out_size = 0;
 	if( (width < 1) || (height < 1) ||
@@ -198,80 +138,115 @@ unsigned char* convert_image_to_DXT5(
 	{
 		return NULL;
 	}
-	/*	for channels == 1 or 2, I do not step forward for R,G,B vales	*/
-	if( channels < 3 )
-	{
-		chan_step = 0;
-	}
-	/*	# channels = 1 or 3 have no alpha, 2 & 4 do have alpha	*/
-	has_alpha = 1 - (channels & 1);
 	/*	get the RAM for the compressed image
 		(16 bytes per 4x4 pixel block)	*/
-	*out_size = ((width+3) >> 2) * ((height+3) >> 2) * 16;
+	*out_size = DXT_image_size( width, height, 1 );
 	compressed = (unsigned char*)malloc( *out_size );
-	/*	go through each block	*/
-	for( j = 0; j < height; j += 4 )
+	convert_image_rows_to_DXT( uncompressed, width, height, channels, 1,
+			0, (height+3) >> 2, compressed );
+	return compressed;
+}
+
+int DXT_image_size( int width, int height, int dxt5 )
+{
+	return ((width+3) >> 2) * ((height+3) >> 2) * (dxt5 ? 16 : 8);
+}
+
+/*	copies the 4x4 block at i,j into ublock as RGB (or RGBA for DXT5),
+	padding blocks that hang off the edge with their first pixel	*/
+static void get_DXT_block(
+		const unsigned char *const uncompressed,
+		int width, int height, int channels, int dxt5,
+		int i, int j,
+		unsigned char *ublock )
+{
+	/*	for channels == 1 or 2, I do not step forward for R,G,B values	*/
+	const int chan_step = (channels < 3) ? 0 : 1;
+	/*	# channels = 1 or 3 have no alpha, 2 & 4 do have alpha	*/
+	const int has_alpha = 1 - (channels & 1);
+	const int out_channels = dxt5 ? 4 : 3;
+	int idx = 0, x, y, c;
+	int mx = 4, my = 4;
+	if( j+4 >= height )
 	{
-		for( i = 0; i < width; i += 4 )
+		my = height - j;
+	}
+	if( i+4 >= width )
+	{
+		mx = width - i;
+	}
+	for( y = 0; y < my; ++y )
+	{
+		const unsigned char *src = uncompressed + ((j+y)*width+i)*channels;
+		if( (mx == 4) && (channels == out_channels) )
 		{
-			/*	local variables, and my block counter	*/
-			int idx = 0;
-			int mx = 4, my = 4;
-			if( j+4 >= height )
-			{
-				my = height - j;
-			}
-			if( i+4 >= width )
+			/*	the common case: a whole row in the same layout	*/
+			memcpy( ublock+idx, src, 4*channels );
+			idx += 4*channels;
+			continue;
+		}
+		for( x = 0; x < mx; ++x, src += channels )
+		{
+			ublock[idx++] = src[0];
+			ublock[idx++] = src[chan_step];
+			ublock[idx++] = src[chan_step+chan_step];
+			if( dxt5 )
 			{
-				mx = width - i;
+				ublock[idx++] = has_alpha ? src[channels-1] : 255;
 			}
-			for( y = 0; y < my; ++y )
+		}
+		for( x = mx; x < 4; ++x )
+		{
+			for( c = 0; c < out_channels; ++c )
 			{
-				for( x = 0; x < mx; ++x )
-				{
-					ublock[idx++] = uncompressed[(j+y)*width*channels+(i+x)*channels];
-					ublock[idx++] = uncompressed[(j+y)*width*channels+(i+x)*channels+chan_step];
-					ublock[idx++] = uncompressed[(j+y)*width*channels+(i+x)*channels+chan_step+chan_step];
-					ublock[idx++] =
-						has_alpha * uncompressed[(j+y)*width*channels+(i+x)*channels+channels-1]
-						+ (1-has_alpha)*255;
-				}
-				for( x = mx; x < 4; ++x )
-				{
-					ublock[idx++] = ublock[0];
-					ublock[idx++] = ublock[1];
-					ublock[idx++] = ublock[2];
-					ublock[idx++] = ublock[3];
-				}
+				ublock[idx++] = ublock[c];
 			}
-			for( y = my; y < 4; ++y )
+		}
+	}
+	for( y = my; y < 4; ++y )
+	{
+		for( x = 0; x < 4; ++x )
+		{
+			for( c = 0; c < out_channels; ++c )
 			{
-				for( x = 0; x < 4; ++x )
-				{
-					ublock[idx++] = ublock[0];
-					ublock[idx++] = ublock[1];
-					ublock[idx++] = ublock[2];
-					ublock[idx++] = ublock[3];
-				}
+				ublock[idx++] = ublock[c];
 			}
-			/*	now compress the alpha block	*/
-			compress_DDS_alpha_block( ublock, cblock );
-			/*	copy the data from the compressed alpha block into the main buffer	*/
-			for( x = 0; x < 8; ++x )
+		}
+	}
+}
+
+void convert_image_rows_to_DXT(
+		const unsigned char *const uncompressed,
+		int width, int height, int channels, int dxt5,
+		int first_row, int rows,
+		unsigned char *compressed )
+{
+	const int block_bytes = dxt5 ? 16 : 8;
+	const int blocks_x = (width+3) >> 2;
+	int last_row = first_row + rows, i, j;
+	unsigned char ublock[16*4];
+	if( last_row > ((height+3) >> 2) )
+	{
+		last_row = (height+3) >> 2;
+	}
+	compressed += first_row * blocks_x * block_bytes;
+	for( j = first_row; j < last_row; ++j )
+	{
+		for( i = 0; i < blocks_x; ++i )
+		{
+			get_DXT_block( uncompressed, width, height, channels, dxt5, i*4, j*4, ublock );
+			if( dxt5 )
 			{
-				compressed[index++] = cblock[x];
-			}
-			/*	then compress the color block	*/
-			++block_count;
-			compress_DDS_color_block( 4, ublock, cblock );
-			/*	copy the data from the compressed color block into the main buffer	*/
-			for( x = 0; x < 8; ++x )
+				/*	the alpha block, then the color block	*/
+				compress_DDS_alpha_block( ublock, compressed );
+				compress_DDS_color_block( 4, ublock, compressed+8 );
+			} else
 			{
-				compressed[index++] = cblock[x];
+				compress_DDS_color_block( 3, ublock, compressed );
 			}
+			compressed += block_bytes;
 		}
 	}
-	return compressed;
 }
 
 /********* Helper Functions *********/
@@ -296,30 +271,20 @@ void rgb_888_from_565( unsigned int c, int *r, int *g, int *b )
 	*b = convert_bit_range( (c >> 00) & 31, 5, 8 );
 }
 
-void compute_color_line_STDEV(
-		const unsigned char *const uncompressed,
-		int channels,
+/*	The SSE2 versions below work on all 16 pixels of a block at once, but
+	do each pixel's float arithmetic in the same order as the plain C, and
+	the sums are of small integers and so exact either way; the output is
+	bit for bit the same.  What is left scalar is shared by both.	*/
+
+/*	sums[] is r, g, b, rr, gg, bb, rg, rb, gb over the block	*/
+static void color_line_from_sums(
+		float sums[9],
 		float point[3], float direction[3] )
 {
 	const float inv_16 = 1.0f / 16.0f;
-	int i;
-	float sum_r = 0.0f, sum_g = 0.0f, sum_b = 0.0f;
-	float sum_rr = 0.0f, sum_gg = 0.0f, sum_bb = 0.0f;
-	float sum_rg = 0.0f, sum_rb = 0.0f, sum_gb = 0.0f;
-	/*	calculate all data needed for the covariance matrix
-		( to compare with _rygdxt code)	*/
-	for( i = 0; i < 16*channels; i += channels )
-	{
-		sum_r += uncompressed[i+0];
-		sum_rr += uncompressed[i+0] * uncompressed[i+0];
-		sum_g += uncompressed[i+1];
-		sum_gg += uncompressed[i+1] * uncompressed[i+1];
-		sum_b += uncompressed[i+2];
-		sum_bb += uncompressed[i+2] * uncompressed[i+2];
-		sum_rg += uncompressed[i+0] * uncompressed[i+1];
-		sum_rb += uncompressed[i+0] * uncompressed[i+2];
-		sum_gb += uncompressed[i+1] * uncompressed[i+2];
-	}
+	float sum_r = sums[0], sum_g = sums[1], sum_b = sums[2];
+	float sum_rr = sums[3], sum_gg = sums[4], sum_bb = sums[5];
+	float sum_rg = sums[6], sum_rb = sums[7], sum_gb = sums[8];
 	/*	convert the sums to averages	*/
 	sum_r *= inv_16;
 	sum_g *= inv_16;
@@ -408,52 +373,42 @@ void compute_color_line_STDEV(
 	#endif
 }
 
-void LSE_master_colors_max_min(
-		int *cmax, int *cmin,
+void compute_color_line_STDEV(
+		const unsigned char *const uncompressed,
 		int channels,
-		const unsigned char *const uncompressed )
+		float point[3], float direction[3] )
+{
+	int i;
+	float sums[9] = { 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f };
+	/*	calculate all data needed for the covariance matrix
+		( to compare with _rygdxt code)	*/
+	for( i = 0; i < 16*channels; i += channels )
+	{
+		sums[0] += uncompressed[i+0];
+		sums[3] += uncompressed[i+0] * uncompressed[i+0];
+		sums[1] += uncompressed[i+1];
+		sums[4] += uncompressed[i+1] * uncompressed[i+1];
+		sums[2] += uncompressed[i+2];
+		sums[5] += uncompressed[i+2] * uncompressed[i+2];
+		sums[6] += uncompressed[i+0] * uncompressed[i+1];
+		sums[7] += uncompressed[i+0] * uncompressed[i+2];
+		sums[8] += uncompressed[i+1] * uncompressed[i+2];
+	}
+	color_line_from_sums( sums, point, direction );
+}
+
+/*	the 565 master colors at either end of the block's extent along its color line	*/
+static void master_colors_from_line(
+		const float sum_x[3], const float sum_x2[3],
+		float dot_min, float dot_max,
+		int *cmax, int *cmin )
 {
 	int i, j;
 	/*	the master colors	*/
 	int c0[3], c1[3];
-	/*	used for fitting the line	*/
-	float sum_x[] = { 0.0f, 0.0f, 0.0f };
-	float sum_x2[] = { 0.0f, 0.0f, 0.0f };
-	float dot_max = 1.0f, dot_min = -1.0f;
-	float vec_len2 = 0.0f;
 	float dot;
-	/*	error check	*/
-	if( (channels < 3) || (channels > 4) )
-	{
-		return;
-	}
-	compute_color_line_STDEV( uncompressed, channels, sum_x, sum_x2 );
-	vec_len2 = 1.0f / ( 0.00001f +
+	const float vec_len2 = 1.0f / ( 0.00001f +
 			sum_x2[0]*sum_x2[0] + sum_x2[1]*sum_x2[1] + sum_x2[2]*sum_x2[2] );
-	/*	finding the max and min vector values	*/
-	dot_max =
-			(
-				sum_x2[0] * uncompressed[0] +
-				sum_x2[1] * uncompressed[1] +
-				sum_x2[2] * uncompressed[2]
-			);
-	dot_min = dot_max;
-	for( i = 1; i < 16; ++i )
-	{
-		dot =
-			(
-				sum_x2[0] * uncompressed[i*channels+0] +
-				sum_x2[1] * uncompressed[i*channels+1] +
-				sum_x2[2] * uncompressed[i*channels+2]
-			);
-		if( dot < dot_min )
-		{
-			dot_min = dot;
-		} else if( dot > dot_max )
-		{
-			dot_max = dot;
-		}
-	}
 	/*	and the offset (from the average location)	*/
 	dot = sum_x2[0]*sum_x[0] + sum_x2[1]*sum_x[1] + sum_x2[2]*sum_x[2];
 	dot_min -= dot;
@@ -497,25 +452,60 @@ void LSE_master_colors_max_min(
 	}
 }
 
-void
-	compress_DDS_color_block
-	(
+void LSE_master_colors_max_min(
+		int *cmax, int *cmin,
 		int channels,
-		const unsigned char *const uncompressed,
-		unsigned char compressed[8]
-	)
+		const unsigned char *const uncompressed )
+{
+	int i;
+	/*	used for fitting the line	*/
+	float sum_x[] = { 0.0f, 0.0f, 0.0f };
+	float sum_x2[] = { 0.0f, 0.0f, 0.0f };
+	float dot_max = 1.0f, dot_min = -1.0f;
+	float dot;
+	/*	error check	*/
+	if( (channels < 3) || (channels > 4) )
+	{
+		return;
+	}
+	compute_color_line_STDEV( uncompressed, channels, sum_x, sum_x2 );
+	/*	finding the max and min vector values	*/
+	dot_max =
+			(
+				sum_x2[0] * uncompressed[0] +
+				sum_x2[1] * uncompressed[1] +
+				sum_x2[2] * uncompressed[2]
+			);
+	dot_min = dot_max;
+	for( i = 1; i < 16; ++i )
+	{
+		dot =
+			(
+				sum_x2[0] * uncompressed[i*channels+0] +
+				sum_x2[1] * uncompressed[i*channels+1] +
+				sum_x2[2] * uncompressed[i*channels+2]
+			);
+		if( dot < dot_min )
+		{
+			dot_min = dot;
+		} else if( dot > dot_max )
+		{
+			dot_max = dot;
+		}
+	}
+	master_colors_from_line( sum_x, sum_x2, dot_min, dot_max, cmax, cmin );
+}
+
+/*	stores the master colors, and works out the line between them that each
+	pixel is placed on; returns the constant part of the placing dot product	*/
+static float start_DDS_color_block(
+		int enc_c0, int enc_c1,
+		float color_line[3],
+		unsigned char compressed[8] )
 {
-	/*	variables	*/
 	int i;
-	int next_bit;
-	int enc_c0, enc_c1;
 	int c0[4], c1[4];
-	float color_line[] = { 0.0f, 0.0f, 0.0f, 0.0f };
-	float vec_len2 = 0.0f, dot_offset = 0.0f;
-	/*	stupid order	*/
-	int swizzle4[] = { 0, 2, 3, 1 };
-	/*	get the master colors	*/
-	LSE_master_colors_max_min( &enc_c0, &enc_c1, channels, uncompressed );
+	float vec_len2 = 0.0f;
 	/*	store the 565 color 0 and color 1	*/
 	compressed[0] = (enc_c0 >> 0) & 255;
 	compressed[1] = (enc_c0 >> 8) & 255;
@@ -530,7 +520,6 @@ void
 	rgb_888_from_565( enc_c0, &c0[0], &c0[1], &c0[2] );
 	rgb_888_from_565( enc_c1, &c1[0], &c1[1], &c1[2] );
 	/*	the new vector	*/
-	vec_len2 = 0.0f;
 	for( i = 0; i < 3; ++i )
 	{
 		color_line[i] = (float)(c1[i] - c0[i]);
@@ -545,7 +534,141 @@ void
 	color_line[1] *= vec_len2;
 	color_line[2] *= vec_len2;
 	/*	compute the offset (constant) portion of the dot product	*/
-	dot_offset = color_line[0]*c0[0] + color_line[1]*c0[1] + color_line[2]*c0[2];
+	return color_line[0]*c0[0] + color_line[1]*c0[1] + color_line[2]*c0[2];
+}
+
+#ifdef __SSE2__
+
+static int hsum_epi32( __m128i v )
+{
+	v = _mm_add_epi32( v, _mm_shuffle_epi32( v, _MM_SHUFFLE( 1, 0, 3, 2 ) ) );
+	v = _mm_add_epi32( v, _mm_shuffle_epi32( v, _MM_SHUFFLE( 2, 3, 0, 1 ) ) );
+	return _mm_cvtsi128_si32( v );
+}
+
+static void compress_DDS_color_block_SSE2(
+		int channels,
+		const unsigned char *const uncompressed,
+		unsigned char compressed[8] )
+{
+	static const int swizzle4[] = { 0, 2, 3, 1 };
+	short rgb[3][16];
+	__m128i r[2], g[2], b[2], sums_rg, sums_b, products;
+	__m128 fr[4], fg[4], fb[4], x, y, z, offset, lo, hi;
+	float sums[9], sum_x[3], sum_x2[3], color_line[3], dot_offset;
+	short values[16];
+	int enc_c0, enc_c1, i, next_bit;
+	const __m128i ones = _mm_set1_epi16( 1 );
+	/*	split the pixels into planes of shorts, then of floats	*/
+	for( i = 0; i < 16; ++i )
+	{
+		rgb[0][i] = uncompressed[i*channels+0];
+		rgb[1][i] = uncompressed[i*channels+1];
+		rgb[2][i] = uncompressed[i*channels+2];
+	}
+	for( i = 0; i < 2; ++i )
+	{
+		r[i] = _mm_loadu_si128( (const __m128i*)(rgb[0]+i*8) );
+		g[i] = _mm_loadu_si128( (const __m128i*)(rgb[1]+i*8) );
+		b[i] = _mm_loadu_si128( (const __m128i*)(rgb[2]+i*8) );
+	}
+	for( i = 0; i < 4; ++i )
+	{
+		const __m128i zero = _mm_setzero_si128();
+		fr[i] = _mm_cvtepi32_ps( (i&1) ? _mm_unpackhi_epi16( r[i>>1], zero ) : _mm_unpacklo_epi16( r[i>>1], zero ) );
+		fg[i] = _mm_cvtepi32_ps( (i&1) ? _mm_unpackhi_epi16( g[i>>1], zero ) : _mm_unpacklo_epi16( g[i>>1], zero ) );
+		fb[i] = _mm_cvtepi32_ps( (i&1) ? _mm_unpackhi_epi16( b[i>>1], zero ) : _mm_unpacklo_epi16( b[i>>1], zero ) );
+	}
+	/*	the sums for the covariance matrix, in pairs of products	*/
+	sums_rg = _mm_add_epi32( _mm_madd_epi16( r[0], ones ), _mm_madd_epi16( r[1], ones ) );
+	sums[0] = (float)hsum_epi32( sums_rg );
+	sums_rg = _mm_add_epi32( _mm_madd_epi16( g[0], ones ), _mm_madd_epi16( g[1], ones ) );
+	sums[1] = (float)hsum_epi32( sums_rg );
+	sums_b = _mm_add_epi32( _mm_madd_epi16( b[0], ones ), _mm_madd_epi16( b[1], ones ) );
+	sums[2] = (float)hsum_epi32( sums_b );
+	products = _mm_add_epi32( _mm_madd_epi16( r[0], r[0] ), _mm_madd_epi16( r[1], r[1] ) );
+	sums[3] = (float)hsum_epi32( products );
+	products = _mm_add_epi32( _mm_madd_epi16( g[0], g[0] ), _mm_madd_epi16( g[1], g[1] ) );
+	sums[4] = (float)hsum_epi32( products );
+	products = _mm_add_epi32( _mm_madd_epi16( b[0], b[0] ), _mm_madd_epi16( b[1], b[1] ) );
+	sums[5] = (float)hsum_epi32( products );
+	products = _mm_add_epi32( _mm_madd_epi16( r[0], g[0] ), _mm_madd_epi16( r[1], g[1] ) );
+	sums[6] = (float)hsum_epi32( products );
+	products = _mm_add_epi32( _mm_madd_epi16( r[0], b[0] ), _mm_madd_epi16( r[1], b[1] ) );
+	sums[7] = (float)hsum_epi32( products );
+	products = _mm_add_epi32( _mm_madd_epi16( g[0], b[0] ), _mm_madd_epi16( g[1], b[1] ) );
+	sums[8] = (float)hsum_epi32( products );
+	color_line_from_sums( sums, sum_x, sum_x2 );
+	/*	the extent of the pixels along the line	*/
+	x = _mm_set1_ps( sum_x2[0] );
+	y = _mm_set1_ps( sum_x2[1] );
+	z = _mm_set1_ps( sum_x2[2] );
+	for( i = 0; i < 4; ++i )
+	{
+		const __m128 dot = _mm_add_ps( _mm_add_ps( _mm_mul_ps( x, fr[i] ), _mm_mul_ps( y, fg[i] ) ), _mm_mul_ps( z, fb[i] ) );
+		lo = i ? _mm_min_ps( lo, dot ) : dot;
+		hi = i ? _mm_max_ps( hi, dot ) : dot;
+	}
+	lo = _mm_min_ps( lo, _mm_shuffle_ps( lo, lo, _MM_SHUFFLE( 1, 0, 3, 2 ) ) );
+	lo = _mm_min_ps( lo, _mm_shuffle_ps( lo, lo, _MM_SHUFFLE( 2, 3, 0, 1 ) ) );
+	hi = _mm_max_ps( hi, _mm_shuffle_ps( hi, hi, _MM_SHUFFLE( 1, 0, 3, 2 ) ) );
+	hi = _mm_max_ps( hi, _mm_shuffle_ps( hi, hi, _MM_SHUFFLE( 2, 3, 0, 1 ) ) );
+	master_colors_from_line( sum_x, sum_x2, _mm_cvtss_f32( lo ), _mm_cvtss_f32( hi ), &enc_c0, &enc_c1 );
+	/*	place each pixel on the line between the master colors	*/
+	dot_offset = start_DDS_color_block( enc_c0, enc_c1, color_line, compressed );
+	x = _mm_set1_ps( color_line[0] );
+	y = _mm_set1_ps( color_line[1] );
+	z = _mm_set1_ps( color_line[2] );
+	offset = _mm_set1_ps( dot_offset );
+	for( i = 0; i < 4; i += 2 )
+	{
+		__m128i v[2];
+		int k;
+		for( k = 0; k < 2; ++k )
+		{
+			const __m128 dot = _mm_sub_ps( _mm_add_ps( _mm_add_ps( _mm_mul_ps( x, fr[i+k] ), _mm_mul_ps( y, fg[i+k] ) ), _mm_mul_ps( z, fb[i+k] ) ), offset );
+			v[k] = _mm_cvttps_epi32( _mm_add_ps( _mm_mul_ps( dot, _mm_set1_ps( 3.0f ) ), _mm_set1_ps( 0.5f ) ) );
+		}
+		/*	map to [0,3]	*/
+		v[0] = _mm_min_epi16( _mm_max_epi16( _mm_packs_epi32( v[0], v[1] ), _mm_setzero_si128() ), _mm_set1_epi16( 3 ) );
+		_mm_storeu_si128( (__m128i*)(values+i*4), v[0] );
+	}
+	next_bit = 8*4;
+	for( i = 0; i < 16; ++i )
+	{
+		compressed[next_bit >> 3] |= swizzle4[ values[i] ] << (next_bit & 7);
+		next_bit += 2;
+	}
+}
+
+#endif /* __SSE2__ */
+
+void
+	compress_DDS_color_block
+	(
+		int channels,
+		const unsigned char *const uncompressed,
+		unsigned char compressed[8]
+	)
+{
+	/*	variables	*/
+	int i;
+	int next_bit;
+	int enc_c0, enc_c1;
+	float color_line[] = { 0.0f, 0.0f, 0.0f, 0.0f };
+	float dot_offset = 0.0f;
+	/*	stupid order	*/
+	int swizzle4[] = { 0, 2, 3, 1 };
+	#ifdef __SSE2__
+	if( (channels >= 3) && (channels <= 4) )
+	{
+		compress_DDS_color_block_SSE2( channels, uncompressed, compressed );
+		return;
+	}
+	#endif
+	/*	get the master colors	*/
+	LSE_master_colors_max_min( &enc_c0, &enc_c1, channels, uncompressed );
+	dot_offset = start_DDS_color_block( enc_c0, enc_c1, color_line, compressed );
 	/*	store the rest of the bits	*/
 	next_bit = 8*4;
 	for( i = 0; i < 16; ++i )
@@ -583,11 +706,33 @@ void
 {
 	/*	variables	*/
 	int i;
+	#ifndef __SSE2__
 	int next_bit;
+	#endif
 	int a0, a1;
 	float scale_me;
 	/*	stupid order	*/
 	int swizzle8[] = { 1, 7, 6, 5, 4, 3, 2, 0 };
+	#ifdef __SSE2__
+	/*	the alphas are the top bytes of the 16 pixels	*/
+	__m128i alpha[4], lo, hi;
+	for( i = 0; i < 4; ++i )
+	{
+		alpha[i] = _mm_srli_epi32( _mm_loadu_si128( (const __m128i*)(uncompressed+i*16) ), 24 );
+	}
+	lo = _mm_packs_epi32( alpha[0], alpha[1] );
+	hi = _mm_packs_epi32( alpha[2], alpha[3] );
+	hi = _mm_max_epi16( lo, hi );
+	lo = _mm_min_epi16( lo, _mm_packs_epi32( alpha[2], alpha[3] ) );
+	hi = _mm_max_epi16( hi, _mm_shuffle_epi32( hi, _MM_SHUFFLE( 1, 0, 3, 2 ) ) );
+	lo = _mm_min_epi16( lo, _mm_shuffle_epi32( lo, _MM_SHUFFLE( 1, 0, 3, 2 ) ) );
+	hi = _mm_max_epi16( hi, _mm_shufflelo_epi16( hi, _MM_SHUFFLE( 1, 0, 3, 2 ) ) );
+	lo = _mm_min_epi16( lo, _mm_shufflelo_epi16( lo, _MM_SHUFFLE( 1, 0, 3, 2 ) ) );
+	hi = _mm_max_epi16( hi, _mm_shufflelo_epi16( hi, _MM_SHUFFLE( 2, 3, 0, 1 ) ) );
+	lo = _mm_min_epi16( lo, _mm_shufflelo_epi16( lo, _MM_SHUFFLE( 2, 3, 0, 1 ) ) );
+	a0 = _mm_cvtsi128_si32( hi ) & 0xffff;
+	a1 = _mm_cvtsi128_si32( lo ) & 0xffff;
+	#else
 	/*	get the alpha limits (a0 > a1)	*/
 	a0 = a1 = uncompressed[3];
 	for( i = 4+3; i < 16*4; i += 4 )
@@ -600,6 +745,7 @@ void
 			a1 = uncompressed[i];
 		}
 	}
+	#endif
 	/*	store those limits, and zero the rest of the compressed dataset	*/
 	compressed[0] = a0;
 	compressed[1] = a1;
@@ -611,8 +757,30 @@ void
 	compressed[6] = 0;
 	compressed[7] = 0;
 	/*	store the all of the alpha values	*/
-	next_bit = 8*2;
 	scale_me = 7.9999f / (a0 - a1);
+	#ifdef __SSE2__
+	{
+		/*	all 16 are 3 bits each, so build them up in 48 bits	*/
+		int values[16];
+		unsigned long long bits = 0;
+		const __m128 scale = _mm_set1_ps( scale_me );
+		const __m128i base = _mm_set1_epi32( a1 );
+		for( i = 0; i < 4; ++i )
+		{
+			_mm_storeu_si128( (__m128i*)(values+i*4), _mm_cvttps_epi32( _mm_mul_ps(
+				_mm_cvtepi32_ps( _mm_sub_epi32( alpha[i], base ) ), scale ) ) );
+		}
+		for( i = 0; i < 16; ++i )
+		{
+			bits |= (unsigned long long)swizzle8[ values[i]&7 ] << (3*i);
+		}
+		for( i = 0; i < 6; ++i )
+		{
+			compressed[2+i] = (unsigned char)(bits >> (8*i));
+		}
+	}
+	#else
+	next_bit = 8*2;
 	for( i = 3; i < 16*4; i += 4 )
 	{
 		/*	convert this alpha value to a 3 bit number	*/
@@ -628,5 +796,6 @@ void
 		}
 		next_bit += 3;
 	}
+	#endif
 	/*	done compressing to DXT1	*/
 }
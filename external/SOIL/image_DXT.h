@@ -10,6 +10,10 @@
 #ifndef HEADER_IMAGE_DXT
 #define HEADER_IMAGE_DXT
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 /**
 	Converts an image from an array of unsigned chars (RGB or RGBA) to
 	DXT1 or DXT5, then saves the converted image to disk.
@@ -45,6 +49,31 @@ convert_image_to_DXT5
     int *out_size
 );
 
+/**
+	the size in bytes of an image in DXT1 (dxt5 == 0) or DXT5
+**/
+int
+DXT_image_size
+(
+    int width, int height, int dxt5
+);
+
+/**
+	converts block rows [first_row,first_row+rows) of an image to DXT1
+	(dxt5 == 0) or DXT5, writing them to their place in compressed, which
+	holds DXT_image_size() bytes; so different threads can each do some
+	rows of the same image at once.  Blocks are 4x4 pixels, so there are
+	(height+3)/4 block rows.
+**/
+void
+convert_image_rows_to_DXT
+(
+    const unsigned char *const uncompressed,
+    int width, int height, int channels, int dxt5,
+    int first_row, int rows,
+    unsigned char *compressed
+);
+
 /**	A bunch of DirectDraw Surface structures and flags **/
 typedef struct
 {
@@ -120,4 +149,8 @@ DDS_header ;
 #define DDSCAPS2_CUBEMAP_NEGATIVEZ	0x00008000
 #define DDSCAPS2_VOLUME	0x00200000
 
+#ifdef __cplusplus
+}
+#endif
+
 #endif /* HEADER_IMAGE_DXT	*/
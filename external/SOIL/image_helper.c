@@ -8,7 +8,206 @@
 
 #include "image_helper.h"
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
+#ifdef __SSE2__
+	#include <emmintrin.h>
+#endif
+#if defined(__SSE2__) && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && !defined(__native_client__)
+	#include <immintrin.h>
+	#define IMAGE_HELPER_AVX2
+#endif
+
+/*	sRGB to linear, scaled to [0,65535], for gamma-correct filtering	*/
+static const unsigned short sRGB_to_linear_LUT[256] =
+{
+	0, 20, 40, 60, 80, 99, 119, 139, 159, 179, 199, 219,
+	241, 264, 288, 313, 340, 367, 396, 427, 458, 491, 526, 562,
+	599, 637, 677, 718, 761, 805, 851, 898, 947, 997, 1048, 1101,
+	1156, 1212, 1270, 1330, 1391, 1453, 1517, 1583, 1651, 1720, 1790, 1863,
+	1937, 2013, 2090, 2170, 2250, 2333, 2418, 2504, 2592, 2681, 2773, 2866,
+	2961, 3058, 3157, 3258, 3360, 3464, 3570, 3678, 3788, 3900, 4014, 4129,
+	4247, 4366, 4488, 4611, 4736, 4864, 4993, 5124, 5257, 5392, 5530, 5669,
+	5810, 5953, 6099, 6246, 6395, 6547, 6700, 6856, 7014, 7174, 7335, 7500,
+	7666, 7834, 8004, 8177, 8352, 8528, 8708, 8889, 9072, 9258, 9445, 9635,
+	9828, 10022, 10219, 10417, 10619, 10822, 11028, 11235, 11446, 11658, 11873, 12090,
+	12309, 12530, 12754, 12980, 13209, 13440, 13673, 13909, 14146, 14387, 14629, 14874,
+	15122, 15371, 15623, 15878, 16135, 16394, 16656, 16920, 17187, 17456, 17727, 18001,
+	18277, 18556, 18837, 19121, 19407, 19696, 19987, 20281, 20577, 20876, 21177, 21481,
+	21787, 22096, 22407, 22721, 23038, 23357, 23678, 24002, 24329, 24658, 24990, 25325,
+	25662, 26001, 26344, 26688, 27036, 27386, 27739, 28094, 28452, 28813, 29176, 29542,
+	29911, 30282, 30656, 31033, 31412, 31794, 32179, 32567, 32957, 33350, 33745, 34143,
+	34544, 34948, 35355, 35764, 36176, 36591, 37008, 37429, 37852, 38278, 38706, 39138,
+	39572, 40009, 40449, 40891, 41337, 41785, 42236, 42690, 43147, 43606, 44069, 44534,
+	45002, 45473, 45947, 46423, 46903, 47385, 47871, 48359, 48850, 49344, 49841, 50341,
+	50844, 51349, 51858, 52369, 52884, 53401, 53921, 54445, 54971, 55500, 56032, 56567,
+	57105, 57646, 58190, 58737, 59287, 59840, 60396, 60955, 61517, 62082, 62650, 63221,
+	63795, 64372, 64952, 65535
+};
+
+/*	the largest sRGB value at or below each 256th of the linear range	*/
+static const unsigned char linear_to_sRGB_LUT[256] =
+{
+	0, 12, 21, 28, 33, 38, 42, 46, 49, 52, 55, 58, 61, 63, 66, 68,
+	70, 72, 74, 77, 78, 80, 82, 84, 86, 88, 89, 91, 92, 94, 96, 97,
+	99, 100, 101, 103, 104, 106, 107, 108, 110, 111, 112, 113, 115, 116, 117, 118,
+	119, 121, 122, 123, 124, 125, 126, 127, 128, 129, 130, 131, 132, 133, 134, 135,
+	136, 137, 138, 139, 140, 141, 142, 143, 144, 145, 146, 147, 148, 149, 149, 150,
+	151, 152, 153, 154, 155, 155, 156, 157, 158, 159, 160, 160, 161, 162, 163, 163,
+	164, 165, 166, 167, 167, 168, 169, 170, 170, 171, 172, 173, 173, 174, 175, 175,
+	176, 177, 178, 178, 179, 180, 180, 181, 182, 182, 183, 184, 184, 185, 186, 186,
+	187, 188, 188, 189, 190, 190, 191, 192, 192, 193, 193, 194, 195, 195, 196, 197,
+	197, 198, 198, 199, 200, 200, 201, 201, 202, 203, 203, 204, 204, 205, 205, 206,
+	207, 207, 208, 208, 209, 210, 210, 211, 211, 212, 212, 213, 213, 214, 215, 215,
+	216, 216, 217, 217, 218, 218, 219, 219, 220, 220, 221, 222, 222, 223, 223, 224,
+	224, 225, 225, 226, 226, 227, 227, 228, 228, 229, 229, 230, 230, 231, 231, 232,
+	232, 233, 233, 234, 234, 235, 235, 236, 236, 237, 237, 238, 238, 239, 239, 239,
+	240, 240, 241, 241, 242, 242, 243, 243, 244, 244, 245, 245, 246, 246, 246, 247,
+	247, 248, 248, 249, 249, 250, 250, 251, 251, 251, 252, 252, 253, 253, 254, 254
+};
+
+/*	the nearest sRGB value to a linear one	*/
+static unsigned char linear_to_sRGB( unsigned int linear )
+{
+	int i = linear_to_sRGB_LUT[linear >> 8];
+	while( (i < 255) && (sRGB_to_linear_LUT[i+1] <= linear) )
+	{
+		++i;
+	}
+	if( (i < 255) && (linear - sRGB_to_linear_LUT[i] > sRGB_to_linear_LUT[i+1] - linear) )
+	{
+		++i;
+	}
+	return (unsigned char)i;
+}
+
+/*	the alpha channel, if any, is never gamma corrected	*/
+static int alpha_channel( int channels ) { return (channels & 1) ? -1 : channels - 1; }
+
+#ifdef IMAGE_HELPER_AVX2
+/*	the AVX2 paths are picked at run time, so the build needn't target it	*/
+static int has_avx2( void )
+{
+	__builtin_cpu_init();
+	return __builtin_cpu_supports( "avx2" );
+}
+
+/*	the upscale blend without gamma, sixteen values at a time, returning
+	how many it did.  The sums are in the scalar code's order, and AVX2
+	doesn't bring FMA, so the results are the same, bit for bit	*/
+__attribute__((target("avx2")))
+static int up_scale_blend_avx2
+	(
+		const float *h00, const float *h01,
+		const float *h10, const float *h11,
+		float not_sampley, float sampley,
+		int row_len, unsigned char *out
+	)
+{
+	const __m256 half = _mm256_set1_ps( 0.5f ),
+		wy0 = _mm256_set1_ps( not_sampley ), wy1 = _mm256_set1_ps( sampley );
+	int x = 0;
+	for ( ; x + 16 <= row_len; x += 16 )
+	{
+		__m256 v0 = half, v1 = half;
+		__m256i w;
+		v0 = _mm256_add_ps( v0, _mm256_mul_ps( _mm256_loadu_ps( h00 + x ), wy0 ) );
+		v1 = _mm256_add_ps( v1, _mm256_mul_ps( _mm256_loadu_ps( h00 + x + 8 ), wy0 ) );
+		v0 = _mm256_add_ps( v0, _mm256_mul_ps( _mm256_loadu_ps( h01 + x ), wy0 ) );
+		v1 = _mm256_add_ps( v1, _mm256_mul_ps( _mm256_loadu_ps( h01 + x + 8 ), wy0 ) );
+		v0 = _mm256_add_ps( v0, _mm256_mul_ps( _mm256_loadu_ps( h10 + x ), wy1 ) );
+		v1 = _mm256_add_ps( v1, _mm256_mul_ps( _mm256_loadu_ps( h10 + x + 8 ), wy1 ) );
+		v0 = _mm256_add_ps( v0, _mm256_mul_ps( _mm256_loadu_ps( h11 + x ), wy1 ) );
+		v1 = _mm256_add_ps( v1, _mm256_mul_ps( _mm256_loadu_ps( h11 + x + 8 ), wy1 ) );
+		/*	packing is within 128 bit lanes, so put the quarters back in order	*/
+		w = _mm256_permute4x64_epi64(
+				_mm256_packs_epi32( _mm256_cvttps_epi32( v0 ), _mm256_cvttps_epi32( v1 ) ),
+				_MM_SHUFFLE(3,1,2,0) );
+		_mm_storeu_si128( (__m128i*)(out + x),
+				_mm_packus_epi16( _mm256_castsi256_si128( w ), _mm256_extracti128_si256( w, 1 ) ) );
+	}
+	return x;
+}
+
+/*	the sum of two rows of bytes, thirty-two at a time	*/
+__attribute__((target("avx2")))
+static int mipmap_add_rows_avx2
+	(
+		const unsigned char *a, const unsigned char *b,
+		int row_len, unsigned short *column_sums
+	)
+{
+	int i = 0;
+	for( ; i + 32 <= row_len; i += 32 )
+	{
+		const __m256i va = _mm256_loadu_si256( (const __m256i*)(a + i) ),
+			vb = _mm256_loadu_si256( (const __m256i*)(b + i) );
+		_mm256_storeu_si256( (__m256i*)(column_sums + i),
+				_mm256_add_epi16( _mm256_cvtepu8_epi16( _mm256_castsi256_si128( va ) ),
+					_mm256_cvtepu8_epi16( _mm256_castsi256_si128( vb ) ) ) );
+		_mm256_storeu_si256( (__m256i*)(column_sums + i + 16),
+				_mm256_add_epi16( _mm256_cvtepu8_epi16( _mm256_extracti128_si256( va, 1 ) ),
+					_mm256_cvtepu8_epi16( _mm256_extracti128_si256( vb, 1 ) ) ) );
+	}
+	return i;
+}
+
+/*	the sums of pairs of pixels of 1, 2 or 4 channels, as the SSE2 code
+	does them but twice as many at a time, returning how many it did	*/
+__attribute__((target("avx2")))
+static int mipmap_pairs_avx2
+	(
+		const unsigned short *column_sums,
+		int mip_width, int channels, int shift,
+		unsigned int *stored, unsigned char *out
+	)
+{
+	const unsigned int half = (1u << shift) >> 1;
+	const __m128i count = _mm_cvtsi32_si128( shift );
+	int i = 0;
+	if( 4 == channels )
+	{
+		/*	four output pixels from eight	*/
+		const __m256i rounding16 = _mm256_set1_epi16( (short)half );
+		for( ; i + 4 <= mip_width; i += 4 )
+		{
+			const __m256i p0123 = _mm256_loadu_si256( (const __m256i*)(column_sums + i*8) ),
+				p4567 = _mm256_loadu_si256( (const __m256i*)(column_sums + i*8 + 16) ),
+				/*	unpacking is within lanes, which leaves the sums in the order 0 2 1 3	*/
+				sum = _mm256_permute4x64_epi64(
+					_mm256_add_epi16( _mm256_unpacklo_epi64( p0123, p4567 ), _mm256_unpackhi_epi64( p0123, p4567 ) ),
+					_MM_SHUFFLE(3,1,2,0) ),
+				value = _mm256_srl_epi16( _mm256_add_epi16( sum, rounding16 ), count );
+			_mm256_storeu_si256( (__m256i*)(stored + i*4), _mm256_cvtepu16_epi32( _mm256_castsi256_si128( sum ) ) );
+			_mm256_storeu_si256( (__m256i*)(stored + i*4 + 8), _mm256_cvtepu16_epi32( _mm256_extracti128_si256( sum, 1 ) ) );
+			_mm_storeu_si128( (__m128i*)(out + i*4),
+					_mm_packus_epi16( _mm256_castsi256_si128( value ), _mm256_extracti128_si256( value, 1 ) ) );
+		}
+	} else
+	{
+		/*	sixteen sums to eight; two channels are first put side by side	*/
+		const __m256i ones = _mm256_set1_epi16( 1 ), rounding32 = _mm256_set1_epi32( (int)half );
+		const int step = 8 / channels;
+		for( ; i + step <= mip_width; i += step )
+		{
+			__m256i p = _mm256_loadu_si256( (const __m256i*)(column_sums + i*channels*2) ), sum, value;
+			if( 2 == channels )
+			{
+				p = _mm256_shufflelo_epi16( p, _MM_SHUFFLE(3,1,2,0) );
+				p = _mm256_shufflehi_epi16( p, _MM_SHUFFLE(3,1,2,0) );
+			}
+			sum = _mm256_madd_epi16( p, ones );
+			value = _mm256_srl_epi32( _mm256_add_epi32( sum, rounding32 ), count );
+			value = _mm256_packs_epi32( value, value );
+			value = _mm256_packus_epi16( value, value );
+			_mm256_storeu_si256( (__m256i*)(stored + i*channels), sum );
+			_mm_storel_epi64( (__m128i*)(out + i*channels),
+					_mm_unpacklo_epi32( _mm256_castsi256_si128( value ), _mm256_extracti128_si256( value, 1 ) ) );
+		}
+	}
+	return i;
+}
+#endif
 
 /*	Upscaling the image uses simple bilinear interpolation	*/
 int
@@ -19,64 +218,200 @@ int
 		unsigned char* resampled,
 		int resampled_width, int resampled_height
 	)
+{
+	return up_scale_image_band( orig, width, height, channels,
+			resampled, resampled_width, resampled_height,
+			0, 0, resampled_height );
+}
+
+/*
+	Each sample is the sum of four products in a fixed order; the first
+	factor of each (a source pixel times its horizontal weight) only
+	depends on the source row and the column, so these are worked out
+	once per source row and shared by every row sampled from it.  The
+	sums are then done in the same order as a pixel at a time would be,
+	so the results are the same, bit for bit.
+*/
+int
+	up_scale_image_band
+	(
+		const unsigned char* const orig,
+		int width, int height, int channels,
+		unsigned char* resampled,
+		int resampled_width, int resampled_height,
+		int gamma,
+		int first_row, int rows
+	)
 {
 	float dx, dy;
-	int x, y, c;
+	int x, y, c, i;
+	const int row_len = resampled_width * channels;
+	const int alpha = alpha_channel( channels );
+	int *index;
+	float *weight, *h_rows[2][2];
+	int h_row[2], need[2], slot[2];
+#ifdef IMAGE_HELPER_AVX2
+	const int avx2 = has_avx2();
+#endif
 
     /* error(s) check	*/
     if ( 	(width < 1) || (height < 1) ||
             (resampled_width < 2) || (resampled_height < 2) ||
             (channels < 1) ||
-            (NULL == orig) || (NULL == resampled) )
+            (NULL == orig) || (NULL == resampled) ||
+            (first_row < 0) || (rows < 0) ||
+            (first_row + rows > resampled_height) )
     {
         /*	signify badness	*/
         return 0;
     }
-    /*
+	/*
 		for each given pixel in the new map, find the exact location
 		from the original map which would contribute to this guy
 	*/
     dx = (width - 1.0f) / (resampled_width - 1.0f);
     dy = (height - 1.0f) / (resampled_height - 1.0f);
-    for ( y = 0; y < resampled_height; ++y )
+	/*	the source index and the weight of it and of its neighbour,
+		for each channel of each column	*/
+	index = (int*)malloc( row_len * 2 * sizeof(int) );
+	weight = (float*)malloc( row_len * 6 * sizeof(float) );
+	if( (NULL == index) || (NULL == weight) )
+	{
+		free( index );
+		free( weight );
+		return 0;
+	}
+	h_rows[0][0] = weight + row_len * 2;
+	h_rows[0][1] = weight + row_len * 3;
+	h_rows[1][0] = weight + row_len * 4;
+	h_rows[1][1] = weight + row_len * 5;
+	h_row[0] = h_row[1] = -1;
+	for ( x = 0; x < resampled_width; ++x )
+	{
+		float samplex = x * dx;
+		int intx = (int)samplex;
+		if( intx > width - 2 ) { intx = width - 2; }
+		samplex -= intx;
+		for ( c = 0; c < channels; ++c )
+		{
+			/*	a 1 pixel wide image has no left neighbour, but then its weight is 0	*/
+			index[x*channels+c] = (intx < 0) ? c : intx * channels + c;
+			index[row_len+x*channels+c] = (intx + 1) * channels + c;
+			weight[x*channels+c] = 1.0f - samplex;
+			weight[row_len+x*channels+c] = samplex;
+		}
+	}
+    for ( y = first_row; y < first_row + rows; ++y )
     {
     	/* find the base y index and fractional offset from that	*/
-    	float sampley = y * dy;
+    	float sampley = y * dy, not_sampley;
     	int inty = (int)sampley;
-    	/*	if( inty < 0 ) { inty = 0; } else	*/
+    	const float *h00, *h01, *h10, *h11;
+    	unsigned char *out = resampled + y * row_len;
 		if( inty > height - 2 ) { inty = height - 2; }
 		sampley -= inty;
-        for ( x = 0; x < resampled_width; ++x )
-        {
-			float samplex = x * dx;
-			int intx = (int)samplex;
-			int base_index;
-			/* find the base x index and fractional offset from that	*/
-			/*	if( intx < 0 ) { intx = 0; } else	*/
-			if( intx > width - 2 ) { intx = width - 2; }
-			samplex -= intx;
-			/*	base index into the original image	*/
-			base_index = (inty * width + intx) * channels;
-            for ( c = 0; c < channels; ++c )
-            {
-            	/*	do the sampling	*/
+		not_sampley = 1.0f - sampley;
+		/*	the two source rows, weighted for each column; a 1 pixel tall
+			image has no row above, but then its weight is 0	*/
+		need[0] = (inty < 0) ? 0 : inty;
+		need[1] = inty + 1;
+		for ( i = 0; i < 2; ++i )
+		{
+			slot[i] = (h_row[0] == need[i]) ? 0 : (h_row[1] == need[i]) ? 1 : -1;
+		}
+		for ( i = 0; i < 2; ++i )
+		{
+			if( slot[i] < 0 )
+			{
+				/*	replace a row that isn't needed	*/
+				const unsigned char *src = orig + need[i] * width * channels;
+				float *h0, *h1;
+				int ch = 0;
+				slot[i] = ((h_row[0] == need[0]) || (h_row[0] == need[1])) ? 1 : 0;
+				h0 = h_rows[slot[i]][0];
+				h1 = h_rows[slot[i]][1];
+				for ( x = 0; x < row_len; ++x )
+				{
+					float a = src[index[x]], b = src[index[row_len+x]];
+					if( gamma && (ch == alpha) )
+					{
+						a *= 257.0f;
+						b *= 257.0f;
+					} else if( gamma )
+					{
+						a = sRGB_to_linear_LUT[src[index[x]]];
+						b = sRGB_to_linear_LUT[src[index[row_len+x]]];
+					}
+					h0[x] = a * weight[x];
+					h1[x] = b * weight[row_len+x];
+					if( ++ch == channels ) { ch = 0; }
+				}
+				h_row[slot[i]] = need[i];
+				if( need[0] == need[1] ) { slot[1-i] = slot[i]; }
+			}
+		}
+		h00 = h_rows[slot[0]][0];
+		h01 = h_rows[slot[0]][1];
+		h10 = h_rows[slot[1]][0];
+		h11 = h_rows[slot[1]][1];
+		x = 0;
+		if( !gamma )
+		{
+#ifdef IMAGE_HELPER_AVX2
+			if( avx2 )
+			{
+				x = up_scale_blend_avx2( h00, h01, h10, h11, not_sampley, sampley, row_len, out );
+			}
+#endif
+#ifdef __SSE2__
+			const __m128 half = _mm_set1_ps( 0.5f ),
+				wy0 = _mm_set1_ps( not_sampley ), wy1 = _mm_set1_ps( sampley );
+			for ( ; x + 8 <= row_len; x += 8 )
+			{
+				__m128 v0 = half, v1 = half;
+				v0 = _mm_add_ps( v0, _mm_mul_ps( _mm_loadu_ps( h00 + x ), wy0 ) );
+				v1 = _mm_add_ps( v1, _mm_mul_ps( _mm_loadu_ps( h00 + x + 4 ), wy0 ) );
+				v0 = _mm_add_ps( v0, _mm_mul_ps( _mm_loadu_ps( h01 + x ), wy0 ) );
+				v1 = _mm_add_ps( v1, _mm_mul_ps( _mm_loadu_ps( h01 + x + 4 ), wy0 ) );
+				v0 = _mm_add_ps( v0, _mm_mul_ps( _mm_loadu_ps( h10 + x ), wy1 ) );
+				v1 = _mm_add_ps( v1, _mm_mul_ps( _mm_loadu_ps( h10 + x + 4 ), wy1 ) );
+				v0 = _mm_add_ps( v0, _mm_mul_ps( _mm_loadu_ps( h11 + x ), wy1 ) );
+				v1 = _mm_add_ps( v1, _mm_mul_ps( _mm_loadu_ps( h11 + x + 4 ), wy1 ) );
+				{
+					const __m128i w = _mm_packs_epi32( _mm_cvttps_epi32( v0 ), _mm_cvttps_epi32( v1 ) );
+					_mm_storel_epi64( (__m128i*)(out + x), _mm_packus_epi16( w, w ) );
+				}
+			}
+#endif
+			for ( ; x < row_len; ++x )
+			{
+				/*	do the sampling	*/
+				float value = 0.5f;
+				value += h00[x] * not_sampley;
+				value += h01[x] * not_sampley;
+				value += h10[x] * sampley;
+				value += h11[x] * sampley;
+				/*	save the new value	*/
+				out[x] = (unsigned char)(value);
+			}
+		} else
+		{
+			for ( ; x < row_len; ++x )
+			{
 				float value = 0.5f;
-				value += orig[base_index]
-							*(1.0f-samplex)*(1.0f-sampley);
-				value += orig[base_index+channels]
-							*(samplex)*(1.0f-sampley);
-				value += orig[base_index+width*channels]
-							*(1.0f-samplex)*(sampley);
-				value += orig[base_index+width*channels+channels]
-							*(samplex)*(sampley);
-				/*	move to the next channel	*/
-				++base_index;
-            	/*	save the new value	*/
-            	resampled[y*resampled_width*channels+x*channels+c] =
-						(unsigned char)(value);
-            }
-        }
+				value += h00[x] * not_sampley;
+				value += h01[x] * not_sampley;
+				value += h10[x] * sampley;
+				value += h11[x] * sampley;
+				if( value > 65535.0f ) { value = 65535.0f; }
+				out[x] = ((x % channels) == alpha) ?
+						(unsigned char)(((unsigned int)value * 255 + 32767) / 65535) :
+						linear_to_sRGB( (unsigned int)value );
+			}
+		}
     }
+	free( index );
+	free( weight );
     /*	done	*/
     return 1;
 }
@@ -91,8 +426,92 @@ int
 	)
 {
 	int mip_width, mip_height;
-	int i, j, c;
+	int i, j, c, u, v;
+	int u_block, v_block, block_area, row_len;
+	unsigned int *sums;
+
+	/*	error check	*/
+	if( (width < 1) || (height < 1) ||
+		(channels < 1) || (orig == NULL) ||
+		(resampled == NULL) ||
+		(block_size_x < 1) || (block_size_y < 1) )
+	{
+		/*	nothing to do	*/
+		return 0;
+	}
+	mip_width = width / block_size_x;
+	mip_height = height / block_size_y;
+	if( mip_width < 1 )
+	{
+		mip_width = 1;
+	}
+	if( mip_height < 1 )
+	{
+		mip_height = 1;
+	}
+	/*	do a bit of checking so we don't over-run the boundaries
+		(necessary for non-square textures!)	*/
+	u_block = (block_size_x > width) ? width : block_size_x;
+	v_block = (block_size_y > height) ? height : block_size_y;
+	block_area = u_block*v_block;
+	/*	a row of output pixels at a time: sum the block's rows, then
+		the columns of each block	*/
+	row_len = ((mip_width - 1)*block_size_x + u_block)*channels;
+	sums = (unsigned int*)malloc( row_len * sizeof(unsigned int) );
+	if( NULL == sums )
+	{
+		return 0;
+	}
+	for( j = 0; j < mip_height; ++j )
+	{
+		memset( sums, 0, row_len * sizeof(unsigned int) );
+		for( v = 0; v < v_block; ++v )
+		{
+			const unsigned char *row = orig + (j*block_size_y + v)*width*channels;
+			for( i = 0; i < row_len; ++i )
+			{
+				sums[i] += row[i];
+			}
+		}
+		for( i = 0; i < mip_width; ++i )
+		{
+			const unsigned int *sum = sums + i*block_size_x*channels;
+			for( c = 0; c < channels; ++c )
+			{
+				/*	note: start the sum at the rounding value, not at 0	*/
+				unsigned int sum_value = block_area >> 1;
+				for( u = 0; u < u_block; ++u )
+				{
+					sum_value += sum[u*channels + c];
+				}
+				resampled[j*mip_width*channels + i*channels + c] = sum_value / block_area;
+			}
+		}
+	}
+	free( sums );
+	return 1;
+}
+
+int
+	mipmap_image_gamma
+	(
+		const unsigned char* const orig,
+		int width, int height, int channels,
+		unsigned char* resampled,
+		int block_size_x, int block_size_y,
+		int gamma
+	)
+{
+	int mip_width, mip_height;
+	int i, j, c, u, v;
+	int u_block, v_block, alpha, row_len;
+	double block_area, *sums;
 
+	if( !gamma )
+	{
+		return mipmap_image( orig, width, height, channels,
+				resampled, block_size_x, block_size_y );
+	}
 	/*	error check	*/
 	if( (width < 1) || (height < 1) ||
 		(channels < 1) || (orig == NULL) ||
@@ -112,42 +531,402 @@ int
 	{
 		mip_height = 1;
 	}
+	u_block = (block_size_x > width) ? width : block_size_x;
+	v_block = (block_size_y > height) ? height : block_size_y;
+	block_area = (double)u_block*v_block;
+	alpha = alpha_channel( channels );
+	/*	as mipmap_image(), but summing linear values; doubles, as a
+		big block of 16 bit values could overflow an unsigned int	*/
+	row_len = ((mip_width - 1)*block_size_x + u_block)*channels;
+	sums = (double*)malloc( row_len * sizeof(double) );
+	if( NULL == sums )
+	{
+		return 0;
+	}
 	for( j = 0; j < mip_height; ++j )
 	{
+		for( i = 0; i < row_len; ++i )
+		{
+			sums[i] = 0.0;
+		}
+		for( v = 0; v < v_block; ++v )
+		{
+			const unsigned char *row = orig + (j*block_size_y + v)*width*channels;
+			for( i = 0, c = 0; i < row_len; ++i )
+			{
+				sums[i] += (c == alpha) ? row[i] : sRGB_to_linear_LUT[row[i]];
+				if( ++c == channels ) { c = 0; }
+			}
+		}
 		for( i = 0; i < mip_width; ++i )
 		{
+			const double *sum = sums + i*block_size_x*channels;
 			for( c = 0; c < channels; ++c )
 			{
-				const int index = (j*block_size_y)*width*channels + (i*block_size_x)*channels + c;
-				int sum_value;
-				int u,v;
-				int u_block = block_size_x;
-				int v_block = block_size_y;
-				int block_area;
-				/*	do a bit of checking so we don't over-run the boundaries
-					(necessary for non-square textures!)	*/
-				if( block_size_x * (i+1) > width )
+				double sum_value = 0.0;
+				for( u = 0; u < u_block; ++u )
+				{
+					sum_value += sum[u*channels + c];
+				}
+				sum_value = sum_value / block_area + 0.5;
+				resampled[j*mip_width*channels + i*channels + c] = (c == alpha) ?
+						(unsigned char)sum_value :
+						linear_to_sRGB( (unsigned int)sum_value );
+			}
+		}
+	}
+	free( sums );
+	return 1;
+}
+
+/*
+	MIPmap chains are made by summing each level from the one before.
+	A pixel of each level stores the sum of the pixels of the original
+	it covers, so rounding only happens when it is written out, and the
+	result is what mipmap_image() of the original would give.  Past
+	2048x2048 blocks the sums would overflow, so they are then scaled
+	down to keep 22 bits (14 for gamma correction's 16 bit linear values).
+*/
+
+static int is_pot( int x ) { return (x > 0) && !(x & (x - 1)); }
+
+static int level_size( int size, int level ) { return (size >> level) ? (size >> level) : 1; }
+
+static int max_kept_shift( int gamma ) { return gamma ? 14 : 22; }
+
+/*	how many of the original pixels, log 2, a stored sum of a level is of	*/
+static int level_shift( int width, int height, int level, int gamma )
+{
+	int shift = 0, l;
+	for( l = 1; l <= level; ++l )
+	{
+		shift += (level_size( width, l - 1 ) > 1) + (level_size( height, l - 1 ) > 1);
+		if( shift > max_kept_shift( gamma ) )
+		{
+			shift = max_kept_shift( gamma );
+		}
+	}
+	return shift;
+}
+
+/*	makes a row of a level from one or two rows (b is NULL when the
+	level before is 1 pixel tall) of the stored sums of the level before	*/
+static void mipmap_sums_row
+	(
+		const unsigned int *a, const unsigned int *b,
+		int width, int channels, int gamma, int in_shift,
+		unsigned int *stored, unsigned char *out
+	)
+{
+	const int pair = (width > 1) ? channels : 0;
+	const int mip_width = (width > 1) ? width / 2 : 1;
+	const int out_shift = in_shift + (pair ? 1 : 0) + (b ? 1 : 0);
+	const int keep = (out_shift > max_kept_shift( gamma )) ? max_kept_shift( gamma ) : out_shift;
+	const int drop = out_shift - keep;
+	const unsigned int out_half = (1u << out_shift) >> 1, drop_half = (1u << drop) >> 1;
+	const int alpha = alpha_channel( channels );
+	int i, c;
+	for( i = 0; i < mip_width; ++i )
+	{
+		for( c = 0; c < channels; ++c )
+		{
+			unsigned int sum = a[c] + (pair ? a[c+pair] : 0), value;
+			if( b )
+			{
+				sum += b[c] + (pair ? b[c+pair] : 0);
+			}
+			value = (sum + out_half) >> out_shift;
+			if( gamma )
+			{
+				value = (c == alpha) ? (value * 255 + 32767) / 65535 : linear_to_sRGB( value );
+			}
+			*out++ = (unsigned char)value;
+			*stored++ = (sum + drop_half) >> drop;
+		}
+		a += channels + pair;
+		if( b )
+		{
+			b += channels + pair;
+		}
+	}
+}
+
+/*	level 1 from the original's bytes, without gamma correction	*/
+static void mipmap_bytes_row
+	(
+		const unsigned char *a, const unsigned char *b,
+		int width, int channels,
+		unsigned short *column_sums,
+		unsigned int *stored, unsigned char *out
+	)
+{
+	const int row_len = width * channels;
+	const int pair = (width > 1) ? channels : 0;
+	const int mip_width = (width > 1) ? width / 2 : 1;
+	const int shift = (pair ? 1 : 0) + (b ? 1 : 0);
+	const unsigned int half = (1u << shift) >> 1;
+	int i = 0, c;
+#ifdef IMAGE_HELPER_AVX2
+	const int avx2 = has_avx2();
+#endif
+	/*	sum the two rows	*/
+	if( b )
+	{
+#ifdef IMAGE_HELPER_AVX2
+		if( avx2 )
+		{
+			i = mipmap_add_rows_avx2( a, b, row_len, column_sums );
+		}
+#endif
+#ifdef __SSE2__
+		const __m128i zero = _mm_setzero_si128();
+		for( ; i + 16 <= row_len; i += 16 )
+		{
+			const __m128i va = _mm_loadu_si128( (const __m128i*)(a + i) ),
+				vb = _mm_loadu_si128( (const __m128i*)(b + i) );
+			_mm_storeu_si128( (__m128i*)(column_sums + i),
+					_mm_add_epi16( _mm_unpacklo_epi8( va, zero ), _mm_unpacklo_epi8( vb, zero ) ) );
+			_mm_storeu_si128( (__m128i*)(column_sums + i + 8),
+					_mm_add_epi16( _mm_unpackhi_epi8( va, zero ), _mm_unpackhi_epi8( vb, zero ) ) );
+		}
+#endif
+		for( ; i < row_len; ++i )
+		{
+			column_sums[i] = a[i] + b[i];
+		}
+	} else
+	{
+		for( ; i < row_len; ++i )
+		{
+			column_sums[i] = a[i];
+		}
+	}
+	/*	then the pairs of pixels	*/
+	i = 0;
+#ifdef IMAGE_HELPER_AVX2
+	if( avx2 && pair && (channels != 3) )
+	{
+		i = mipmap_pairs_avx2( column_sums, mip_width, channels, shift, stored, out );
+	}
+#endif
+#ifdef __SSE2__
+	if( pair && (channels != 3) )
+	{
+		const __m128i zero = _mm_setzero_si128(), ones = _mm_set1_epi16( 1 ),
+			rounding16 = _mm_set1_epi16( (short)half ), rounding32 = _mm_set1_epi32( (int)half );
+		const __m128i count = _mm_cvtsi32_si128( shift );
+		if( 4 == channels )
+		{
+			/*	two output pixels from four	*/
+			for( ; i + 2 <= mip_width; i += 2 )
+			{
+				const __m128i p01 = _mm_loadu_si128( (const __m128i*)(column_sums + i*8) ),
+					p23 = _mm_loadu_si128( (const __m128i*)(column_sums + i*8 + 8) ),
+					sum = _mm_add_epi16( _mm_unpacklo_epi64( p01, p23 ), _mm_unpackhi_epi64( p01, p23 ) ),
+					value = _mm_srl_epi16( _mm_add_epi16( sum, rounding16 ), count );
+				_mm_storeu_si128( (__m128i*)(stored + i*4), _mm_unpacklo_epi16( sum, zero ) );
+				_mm_storeu_si128( (__m128i*)(stored + i*4 + 4), _mm_unpackhi_epi16( sum, zero ) );
+				_mm_storel_epi64( (__m128i*)(out + i*4), _mm_packus_epi16( value, value ) );
+			}
+		} else
+		{
+			/*	eight sums to four; two channels are first put side by side	*/
+			const int step = 4 / channels;
+			for( ; i + step <= mip_width; i += step )
+			{
+				__m128i p = _mm_loadu_si128( (const __m128i*)(column_sums + i*channels*2) ), sum, value;
+				int packed;
+				if( 2 == channels )
 				{
-					u_block = width - i*block_size_y;
+					p = _mm_shufflelo_epi16( p, _MM_SHUFFLE(3,1,2,0) );
+					p = _mm_shufflehi_epi16( p, _MM_SHUFFLE(3,1,2,0) );
 				}
-				if( block_size_y * (j+1) > height )
+				sum = _mm_madd_epi16( p, ones );
+				value = _mm_srl_epi32( _mm_add_epi32( sum, rounding32 ), count );
+				value = _mm_packs_epi32( value, value );
+				value = _mm_packus_epi16( value, value );
+				_mm_storeu_si128( (__m128i*)(stored + i*channels), sum );
+				packed = _mm_cvtsi128_si32( value );
+				memcpy( out + i*channels, &packed, 4 );
+			}
+		}
+	}
+#endif
+	for( ; i < mip_width; ++i )
+	{
+		const unsigned short *src = column_sums + i*(channels+pair);
+		for( c = 0; c < channels; ++c )
+		{
+			const unsigned int sum = src[c] + (pair ? src[c+pair] : 0);
+			out[i*channels+c] = (unsigned char)((sum + half) >> shift);
+			stored[i*channels+c] = sum;
+		}
+	}
+}
+
+/*	goes on from the stored sums of some rows of a level, making the
+	next levels' rows; scratch has room for two of those levels' rows	*/
+static void mipmap_levels
+	(
+		const unsigned int *stored,
+		int width, int height, int channels, int gamma,
+		int level, int first_row, int rows, int levels,
+		unsigned char** mips, unsigned int* sums,
+		unsigned int *scratch, int scratch_size
+	)
+{
+	int in_shift = level_shift( width, height, level, gamma );
+	int l, j;
+	unsigned int *next = scratch;
+	for( l = 1; l <= levels; ++l )
+	{
+		const int src_width = level_size( width, level + l - 1 ),
+			src_height = level_size( height, level + l - 1 ),
+			mip_width = level_size( width, level + l ),
+			mip_rows = (src_height > 1) ? rows / 2 : 1,
+			mip_first = (src_height > 1) ? first_row / 2 : 0;
+		for( j = 0; j < mip_rows; ++j )
+		{
+			const unsigned int *a = stored + ((src_height > 1) ? 2*j : 0)*src_width*channels;
+			mipmap_sums_row( a, (src_height > 1) ? a + src_width*channels : NULL,
+					src_width, channels, gamma, in_shift,
+					next + j*mip_width*channels,
+					mips[l-1] + (mip_first + j)*mip_width*channels );
+		}
+		in_shift = level_shift( width, height, level + l, gamma );
+		stored = next;
+		next = (next == scratch) ? scratch + scratch_size : scratch;
+		first_row = mip_first;
+		rows = mip_rows;
+	}
+	if( sums )
+	{
+		const int mip_width = level_size( width, level + levels );
+		memcpy( sums + first_row*mip_width*channels, stored,
+				rows*mip_width*channels*sizeof(unsigned int) );
+	}
+}
+
+int
+	mipmap_image_band
+	(
+		const unsigned char* const orig,
+		int width, int height, int channels,
+		int gamma,
+		int first_row, int rows, int levels,
+		unsigned char** mips,
+		unsigned int* sums
+	)
+{
+	const int band = ((1 << levels) < height) ? (1 << levels) : height;
+	const int mip_width = level_size( width, 1 ),
+		mip_rows = (height > 1) ? rows / 2 : 1,
+		mip_first = (height > 1) ? first_row / 2 : 0;
+	const int row_len = width * channels;
+	unsigned int *stored, *scratch;
+	void *row_scratch;
+	int scratch_size, j, i;
+
+	/*	error check	*/
+	if( !is_pot( width ) || !is_pot( height ) ||
+		(channels < 1) || (channels > 4) ||
+		(orig == NULL) || (mips == NULL) ||
+		(levels < 1) || (levels > 30) ||
+		(first_row < 0) || (rows < 1) || (first_row + rows > height) ||
+		(first_row % band) || (rows % band) )
+	{
+		/*	nothing to do	*/
+		return 0;
+	}
+	/*	level 1 in stored, and room for two levels after it	*/
+	scratch_size = level_size( mip_width, 1 ) * ((mip_rows > 1) ? mip_rows / 2 : 1) * channels;
+	stored = (unsigned int*)malloc( (mip_width*mip_rows*channels + 2*scratch_size) * sizeof(unsigned int) );
+	row_scratch = malloc( row_len * (gamma ? 2*sizeof(unsigned int) : sizeof(unsigned short)) );
+	if( (NULL == stored) || (NULL == row_scratch) )
+	{
+		free( stored );
+		free( row_scratch );
+		return 0;
+	}
+	scratch = stored + mip_width*mip_rows*channels;
+	for( j = 0; j < mip_rows; ++j )
+	{
+		const unsigned char *a = orig + (first_row + ((height > 1) ? 2*j : 0))*row_len,
+			*b = (height > 1) ? a + row_len : NULL;
+		unsigned int *row_stored = stored + j*mip_width*channels;
+		unsigned char *out = mips[0] + (mip_first + j)*mip_width*channels;
+		if( gamma )
+		{
+			/*	to linear, and go on as if these were the sums of a level	*/
+			const int alpha = alpha_channel( channels );
+			unsigned int *la = (unsigned int*)row_scratch, *lb = la + row_len;
+			for( i = 0; i < row_len; ++i )
+			{
+				la[i] = sRGB_to_linear_LUT[a[i]];
+				if( b )
 				{
-					v_block = height - j*block_size_y;
+					lb[i] = sRGB_to_linear_LUT[b[i]];
 				}
-				block_area = u_block*v_block;
-				/*	for this pixel, see what the average
-					of all the values in the block are.
-					note: start the sum at the rounding value, not at 0	*/
-				sum_value = block_area >> 1;
-				for( v = 0; v < v_block; ++v )
-				for( u = 0; u < u_block; ++u )
+			}
+			for( i = alpha; (alpha >= 0) && (i < row_len); i += channels )
+			{
+				la[i] = a[i] * 257u;
+				if( b )
 				{
-					sum_value += orig[index + v*width*channels + u*channels];
+					lb[i] = b[i] * 257u;
 				}
-				resampled[j*mip_width*channels + i*channels + c] = sum_value / block_area;
 			}
+			mipmap_sums_row( la, b ? lb : NULL, width, channels, gamma, 0, row_stored, out );
+		} else
+		{
+			mipmap_bytes_row( a, b, width, channels, (unsigned short*)row_scratch, row_stored, out );
 		}
 	}
+	free( row_scratch );
+	mipmap_levels( stored, width, height, channels, gamma,
+			1, mip_first, mip_rows, levels - 1, mips + 1, sums,
+			scratch, scratch_size );
+	free( stored );
+	return 1;
+}
+
+int
+	mipmap_image_sums
+	(
+		const unsigned int* const sums,
+		int width, int height, int channels,
+		int gamma,
+		int level, int levels,
+		unsigned char** mips
+	)
+{
+	const int rows = level_size( height, level );
+	int scratch_size;
+	unsigned int *scratch;
+
+	/*	error check	*/
+	if( !is_pot( width ) || !is_pot( height ) ||
+		(channels < 1) || (channels > 4) ||
+		(sums == NULL) || (mips == NULL) ||
+		(level < 1) || (levels < 0) || (level + levels > 30) )
+	{
+		/*	nothing to do	*/
+		return 0;
+	}
+	if( 0 == levels )
+	{
+		return 1;
+	}
+	scratch_size = level_size( width, level + 1 ) * level_size( height, level + 1 ) * channels;
+	scratch = (unsigned int*)malloc( 2 * scratch_size * sizeof(unsigned int) );
+	if( NULL == scratch )
+	{
+		return 0;
+	}
+	mipmap_levels( sums, width, height, channels, gamma,
+			level, 0, rows, levels, mips, NULL,
+			scratch, scratch_size );
+	free( scratch );
 	return 1;
 }
 
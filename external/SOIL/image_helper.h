@@ -28,6 +28,23 @@ int
 		int resampled_width, int resampled_height
 	);
 
+/**
+	Upscales rows [first_row,first_row+rows) of the resampled image, so
+	that threads can each do a band of it.  With gamma non-zero the colour
+	channels are blended in linear light rather than as sRGB; otherwise
+	the result is the same as up_scale_image(), bit for bit.
+**/
+int
+	up_scale_image_band
+	(
+		const unsigned char* const orig,
+		int width, int height, int channels,
+		unsigned char* resampled,
+		int resampled_width, int resampled_height,
+		int gamma,
+		int first_row, int rows
+	);
+
 /**
 	This function downscales an image.
 	Used for creating MIPmaps,
@@ -43,6 +60,60 @@ int
 		int block_size_x, int block_size_y
 	);
 
+/**
+	As mipmap_image(), but with gamma non-zero the colour channels
+	are averaged in linear light rather than as sRGB; with gamma 0
+	it is mipmap_image().
+**/
+int
+	mipmap_image_gamma
+	(
+		const unsigned char* const orig,
+		int width, int height, int channels,
+		unsigned char* resampled,
+		int block_size_x, int block_size_y,
+		int gamma
+	);
+
+/**
+	Makes MIPmap levels 1 to levels of a power-of-two sized image of 1-4
+	channels in one pass, summing each level from the one before.  mips[i]
+	receives level i+1, (width>>(i+1)) by (height>>(i+1)) pixels (but at
+	least 1).  Without gamma each level is the same, bit for bit, as
+	mipmap_image() of the original with blocks of 2, 4, 8 ... pixels.
+	So that threads can share the work, it can do just a band of rows of
+	the original: first_row and rows must be multiples of 1<<levels, or of
+	the height if that is smaller, and only the band's rows of each level
+	are written.  If sums is not NULL it receives the band's rows of the
+	last level's sums, channels unsigned ints per pixel, for
+	mipmap_image_sums() to go on from once every band is done.
+**/
+int
+	mipmap_image_band
+	(
+		const unsigned char* const orig,
+		int width, int height, int channels,
+		int gamma,
+		int first_row, int rows, int levels,
+		unsigned char** mips,
+		unsigned int* sums
+	);
+
+/**
+	Goes on from the sums of every row of MIPmap level, that
+	mipmap_image_band() left, making the next levels levels in mips.
+	width and height are the original's.
+**/
+int
+	mipmap_image_sums
+	(
+		const unsigned int* const sums,
+		int width, int height, int channels,
+		int gamma,
+		int level, int levels,
+		unsigned char** mips
+	);
+
 /**
 	This function takes the RGB components of the image
 	and scales each channel from [0,255] to [16,235].